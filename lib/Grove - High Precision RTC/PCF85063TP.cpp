@@ -25,6 +25,7 @@
 
 #include <Wire.h>
 #include "PCF85063TP.h"
+#include <jigtrace.h>
 
 uint8_t PCF85063TP::decToBcd(uint8_t val) {
     return ((val / 10 * 16) + (val % 10));
@@ -35,68 +36,83 @@ uint8_t PCF85063TP::bcdToDec(uint8_t val) {
     return ((val / 16 * 10) + (val % 16));
 }
 
+PCF85063TP::PCF85063TP(void) {
+    pWire = NULL;
+    _hold = false;
+    _pending = 0;
+    invalidateShadow();
+    resetBusStats();
+    _maxErrorMs = 0;
+    _maxAgeMs = PCF85063TP_MAX_AGE_MS;
+    _driftPpm = PCF85063TP_DRIFT_PPM;
+    invalidateTime();
+}
+
 void PCF85063TP::begin(TwoWire *_pWire) {
     // Wire.begin();
     pWire = _pWire;
     pWire->begin();
+    // The chip may have been swapped, fill the shadow again in one read
+    _pending = 0;
+    invalidateShadow();
+    invalidateTime();
+    uint8_t regs[REG_RAM + 1];
+    readRegs(REG_CTRL1, regs, sizeof(regs));
     cap_sel(CAP_SEL_12_5PF);  // CAP_SEL bit setting 12.5pF
 
 }
 /*Function: The clock timing will start */
 void PCF85063TP::startClock(void) {      // set the ClockHalt bit low to start the rtc
-    uint8_t data;
-    pWire->beginTransmission(PCF85063TP_I2C_ADDRESS);
-    pWire->write((uint8_t)0x00);                      // Register 0x00 holds the oscillator start/stop bit
-    pWire->endTransmission();
-    pWire->requestFrom(PCF85063TP_I2C_ADDRESS, 1);
-    data = pWire->read() &
-           ~0x20;       // save actual control_1 regitser and AND sec with bit 7 (sart/stop bit) = clock started
-    pWire->beginTransmission(PCF85063TP_I2C_ADDRESS);
-    pWire->write((uint8_t)0x00);
-    pWire->write((uint8_t)data);                    // write seconds back and start the clock
-    pWire->endTransmission();
+    JIG_TRACE_SCOPE("PCF startClock");
+    updateReg(REG_CTRL1, REG_CTRL1_STOP, 0);
+    invalidateTime();                      // millis() kept running while the clock stood
 }
 /*Function: The clock timing will stop */
 void PCF85063TP::stopClock(void) {       // set the ClockHalt bit high to stop the rtc
-    uint8_t data;
-    pWire->beginTransmission(PCF85063TP_I2C_ADDRESS);
-    pWire->write((uint8_t)0x00);                      // Register 0x00 holds the oscillator start/stop bit
-    pWire->endTransmission();
-    pWire->requestFrom(PCF85063TP_I2C_ADDRESS, 1);
-    data = pWire->read() |
-           0x20;       // save actual control_1 regitser and AND sec with bit 7 (sart/stop bit) = clock started
-    pWire->beginTransmission(PCF85063TP_I2C_ADDRESS);
-    pWire->write((uint8_t)0x00);
-    pWire->write((uint8_t)data);                    // write seconds back and stop the clock
-    pWire->endTransmission();
+    JIG_TRACE_SCOPE("PCF stopClock");
+    updateReg(REG_CTRL1, REG_CTRL1_STOP, REG_CTRL1_STOP);
+    invalidateTime();
 }
 /****************************************************************/
-/*Function: Read time and date from RTC  */
+/*Function: Read time and date from RTC, or extrapolate the last read
+  with millis() while the time cache allows it (see setTimeCache()) */
 void PCF85063TP::getTime() {
-    // Reset the register pointer
-    pWire->beginTransmission(PCF85063TP_I2C_ADDRESS);
-    pWire->write((uint8_t)0x04);
-    pWire->endTransmission();
-    pWire->requestFrom(PCF85063TP_I2C_ADDRESS, 7);
-    // A few of these need masks because certain bits are control bits
-    second     = bcdToDec(pWire->read() & 0x7f);
-    minute     = bcdToDec(pWire->read());
-    hour     = bcdToDec(pWire->read() & 0x3f);// Need to change this if 12 hour am/pm
-    dayOfMonth = bcdToDec(pWire->read());
-    dayOfWeek  = bcdToDec(pWire->read());
-    month      = bcdToDec(pWire->read());
-    year     = bcdToDec(pWire->read());
+    JIG_TRACE_SCOPE("PCF getTime");
+    uint32_t now = millis();
+    if (!_timeValid || (_maxErrorMs == 0) || ((now - _readMs) >= _maxAgeMs) || (timeError(now) > _maxErrorMs)) {
+        if (!readTime()) {
+            return;
+        }
+        now = _readMs;
+    } else {
+        _bus.timeCached++;
+    }
+    // Whole seconds since the ref second started, taking the middle of its window
+    int32_t since = (int32_t)(now - (_edgeLo + (_edgeHi - _edgeLo) / 2));
+    int32_t n = (since < 0) ? 0 : since / 1000;
+    if (_maxErrorMs == 0) {
+        n = 0;                                // plain chip read, as before the cache
+    } else if ((n < _lastN) && (_lastN - n <= 1)) {
+        n = _lastN;                           // a narrower window must not step back a second
+    }
+    _lastN = n;
+    fillTime(n);
 }
 /*******************************************************************/
-/*Frunction: Write the time that includes the date to the RTC chip */
+/*Frunction: Write the time that includes the date to the RTC chip.
+  Pending register writes go out in the same burst where they border it */
 void PCF85063TP::setTime() {
-    writeReg(REG_SEC, decToBcd(second));// 0 to bit 7 starts the clock, bit 8 is OS reg
-    writeReg(REG_MIN, decToBcd(minute));
-    writeReg(REG_HOUR, decToBcd(hour));  // If you want 12 hour am/pm you need to set bit 6
-    writeReg(REG_DAY_MONTH, decToBcd(dayOfMonth));
-    writeReg(REG_DAY_WEEK, decToBcd(dayOfWeek));
-    writeReg(REG_MON, decToBcd(month));
-    writeReg(REG_YEAR, decToBcd(year));
+    uint8_t time[TIME_REGS];
+    time[0] = decToBcd(second);      // 0 to bit 7 starts the clock, bit 8 is OS reg
+    time[1] = decToBcd(minute);
+    time[2] = decToBcd(hour);        // If you want 12 hour am/pm you need to set bit 6
+    time[3] = decToBcd(dayOfMonth);
+    time[4] = decToBcd(dayOfWeek);
+    time[5] = decToBcd(month);
+    time[6] = decToBcd(year);
+    _hold = false;
+    writePending(time);
+    invalidateTime();
 }
 void PCF85063TP::fillByHMS(uint8_t _hour, uint8_t _minute, uint8_t _second) {
     // assign variables
@@ -114,10 +130,13 @@ void PCF85063TP::fillDayOfWeek(uint8_t _dow) {
 }
 
 void PCF85063TP::reset() {
-    pWire->beginTransmission(PCF85063TP_I2C_ADDRESS);
-    pWire->write((uint8_t)0x00);
-    pWire->write(decToBcd(0x10));// software reset at bit 4
-    pWire->endTransmission();
+    JIG_TRACE_SCOPE("PCF reset");
+    uint8_t data = decToBcd(0x10);   // software reset at bit 4
+    writeRegs(REG_CTRL1, &data, 1);
+    // All registers are back at their defaults
+    _pending = 0;
+    invalidateShadow();
+    invalidateTime();
 }
 
 /*
@@ -153,7 +172,7 @@ void PCF85063TP::setcalibration(int mode, float Fmeas) {
     }
 
     uint8_t data = (mode << 7) & 0x80 | ((int)(offset + 0.5) & 0x7f);
-    writeReg(PCF85063TP_OFFSET, data);
+    updateReg(PCF85063TP_OFFSET, 0xFF, data);
 }
 
 
@@ -163,7 +182,7 @@ uint8_t PCF85063TP::readCalibrationReg(void) {
 
 
 void PCF85063TP::setRam(uint8_t value) {
-    writeReg(REG_RAM, value);
+    updateReg(REG_RAM, 0xFF, value);
 }
 
 uint8_t PCF85063TP::readRamReg(void) {
@@ -180,30 +199,320 @@ uint8_t PCF85063TP::readRamReg(void) {
     @return: value of CAP_SEL bit
 */
 uint8_t PCF85063TP::cap_sel(uint8_t value) {
-    uint8_t control_1 = readReg(REG_CTRL1);
-    control_1 = (control_1 & 0xFE) | (0x01 & value);
-    writeReg(REG_CTRL1, control_1);
+    updateReg(REG_CTRL1, 0x01, value);
 
     return readReg(REG_CTRL1) & 0x01;
 }
 
+/*
+    @brief: keep register writes in the shadow until flush(), which
+           sends them in as few bursts as the register map allows
+*/
+void PCF85063TP::holdWrites(void) {
+    _hold = true;
+}
+
+/*
+    @return: false if a write was not acknowledged
+*/
+bool PCF85063TP::flush(void) {
+    _hold = false;
+    return writePending(NULL);
+}
+
+/*
+    @brief: forget the cached registers, the next access goes to the chip.
+           Writes held with holdWrites() stay pending.
+*/
+void PCF85063TP::invalidateShadow(void) {
+    _shadowValid = _pending;
+}
+
+/*
+    @brief: serve getTime() from millis() between chip reads
+    @parm:
+         maxErrorMs: the chip is read again once the extrapolated time may be
+                     off by more than this, 0 reads it on every call
+         maxAgeMs: the chip is read at least this often, catches a clock set
+                   by someone else. At most a day.
+         driftPpm: worst case rate difference of millis() and the RTC
+*/
+void PCF85063TP::setTimeCache(uint16_t maxErrorMs, uint32_t maxAgeMs, uint16_t driftPpm) {
+    _maxErrorMs = maxErrorMs;
+    _maxAgeMs = (maxAgeMs > 86400000UL) ? 86400000UL : maxAgeMs;
+    _driftPpm = driftPpm;
+}
+
+/*
+    @brief: the next getTime() reads the chip and starts a new estimate
+           of where its seconds begin
+*/
+void PCF85063TP::invalidateTime(void) {
+    _timeValid = false;
+    _lastN = 0;
+}
+
+/*
+    @return: how far off an extrapolated getTime() could be now in ms,
+             0xFFFF without a chip read to go from
+*/
+uint16_t PCF85063TP::getTimeError(void) {
+    if (!_timeValid) {
+        return 0xFFFF;
+    }
+    uint32_t error = timeError(millis());
+    return (error > 0xFFFF) ? 0xFFFF : error;
+}
+
+PCF85063TPBusStats_t PCF85063TP::getBusStats(void) {
+    return _bus;
+}
+
+void PCF85063TP::resetBusStats(void) {
+    _bus.transactions = 0;
+    _bus.bytes = 0;
+    _bus.busUs = 0;
+    _bus.skippedWrites = 0;
+    _bus.timeReads = 0;
+    _bus.timeCached = 0;
+}
+
 
 uint8_t PCF85063TP::readReg(uint8_t reg) {
-    pWire->beginTransmission(PCF85063TP_I2C_ADDRESS);
-    pWire->write(reg & 0xFF);
-    pWire->endTransmission();
-    pWire->requestFrom(PCF85063TP_I2C_ADDRESS, 1);
+    // Shadowed registers come from the copy once known
+    if ((reg <= REG_RAM) && (_shadowValid & (1 << reg))) {
+        return _shadow[reg];
+    }
+    uint8_t data = 0xFF;
+    readRegs(reg, &data, 1);
 
-    return pWire->read();
+    return data;
 
 }
 
 void PCF85063TP::writeReg(uint8_t reg, uint8_t data) {
+    writeRegs(reg, &data, 1);
+
+}
+
+/*
+    @brief: read count registers from reg on in one request, the chip
+           increments the register address
+*/
+bool PCF85063TP::readRegs(uint8_t reg, uint8_t *buf, uint8_t count) {
+    JIG_TRACE_SCOPE("PCF readRegs");
+    uint32_t start = micros();
+    pWire->beginTransmission(PCF85063TP_I2C_ADDRESS);
+    pWire->write(reg & 0xFF);
+    uint8_t error = pWire->endTransmission();
+    _bus.transactions++;
+    _bus.bytes += 2;
+    bool good = false;
+    if (error == 0) {
+        pWire->requestFrom(PCF85063TP_I2C_ADDRESS, (int)count);
+        _bus.transactions++;
+        _bus.bytes += 1 + count;
+        if (pWire->available() == count) {
+            for (uint8_t i = 0; i < count; i++) {
+                buf[i] = pWire->read();
+                uint8_t r = reg + i;
+                if ((r <= REG_RAM) && (PCF85063TP_SHADOW_REGS & (1 << r)) && !(_pending & (1 << r))) {
+                    _shadow[r] = buf[i];
+                    _shadowValid |= 1 << r;
+                }
+            }
+            good = true;
+        }
+    }
+    _bus.busUs += micros() - start;
+    return good;
+}
+
+bool PCF85063TP::writeRegs(uint8_t reg, const uint8_t *buf, uint8_t count) {
+    JIG_TRACE_SCOPE("PCF writeRegs");
+    uint32_t start = micros();
     pWire->beginTransmission(PCF85063TP_I2C_ADDRESS);
     pWire->write(reg & 0xFF);
-    pWire->write(data & 0xFF);
-    pWire->endTransmission();
+    pWire->write(buf, count);
+    uint8_t error = pWire->endTransmission();
+    _bus.transactions++;
+    _bus.bytes += 2 + count;
+    _bus.busUs += micros() - start;
+    return (error == 0);
+}
+
+/*
+    @brief: write the pending shadow registers, and the time registers
+           when time is not NULL. Registers between two that are written
+           go along from the shadow when it knows them, so a run costs one
+           burst; Control_2 splits a run.
+*/
+bool PCF85063TP::writePending(const uint8_t *time) {
+    uint16_t want = _pending;
+    if (time != NULL) {
+        want |= ((1 << TIME_REGS) - 1) << REG_SEC;
+    }
+    uint8_t buf[REG_YEAR + 1];
+    bool good = true;
+    uint8_t reg = 0;
+    while ((want >> reg) != 0) {
+        if (!(want & (1 << reg))) {
+            reg++;
+            continue;
+        }
+        uint8_t last = reg;
+        for (uint8_t r = reg + 1; (want >> r) != 0; r++) {
+            if (want & (1 << r)) {
+                last = r;
+            } else if ((r > REG_RAM) || !(PCF85063TP_SHADOW_REGS & _shadowValid & (1 << r))) {
+                break;
+            }
+        }
+        for (uint8_t r = reg; r <= last; r++) {
+            buf[r - reg] = (r <= REG_RAM) ? _shadow[r] : time[r - REG_SEC];
+        }
+        bool written = writeRegs(reg, buf, last - reg + 1);
+        for (uint8_t r = reg; (r <= last) && (r <= REG_RAM); r++) {
+            _pending &= ~(1 << r);
+            if (!written) {
+                _shadowValid &= ~(1 << r);    // unknown how far the write got
+            }
+        }
+        good = good && written;
+        reg = last + 1;
+    }
+    return good;
+}
 
+/*
+    @brief: change the mask bits of a shadowed register. Nothing is sent
+           when the register already holds the value, and only at flush()
+           while writes are held.
+*/
+void PCF85063TP::updateReg(uint8_t reg, uint8_t mask, uint8_t value) {
+    uint8_t data = (readReg(reg) & ~mask) | (value & mask);
+    if ((_shadowValid & (1 << reg)) && (data == _shadow[reg])) {
+        _bus.skippedWrites++;
+        return;
+    }
+    _shadow[reg] = data;
+    _shadowValid |= 1 << reg;
+    _pending |= 1 << reg;
+    if (!_hold) {
+        writePending(NULL);
+    }
+}
+
+/*
+    @brief: read the time registers and narrow down the millis() window
+           in which the second read started
+*/
+bool PCF85063TP::readTime(void) {
+    uint8_t regs[TIME_REGS];
+    uint32_t start = millis();
+    if (!readRegs(REG_SEC, regs, TIME_REGS)) {
+        _timeValid = false;
+        return false;
+    }
+    uint32_t end = millis();
+    _bus.timeReads++;
+    // A few of these need masks because certain bits are control bits
+    uint32_t sod = bcdToDec(regs[0] & 0x7f) + bcdToDec(regs[1]) * 60UL +
+                   bcdToDec(regs[2] & 0x3f) * 3600UL; // Need to change this if 12 hour am/pm
+    uint8_t day = bcdToDec(regs[3]);
+    uint8_t dow = bcdToDec(regs[4]);
+    uint8_t mon = bcdToDec(regs[5]);
+    uint16_t yr = bcdToDec(regs[6]);
+
+    // The registers were latched between start and end, this second began
+    // less than a second before that
+    uint32_t lo = start - 999;
+    uint32_t hi = end;
+    int32_t d = _timeValid ? secondsSinceRef(day, mon, yr, sod) : -1;
+    if (d >= 0) {
+        // Carry the old window over, widened by the drift since the last read
+        uint32_t drift = (uint64_t)(end - _readMs) * _driftPpm / 1000000UL;
+        uint32_t oldLo = _edgeLo + d * 1000UL - drift;
+        uint32_t oldHi = _edgeHi + d * 1000UL + drift;
+        if ((int32_t)(oldLo - lo) > 0) {
+            lo = oldLo;
+        }
+        if ((int32_t)(oldHi - hi) < 0) {
+            hi = oldHi;
+        }
+        if ((int32_t)(hi - lo) < 0) {
+            lo = start - 999;                 // the windows miss each other: clock set or stopped
+            hi = end;
+        }
+        _lastN -= d;
+    } else {
+        _lastN = 0;
+    }
+    _edgeLo = lo;
+    _edgeHi = hi;
+    _readMs = end;
+    _refSod = sod;
+    _refDay = day;
+    _refMonth = mon;
+    _refYear = yr;
+    _refDow = dow;
+    _timeValid = true;
+    return true;
+}
+
+/*
+    @return: seconds from the ref second to the given one, -1 when it is
+             earlier or more than a day later
+*/
+int32_t PCF85063TP::secondsSinceRef(uint8_t day, uint8_t mon, uint16_t yr, uint32_t sod) {
+    if ((day == _refDay) && (mon == _refMonth) && (yr == _refYear)) {
+        return (sod >= _refSod) ? (int32_t)(sod - _refSod) : -1;
+    }
+    uint8_t nextDayOfMonth = _refDay;
+    uint8_t nextMonth = _refMonth;
+    uint16_t nextYear = _refYear;
+    uint8_t nextDow = _refDow;
+    nextDay(nextDayOfMonth, nextMonth, nextYear, nextDow);
+    if ((day == nextDayOfMonth) && (mon == nextMonth) && (yr == nextYear)) {
+        return 86400L + sod - _refSod;
+    }
+    return -1;
+}
+
+uint32_t PCF85063TP::timeError(uint32_t now) {
+    return (_edgeHi - _edgeLo) / 2 + (uint64_t)(now - _readMs) * _driftPpm / 1000000UL;
+}
+
+/*
+    @brief: time and date n seconds after the ref second
+*/
+void PCF85063TP::fillTime(uint32_t n) {
+    uint32_t sod = _refSod + n;
+    second = sod % 60;
+    minute = sod / 60 % 60;
+    hour = sod / 3600 % 24;
+    dayOfMonth = _refDay;
+    month = _refMonth;
+    year = _refYear;
+    dayOfWeek = _refDow;
+    for (uint32_t days = sod / 86400; days > 0; days--) {
+        nextDay(dayOfMonth, month, year, dayOfWeek);
+    }
+}
+
+void PCF85063TP::nextDay(uint8_t &day, uint8_t &mon, uint16_t &yr, uint8_t &dow) {
+    static const uint8_t monthDays[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    uint8_t last = monthDays[(mon + 11) % 12] + (((mon == 2) && (yr % 4 == 0)) ? 1 : 0);
+    dow = (dow + 1) % 7;
+    if (++day <= last) {
+        return;
+    }
+    day = 1;
+    if (++mon <= 12) {
+        return;
+    }
+    mon = 1;
+    yr = (yr + 1) % 100;                     // the chip counts years 00 to 99
 }
 
 #ifdef PCF85063TP_USE_STRINGS
@@ -47,6 +47,25 @@
 #define REG_YEAR          0x0A
 #define CAP_SEL_7PF       0
 #define CAP_SEL_12_5PF    1
+#define TIME_REGS         7 // REG_SEC to REG_YEAR
+
+// Registers kept in the shadow copy: Control_1, Offset and RAM. Control_2
+// is left out, the chip sets its timer flag on its own.
+#define PCF85063TP_SHADOW_REGS ((1 << REG_CTRL1) | (1 << REG_OFFSET) | (1 << REG_RAM))
+
+// getTime() from millis() between chip reads, see setTimeCache()
+#define PCF85063TP_MAX_AGE_MS 60000 // longest time without a chip read
+#define PCF85063TP_DRIFT_PPM  50    // millis() against the RTC crystal, worst case
+
+// I2C traffic and where getTime() took the time from, see getBusStats()
+struct PCF85063TPBusStats_t {
+    uint32_t transactions;
+    uint32_t bytes;         // address bytes included
+    uint32_t busUs;
+    uint32_t skippedWrites; // register writes the shadow made unnecessary
+    uint32_t timeReads;     // getTime() calls that read the chip
+    uint32_t timeCached;    // getTime() calls served from millis()
+};
 
 #define MON 1
 #define TUE 2
@@ -62,6 +81,7 @@ class PCF85063TP {
     uint8_t bcdToDec(uint8_t val);
     TwoWire *pWire;
   public:
+    PCF85063TP(void);
     void begin(TwoWire *pWire);
     void startClock(void);
     void stopClock(void);
@@ -77,6 +97,15 @@ class PCF85063TP {
     void fillByHMS(uint8_t _hour, uint8_t _minute, uint8_t _second);
     void fillByYMD(uint16_t _year, uint8_t _month, uint8_t _day);
     void fillDayOfWeek(uint8_t _dow);
+    void holdWrites(void);
+    bool flush(void);
+    void invalidateShadow(void);
+    void setTimeCache(uint16_t maxErrorMs, uint32_t maxAgeMs = PCF85063TP_MAX_AGE_MS,
+                      uint16_t driftPpm = PCF85063TP_DRIFT_PPM);
+    void invalidateTime(void);
+    uint16_t getTimeError(void);
+    PCF85063TPBusStats_t getBusStats(void);
+    void resetBusStats(void);
 #ifdef PCF85063TP_USE_STRINGS
     void fillDateByString(const char date_string[] = __DATE__);
     void fillTimeByString(const char time_string[] = __TIME__);
@@ -91,6 +120,34 @@ class PCF85063TP {
   private:
     uint8_t readReg(uint8_t reg);
     void writeReg(uint8_t reg, uint8_t data);
+    bool readRegs(uint8_t reg, uint8_t *buf, uint8_t count);
+    bool writeRegs(uint8_t reg, const uint8_t *buf, uint8_t count);
+    bool writePending(const uint8_t *time);
+    void updateReg(uint8_t reg, uint8_t mask, uint8_t value);
+    bool readTime(void);
+    int32_t secondsSinceRef(uint8_t day, uint8_t mon, uint16_t yr, uint32_t sod);
+    uint32_t timeError(uint32_t now);
+    void fillTime(uint32_t n);
+    static void nextDay(uint8_t &day, uint8_t &mon, uint16_t &yr, uint8_t &dow);
+    uint8_t _shadow[REG_RAM + 1];
+    uint8_t _shadowValid; // bit n: _shadow[n] is known
+    uint8_t _pending;     // bit n: _shadow[n] not written to the chip yet
+    bool _hold;           // holdWrites() until flush()
+    PCF85063TPBusStats_t _bus;
+    // Time cache: the second _ref* started between millis() _edgeLo and _edgeHi
+    uint16_t _maxErrorMs; // 0: every getTime() reads the chip
+    uint32_t _maxAgeMs;
+    uint16_t _driftPpm;
+    bool _timeValid;
+    uint32_t _edgeLo;
+    uint32_t _edgeHi;
+    uint32_t _readMs;     // last chip read
+    uint32_t _refSod;     // seconds of the day
+    uint8_t _refDay;
+    uint8_t _refMonth;
+    uint16_t _refYear;
+    uint8_t _refDow;
+    int32_t _lastN;       // seconds after _ref* getTime() returned last
 #ifdef PCF85063TP_USE_STRINGS
     void timeOrDateStringsToInts(const char time_or_date[], int parts[]);
 #endif
@@ -30,19 +30,34 @@ version 0.1
 #include <stdint.h>
 #include <LTR308.h>
 #include <Wire.h>
+#include <jigtrace.h>
 
 LTR308::LTR308(TwoWire *_pWire)
 {
 	pWire = _pWire;
 	// LTR308 object
+	_intPin = -1;
+	_notifyTask = NULL;
+	_readyCount = 0;
+	_readyUs = 0;
+#ifdef JIG_TRACE
+	_readyTraceUs = 0;
+#endif
+	_readySeen = 0;
+	_latencyUs = 0;
+	_fresh = false;
+	_shadowValid = 0;
+	resetBusStats();
 }
 
 boolean LTR308::begin(void)
 {
 	// Initialize LTR308 library with default address
 	// Always returns true
+	// The sensor may have been swapped, the shadow registers are dropped
 
 	_i2c_address = LTR308_ADDR;
+	invalidateShadow();
 	pWire->begin();
 	return (true);
 }
@@ -166,6 +181,32 @@ boolean LTR308::setMeasurementRate(byte integrationTime, byte measurementRate)
 	return (writeByte(LTR308_MEAS_RATE, measurement));
 }
 
+boolean LTR308::setRange(byte gain, byte integrationTime, byte measurementRate)
+{
+	// setMeasurementRate() and setGain() in one write, with the same sanity checks
+	// MEAS_RATE and ALS_GAIN are adjacent registers
+	// Returns true (1) if successful, false (0) if there was an I2C error
+	// (Also see getError() below)
+
+	if (gain >= 0x05)
+	{
+		gain = 0x00;
+	}
+
+	if (integrationTime >= 8)
+	{
+		integrationTime = 0;
+	}
+
+	if (measurementRate >= 8 || measurementRate == 4)
+	{
+		measurementRate = 0;
+	}
+
+	byte regs[2] = {(byte)((integrationTime << 4) | measurementRate), gain};
+	return (writeRegisters(LTR308_MEAS_RATE, regs, 2));
+}
+
 boolean LTR308::getMeasurementRate(byte &integrationTime, byte &measurementRate)
 {
 	// Gets the value of Measurement Rate register
@@ -227,7 +268,7 @@ boolean LTR308::getData(unsigned long &data)
 	return (readLongInt(LTR308_DATA_0, data));
 }
 
-boolean LTR308::getStatus(boolean ponStatus, boolean intrStatus, boolean dataStatus)
+boolean LTR308::getStatus(boolean &ponStatus, boolean &intrStatus, boolean &dataStatus)
 {
 	// Gets the status information of LTR308
 	// Default value is 0x00
@@ -279,7 +320,7 @@ boolean LTR308::setInterruptControl(boolean mode)
 	return (writeByte(LTR308_INTERRUPT, intrControl));
 }
 
-boolean LTR308::getInterruptControl(boolean mode)
+boolean LTR308::getInterruptControl(boolean &mode)
 {
 	// Gets interrupt operations status
 	//------------------------------------------------------
@@ -313,7 +354,10 @@ boolean LTR308::setThreshold(unsigned long upperLimit, unsigned long lowerLimit)
 	// Returns true (1) if successful, false (0) if there was an I2C error
 	// (Also see getError() below)
 
-	return (writeLongInt(LTR308_THRES_UP_0, upperLimit) && writeLongInt(LTR308_THRES_LOW_0, lowerLimit));
+	// Both limits in one write, the registers are adjacent
+	byte regs[6] = {(byte)upperLimit, (byte)(upperLimit >> 8), (byte)(upperLimit >> 16),
+					(byte)lowerLimit, (byte)(lowerLimit >> 8), (byte)(lowerLimit >> 16)};
+	return (writeRegisters(LTR308_THRES_UP_0, regs, 6));
 }
 
 boolean LTR308::getThreshold(unsigned long &upperLimit, unsigned long &lowerLimit)
@@ -325,7 +369,15 @@ boolean LTR308::getThreshold(unsigned long &upperLimit, unsigned long &lowerLimi
 	// Returns true (1) if successful, false (0) if there was an I2C error
 	// (Also see getError() below)
 
-	return (readLongInt(LTR308_THRES_UP_0, upperLimit) && readLongInt(LTR308_THRES_LOW_0, lowerLimit));
+	// Both limits in one read, the registers are adjacent
+	byte regs[6];
+	if (readRegisters(LTR308_THRES_UP_0, regs, 6))
+	{
+		upperLimit = ((unsigned long)(regs[2] & 0x0F) << 16) | ((unsigned long)regs[1] << 8) | regs[0];
+		lowerLimit = ((unsigned long)(regs[5] & 0x0F) << 16) | ((unsigned long)regs[4] << 8) | regs[3];
+		return (true);
+	}
+	return (false);
 }
 
 boolean LTR308::setIntrPersist(byte persist)
@@ -354,7 +406,7 @@ boolean LTR308::setIntrPersist(byte persist)
 	// (Also see getError() below)
 
 	// sanity check
-	if (persist >= 15)
+	if (persist > 15)
 	{
 		persist = 0x00;
 	}
@@ -388,9 +440,29 @@ boolean LTR308::getIntrPersist(byte &persist)
 	// Returns true (1) if successful, false (0) if there was an I2C error
 	// (Also see getError() below)
 
-	return ((readByte(LTR308_INTR_PERS, persist) >> 4));
+	if (readByte(LTR308_INTR_PERS, persist))
+	{
+		persist = persist >> 4;
+		return (true);
+	}
+	return (false);
 }
 
+#define LTR308_LUX_SCALES(g) \
+	{LTR308LuxScale<g, 0>::mult, LTR308LuxScale<g, 0>::shift}, \
+	{LTR308LuxScale<g, 1>::mult, LTR308LuxScale<g, 1>::shift}, \
+	{LTR308LuxScale<g, 2>::mult, LTR308LuxScale<g, 2>::shift}, \
+	{LTR308LuxScale<g, 3>::mult, LTR308LuxScale<g, 3>::shift}, \
+	{LTR308LuxScale<g, 4>::mult, LTR308LuxScale<g, 4>::shift}
+
+// Scale factor per [gain][integrationTime], see LTR308LuxScale
+static const LTR308LuxScale_t luxScales[5][5] = {
+	{LTR308_LUX_SCALES(0)},
+	{LTR308_LUX_SCALES(1)},
+	{LTR308_LUX_SCALES(2)},
+	{LTR308_LUX_SCALES(3)},
+	{LTR308_LUX_SCALES(4)}};
+
 boolean LTR308::getLux(byte gain, byte integrationTime, unsigned long CH, double &lux)
 {
 	// Convert raw data to lux
@@ -401,75 +473,258 @@ boolean LTR308::getLux(byte gain, byte integrationTime, unsigned long CH, double
 	// returns true (1) if calculation was successful
 	// returns false (0) AND lux = 0.0 IF THE SENSOR WAS SATURATED (0XFFFF)
 
-	double d0;
+	unsigned long milliLux;
+	boolean good = getMilliLux(gain, integrationTime, CH, milliLux);
+	lux = milliLux / 1000.0;
+	return (good);
+}
+
+boolean LTR308::getMilliLux(byte gain, byte integrationTime, unsigned long CH, unsigned long &milliLux)
+{
+	// Same as getLux() in integer milli-lux, rounded
+	// An unknown gain or integration time gives 0 like getLux() always did
 
 	// Determine if either sensor saturated (0xFFFF)
 	// If so, abandon ship (calculation will not be accurate)
-	if (CH == 0x000FFFFF)
+	if (CH == LTR308_SATURATED)
 	{
-		lux = 0.0;
+		milliLux = 0;
 		return (false);
 	}
 
-	// Convert from unsigned integer to floating point
+	if (gain >= 5 || integrationTime >= 5)
+	{
+		milliLux = 0;
+		return (true);
+	}
+
+	const LTR308LuxScale_t &scale = luxScales[gain][integrationTime];
+	milliLux = (unsigned long)(((uint64_t)CH * scale.mult + (1ULL << (scale.shift - 1))) >> scale.shift);
+	return (true);
+}
+
+boolean LTR308::beginDataReady(int8_t intPin)
+{
+	// Acquisition on the data-ready interrupt, see LTR308.h
+	// Returns true (1) if successful, false (0) if there was an I2C error
+	// (Also see getError() below)
+
+	if (!(setThreshold(0, 0) && setIntrPersist(0) && setInterruptControl(true)))
+		return (false);
 
-	switch (gain)
+	if (intPin != _intPin)
 	{
-	case 0:
-		d0 = ((double)CH * 0.6);
-		break;
+		if (_intPin >= 0)
+			detachInterrupt(digitalPinToInterrupt(_intPin));
+		_intPin = intPin;
+		if (_intPin >= 0)
+		{
+			pinMode(_intPin, INPUT_PULLUP);
+			attachInterruptArg(digitalPinToInterrupt(_intPin), intIsr, this, FALLING);
+		}
+	}
 
-	case 1:
-		d0 = ((double)CH * 0.6) / 3;
-		break;
+	// Reading STATUS releases INT and drops an older conversion
+	byte status;
+	_fresh = false;
+	_readySeen = _readyCount;
+	return (readByte(LTR308_STATUS, status));
+}
 
-	case 2:
-		d0 = ((double)CH * 0.6) / 6;
-		break;
+void LTR308::setNotifyTask(TaskHandle_t task)
+{
+	// Task to wake from the INT interrupt, NULL to disable
 
-	case 3:
-		d0 = ((double)CH * 0.6) / 9;
-		break;
+	_notifyTask = task;
+}
 
-	case 4:
-		d0 = ((double)CH * 0.6) / 18;
-		break;
+boolean LTR308::dataReady(boolean poll)
+{
+	// True once a conversion finished that readLatest() did not read yet
+	// An INT edge is confirmed against STATUS, a floating pin cannot fake one
 
-	default:
-		d0 = 0.0;
-		break;
+	if (!_fresh && (poll || (_readyCount != _readySeen)))
+	{
+		byte status;
+		_readySeen = _readyCount;
+		if (readByte(LTR308_STATUS, status) && (status & 0x08))
+			_fresh = true;
 	}
+	return (_fresh);
+}
 
-	switch (integrationTime)
+boolean LTR308::readLatest(unsigned long &data, uint16_t timeoutMs)
+{
+	JIG_TRACE_SCOPE("LTR308 readLatest");
+	// Waits at most timeoutMs for a fresh conversion and reads it
+	// Returns true (1) if successful, false (0) on timeout or I2C error
+	// (Also see getError() below)
+
+	uint32_t start = millis();
+	for (;;)
 	{
-	case 0:
-		lux = d0 / 4;
-		break;
+		boolean expired = (millis() - start) >= timeoutMs;
+		if (dataReady((_intPin < 0) || expired))
+			break;
+		if (expired)
+		{
+			if (_error == 0)
+				_error = LTR308_ERROR_NO_DATA;
+			return (false);
+		}
+		if ((_intPin >= 0) && (_notifyTask == xTaskGetCurrentTaskHandle()))
+			ulTaskNotifyTake(pdTRUE, 1);
+		else
+			delay(1);
+	}
 
-	case 1:
-		lux = d0 / 2;
-		break;
+	_fresh = false;
+	if (!getData(data))
+		return (false);
+	_latencyUs = (_intPin >= 0) ? (micros() - _readyUs) : 0;
+#ifdef JIG_TRACE
+	if (_intPin >= 0)
+		jigTraceRecordSince("LTR308 INT to data", _readyTraceUs);
+#endif
+	return (true);
+}
 
-	case 2:
-		lux = d0;
-		break;
+uint32_t LTR308::getInterrupts(void)
+{
+	// INT falling edges counted since beginDataReady()
+
+	return (_readyCount);
+}
+
+uint32_t LTR308::getReadyLatencyUs(void)
+{
+	// INT edge to data read time of the last readLatest()
+
+	return (_latencyUs);
+}
+
+boolean LTR308::readRegisters(uint8_t address, uint8_t *buf, uint8_t count)
+{
+	JIG_TRACE_SCOPE("LTR308 readRegisters");
+	// Reads count consecutive registers in one read, the sensor increments the address
+	// Returns true (1) if successful, false (0) if there was an I2C error
+	// (Also see getError() below)
 
-	case 3:
-		lux = d0 * 2;
-		break;
+	uint32_t start = micros();
 
-	case 4:
-		lux = d0 * 4;
-		break;
+	// Check if sensor present for read
+	pWire->beginTransmission(_i2c_address);
+	pWire->write(address);
+	_error = pWire->endTransmission();
+	_bus.transactions++;
+	_bus.bytes += 2;
 
-	default:
-		lux = 0.0;
-		break;
+	boolean good = false;
+	if (_error == 0)
+	{
+		pWire->requestFrom(_i2c_address, count);
+		_bus.transactions++;
+		_bus.bytes += 1 + count;
+		if (pWire->available() == count)
+		{
+			for (uint8_t i = 0; i < count; i++)
+			{
+				buf[i] = pWire->read();
+				if (shadowed(address + i))
+				{
+					_shadow[address + i] = buf[i];
+					_shadowValid |= 1ULL << (address + i);
+				}
+			}
+			good = true;
+		}
 	}
+	_bus.busUs += micros() - start;
+	return (good);
+}
 
+boolean LTR308::writeRegisters(uint8_t address, const uint8_t *buf, uint8_t count)
+{
+	JIG_TRACE_SCOPE("LTR308 writeRegisters");
+	// Writes count consecutive registers in one write, the sensor increments the address
+	// Leading and trailing registers the shadow says already hold their value are left out,
+	// nothing is sent when all do
+	// Returns true (1) if successful, false (0) if there was an I2C error
+	// (Also see getError() below)
+
+	while ((count > 0) && shadowHolds(address, buf[0]))
+	{
+		address++;
+		buf++;
+		count--;
+		_bus.skippedWrites++;
+	}
+	while ((count > 0) && shadowHolds(address + count - 1, buf[count - 1]))
+	{
+		count--;
+		_bus.skippedWrites++;
+	}
+	if (count == 0)
+		return (true);
+
+	uint32_t start = micros();
+	pWire->beginTransmission(_i2c_address);
+	pWire->write(address);
+	pWire->write(buf, count);
+	_error = pWire->endTransmission();
+	_bus.transactions++;
+	_bus.bytes += 2 + count;
+	_bus.busUs += micros() - start;
+
+	if (_error != 0)
+	{
+		// Unknown how far the write got
+		for (uint8_t i = 0; i < count; i++)
+		{
+			if (shadowed(address + i))
+				_shadowValid &= ~(1ULL << (address + i));
+		}
+		return (false);
+	}
+	if ((address == LTR308_CONTR) && (buf[0] & 0x10))
+	{
+		// Software reset, all registers go back to their defaults
+		invalidateShadow();
+		return (true);
+	}
+	for (uint8_t i = 0; i < count; i++)
+	{
+		if (shadowed(address + i))
+		{
+			_shadow[address + i] = buf[i];
+			_shadowValid |= 1ULL << (address + i);
+		}
+	}
 	return (true);
 }
 
+void LTR308::invalidateShadow(void)
+{
+	// Forget the cached register values, the next writes go to the sensor
+
+	_shadowValid = 0;
+}
+
+LTR308BusStats_t LTR308::getBusStats(void)
+{
+	// I2C traffic since resetBusStats()
+
+	return (_bus);
+}
+
+void LTR308::resetBusStats(void)
+{
+	_bus.transactions = 0;
+	_bus.bytes = 0;
+	_bus.busUs = 0;
+	_bus.skippedWrites = 0;
+}
+
 byte LTR308::getError(void)
 {
 	// If any library command fails, you can retrieve an extended
@@ -485,6 +740,39 @@ byte LTR308::getError(void)
 
 // Private functions:
 
+void IRAM_ATTR LTR308::intIsr(void *arg)
+{
+	// INT falling edge: count it and wake the notify task
+
+	LTR308 *self = (LTR308 *)arg;
+	self->_readyUs = micros();
+#ifdef JIG_TRACE
+	self->_readyTraceUs = esp_timer_get_time();
+#endif
+	self->_readyCount++;
+	if (self->_notifyTask != NULL)
+	{
+		BaseType_t woken = pdFALSE;
+		vTaskNotifyGiveFromISR(self->_notifyTask, &woken);
+		if (woken == pdTRUE)
+			portYIELD_FROM_ISR();
+	}
+}
+
+boolean LTR308::shadowed(uint8_t address)
+{
+	// Control registers only, STATUS and DATA change by themselves
+
+	return ((address <= LTR308_THRES_LOW_2) && ((LTR308_SHADOW_REGS >> address) & 1));
+}
+
+boolean LTR308::shadowHolds(uint8_t address, uint8_t value)
+{
+	// The sensor is known to hold value at address
+
+	return (shadowed(address) && ((_shadowValid >> address) & 1) && (_shadow[address] == value));
+}
+
 boolean LTR308::readByte(uint8_t address, uint8_t &value)
 {
 	// Reads a byte from a LTR308 address
@@ -493,22 +781,7 @@ boolean LTR308::readByte(uint8_t address, uint8_t &value)
 	// Returns true (1) if successful, false (0) if there was an I2C error
 	// (Also see getError() above)
 
-	// Check if sensor present for read
-	pWire->beginTransmission(_i2c_address);
-	pWire->write(address);
-	_error = pWire->endTransmission();
-
-	// Read requested byte
-	if (_error == 0)
-	{
-		pWire->requestFrom(_i2c_address, 1);
-		if (pWire->available() == 1)
-		{
-			value = pWire->read();
-			return (true);
-		}
-	}
-	return (false);
+	return (readRegisters(address, &value, 1));
 }
 
 boolean LTR308::writeByte(uint8_t address, uint8_t value)
@@ -519,62 +792,37 @@ boolean LTR308::writeByte(uint8_t address, uint8_t value)
 	// Returns true (1) if successful, false (0) if there was an I2C error
 	// (Also see getError() above)
 
-	pWire->beginTransmission(_i2c_address);
-	pWire->write(address);
-	// Write byte
-	pWire->write(value);
-	_error = pWire->endTransmission();
-	if (_error == 0)
-		return (true);
-
-	return (false);
+	return (writeRegisters(address, &value, 1));
 }
 
 boolean LTR308::readLongInt(uint8_t address, unsigned long &value)
 {
-	// Reads an unsigned integer (16 bits) from a LTR308 address (low byte first)
+	// Reads an unsigned integer (20 bits) from a LTR308 address (low byte first)
 	// Address: LTR308 address (0 to 15), low byte first
 	// Value will be set to stored unsigned integer
 	// Returns true (1) if successful, false (0) if there was an I2C error
 	// (Also see getError() above)
 
-	uint8_t high, med, low;
-
-	// Check if sensor present for read
-	pWire->beginTransmission(_i2c_address);
-	pWire->write(address);
-	_error = pWire->endTransmission();
-
-	// Read two bytes (low and high)
-	if (_error == 0)
+	uint8_t regs[3];
+	if (readRegisters(address, regs, 3))
 	{
-		pWire->requestFrom(_i2c_address, 3);
-		if (pWire->available() == 3)
-		{
-			low = pWire->read();
-			med = pWire->read();
-			high = pWire->read();
-			// Combine bytes into unsigned int
-			value = ((long)(high & 0x0F)) << 16;
-			value |= ((long)med) << 8;
-			value |= (long)low;
-			return (true);
-		}
+		// Combine bytes into unsigned int
+		value = ((long)(regs[2] & 0x0F)) << 16;
+		value |= ((long)regs[1]) << 8;
+		value |= (long)regs[0];
+		return (true);
 	}
 	return (false);
 }
 
 boolean LTR308::writeLongInt(uint8_t address, unsigned long value)
 {
-	// Write an unsigned integer (16 bits) to a LTR308 address (low byte first)
+	// Write an unsigned integer (20 bits) to a LTR308 address (low byte first)
 	// Address: LTR308 address (0 to 15), low byte first
 	// Value: unsigned int to write to address
 	// Returns true (1) if successful, false (0) if there was an I2C error
 	// (Also see getError() above)
 
-	// Split int into lower and upper bytes, write each byte
-	if (writeByte(address, (uint8_t)(value && 0x000000FF)) && writeByte(address + 1, (uint8_t)((value && 0x0000FF00) >> 8)) && writeByte(address + 2, (uint8_t)((value && 0x00FF0000) >> 16)))
-		return (true);
-
-	return (false);
+	uint8_t regs[3] = {(uint8_t)(value & 0x000000FF), (uint8_t)((value & 0x0000FF00) >> 8), (uint8_t)((value & 0x00FF0000) >> 16)};
+	return (writeRegisters(address, regs, 3));
 }
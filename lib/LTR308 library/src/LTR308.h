@@ -54,6 +54,62 @@ version 0.1
 #define LTR308_THRES_LOW_1   0x25
 #define LTR308_THRES_LOW_2   0x26
 
+// getError() code of readLatest() when no conversion finished in time
+#define LTR308_ERROR_NO_DATA 0x10
+
+// Registers kept in the shadow copy: CONTR, MEAS_RATE, ALS_GAIN,
+// INTERRUPT, INTR_PERS and the thresholds. Bit n stands for address n.
+#define LTR308_SHADOW_REGS ((1ULL << LTR308_CONTR) | (1ULL << LTR308_MEAS_RATE) | (1ULL << LTR308_ALS_GAIN) | \
+							(1ULL << LTR308_INTERRUPT) | (1ULL << LTR308_INTR_PERS) | (0x3FULL << LTR308_THRES_UP_0))
+
+// I2C traffic, see getBusStats()
+struct LTR308BusStats_t
+{
+	uint32_t transactions;  // start to stop
+	uint32_t bytes;         // on the wire, address bytes included
+	uint32_t busUs;         // time spent in Wire calls
+	uint32_t skippedWrites; // register writes the shadow made unnecessary
+};
+
+// Raw count of a saturated conversion, getLux() refuses it
+#define LTR308_SATURATED 0x000FFFFF
+
+// Milli-lux per count for a gain / integration time setting:
+// 600 / gain factor ( 1, 3, 6, 9, 18 ) * 100 ms / integration time
+// kept as a 32 bit multiplier and a right shift, folded at compile time,
+// so a conversion is one 32x32->64 bit multiply with rounding
+struct LTR308LuxScale_t
+{
+	uint32_t mult;
+	uint8_t shift;
+};
+
+constexpr double ltr308MilliLuxPerCount(uint8_t gain, uint8_t integrationTime)
+{
+	return 600.0 / (gain == 0 ? 1 : gain == 1 ? 3 : gain == 2 ? 6 : gain == 3 ? 9 : 18) *
+		   (integrationTime == 0 ? 0.25 : integrationTime == 1 ? 0.5 : integrationTime == 2 ? 1 : integrationTime == 3 ? 2 : 4);
+}
+
+// Largest shift that keeps the multiplier under 32 bits
+constexpr uint8_t ltr308LuxShift(double scale, uint8_t shift = 0)
+{
+	return (shift < 40 && scale * (double)(1ULL << (shift + 1)) < 4294967295.0) ? ltr308LuxShift(scale, shift + 1) : shift;
+}
+
+template <uint8_t Gain, uint8_t IntegrationTime>
+struct LTR308LuxScale
+{
+	static_assert(Gain < 5, "LTR308 gain is 0 to 4");
+	static_assert(IntegrationTime < 5, "LTR308 integration time is 0 to 4");
+	static constexpr uint8_t shift = ltr308LuxShift(ltr308MilliLuxPerCount(Gain, IntegrationTime));
+	static constexpr uint32_t mult = (uint32_t)(ltr308MilliLuxPerCount(Gain, IntegrationTime) * (double)(1ULL << shift) + 0.5);
+
+	static unsigned long milliLux(unsigned long CH)
+	{
+		return (unsigned long)(((uint64_t)CH * mult + (1ULL << (shift - 1))) >> shift);
+	}
+};
+
 
 class LTR308 {
 	public:
@@ -123,6 +179,11 @@ class LTR308 {
 			// Returns true (1) if successful, false (0) if there was an I2C error
 			// (Also see getError() below)
 			
+		boolean setRange(byte gain, byte integrationTime, byte measurementRate);
+			// setMeasurementRate() and setGain() in a single I2C write
+			// Returns true (1) if successful, false (0) if there was an I2C error
+			// (Also see getError() below)
+
 		boolean getMeasurementRate(byte &integrationTime, byte &measurementRate);
 			// Gets the value of Measurement Rate register
 			// Default value is 0x03
@@ -159,7 +220,7 @@ class LTR308 {
 			// Returns true (1) if successful, false (0) if there was an I2C error
 			// (Also see getError() below)
 		
-		boolean getStatus(boolean ponStatus, boolean intrStatus, boolean dataStatus);
+		boolean getStatus(boolean &ponStatus, boolean &intrStatus, boolean &dataStatus);
 			// Gets the status information of LTR308
 			// Default value is 0x00
 			// If ponStatus = false(0), power on event (default)
@@ -183,7 +244,7 @@ class LTR308 {
 			// Returns true (1) if successful, false (0) if there was an I2C error
 			// (Also see getError() below)
 			
-		boolean getInterruptControl(boolean mode);
+		boolean getInterruptControl(boolean &mode);
 			// Gets interrupt operations status
 			//------------------------------------------------------
 			// If mode = false(0), INT pin is active at logic 0 (default)
@@ -264,7 +325,75 @@ class LTR308 {
 			// lux will be set to resulting lux calculation
 			// returns true (1) if calculation was successful
 			// returns false (0) AND lux = 0.0 IF THE SENSOR WAS SATURATED (0XFFFF)
+
+		boolean getMilliLux(byte gain, byte integrationTime, unsigned long CH, unsigned long &milliLux);
+			// Same as getLux() in integer milli-lux, rounded
+			// Scale factor from a table, no floating point
+
+		template <uint8_t Gain, uint8_t IntegrationTime>
+		boolean getLux(unsigned long CH, unsigned long &milliLux)
+		{
+			// getMilliLux() for a setting known at compile time,
+			// the scale factor is a constant
+			if (CH == LTR308_SATURATED)
+			{
+				milliLux = 0;
+				return (false);
+			}
+			milliLux = LTR308LuxScale<Gain, IntegrationTime>::milliLux(CH);
+			return (true);
+		}
 		
+		boolean beginDataReady(int8_t intPin = -1);
+			// Acquisition on the data-ready interrupt: thresholds 0/0 put every
+			// conversion above 0 counts out of range, persist 0 raises INT on
+			// each one. INT is open drain, active low, and needs a pull-up.
+			// intPin: GPIO on INT, or -1 to poll the STATUS register instead
+			// Drops a conversion that finished before this call
+			// Returns true (1) if successful, false (0) if there was an I2C error
+			// (Also see getError() below)
+
+		void setNotifyTask(TaskHandle_t task);
+			// Give task a notification ( xTaskNotifyGive ) from the INT interrupt,
+			// so it can sleep in ulTaskNotifyTake() until a conversion is latched
+			// task: task to wake up, NULL to disable
+
+		boolean dataReady(boolean poll = true);
+			// Returns true once a conversion finished that readLatest() did not read yet
+			// With an INT pin no I2C traffic happens until INT fires
+			// poll = true asks the STATUS register regardless, for a reading of
+			// 0 counts, which stays inside the thresholds and raises no interrupt
+
+		boolean readLatest(unsigned long &data, uint16_t timeoutMs);
+			// Waits at most timeoutMs for a fresh conversion and reads it
+			// Returns true (1) if successful, false (0) on timeout
+			// (getError() = LTR308_ERROR_NO_DATA) or if there was an I2C error
+
+		uint32_t getInterrupts(void);
+			// INT falling edges counted since beginDataReady()
+
+		uint32_t getReadyLatencyUs(void);
+			// INT edge to data read time of the last readLatest(), 0 without INT pin
+
+		boolean readRegisters(uint8_t address, uint8_t *buf, uint8_t count);
+			// Reads count consecutive registers in one I2C read (address auto-increment)
+			// Returns true (1) if successful, false (0) if there was an I2C error
+			// (Also see getError() below)
+
+		boolean writeRegisters(uint8_t address, const uint8_t *buf, uint8_t count);
+			// Writes count consecutive registers in one I2C write (address auto-increment)
+			// Control registers known to hold the value already are not written again,
+			// see LTR308_SHADOW_REGS
+			// Returns true (1) if successful, false (0) if there was an I2C error
+			// (Also see getError() below)
+
+		void invalidateShadow(void);
+			// Forget the cached control registers, begin() does this for a new sensor
+
+		LTR308BusStats_t getBusStats(void);
+		void resetBusStats(void);
+			// I2C transactions, bytes, bus time and skipped writes since resetBusStats()
+
 		byte getError(void);
 			// If any library command fails, you can retrieve an extended
 			// error code using this command. Errors are from the wire library: 
@@ -276,6 +405,15 @@ class LTR308 {
 
 	private:
 
+		boolean shadowed(uint8_t address);
+			// address is one of LTR308_SHADOW_REGS
+
+		boolean shadowHolds(uint8_t address, uint8_t value);
+			// The sensor is known to hold value at address
+
+		static void IRAM_ATTR intIsr(void *arg);
+			// INT falling edge: count it and wake the notify task
+
 		boolean readByte(uint8_t address, uint8_t &value);
 			// Reads a byte from a LTR308 address
 			// Address: LTR308 address (0x00 to 0x26)
@@ -308,6 +446,21 @@ class LTR308 {
 		
 		uint8_t _error;
 
+		int8_t _intPin;
+		TaskHandle_t _notifyTask;
+		volatile uint32_t _readyCount;
+		volatile uint32_t _readyUs;
+#ifdef JIG_TRACE
+		volatile int64_t _readyTraceUs; // esp_timer_get_time() of the INT edge
+#endif
+		uint32_t _readySeen;  // _readyCount already checked against STATUS
+		uint32_t _latencyUs;
+		boolean _fresh;       // STATUS reported new data not read yet
+
+		uint8_t _shadow[LTR308_THRES_LOW_2 + 1];
+		uint64_t _shadowValid; // bit n: _shadow[n] is what the sensor holds
+		LTR308BusStats_t _bus;
+
 		TwoWire *pWire;
 };
 
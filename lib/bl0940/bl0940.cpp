@@ -1,4 +1,10 @@
 #include "bl0940.h"
+#include <jigtrace.h>
+
+typedef bl0940Scale<BL0940_BOARD> scale;
+static_assert(scale::q(scale::volts()) < 4294967296.0 && scale::q(scale::amps()) < 4294967296.0 &&
+                  scale::q(scale::watts()) < 4294967296.0 && scale::q(scale::kWhPerPulse() * 1000.0) < 4294967296.0,
+              "BL0940 fixed-point scale factor does not fit 32 bits");
 // #include "defvar.h"
 
 /*!
@@ -16,6 +22,23 @@ bl0940::bl0940(HardwareSerial *hwSerial, HardwareSerial *hwSerial2)
     _init();
 }
 
+/*!
+ * bl0940::bl0940
+ * Class constructor for a chip on other UART pins
+ *
+ * @param hwSerial Pointer to hardware serial connected to BL0940
+ * @param rxPin UART RX pin
+ * @param txPin UART TX pin
+ * @param hwSerial2 Debug serial
+ */
+bl0940::bl0940(HardwareSerial *hwSerial, int8_t rxPin, int8_t txPin, HardwareSerial *hwSerial2)
+{
+    this->_serial = hwSerial;
+    this->_serial2 = hwSerial2;
+    hwSerial->begin(BL0940_DEFAULT_BAUD_RATE, BL0940_DEFAULT_PORT_CONFIG, rxPin, txPin);
+    _init();
+}
+
 // bl0940::bl0940()
 // {
 //     this->_serial = hwSerial;
@@ -32,6 +55,29 @@ bl0940::~bl0940()
 {
 }
 
+/*!
+ * bl0940::begin
+ * Initialize again, for chips that were not reachable at construction
+ * ( behind a select line, powered later ). Resets calibration and
+ * energy totals, call it before beginPulseCounter().
+ *
+ * @return Success
+ */
+bool bl0940::begin()
+{
+    _init();
+    return (_state == NO_ERROR);
+}
+
+/*!
+ * bl0940::getStream
+ * Serial the chip is connected to, chips sharing one need a select line
+ */
+Stream *bl0940::getStream()
+{
+    return _serial;
+}
+
 /*!
  * bl0940::getVoltage
  * Get measured voltage
@@ -47,10 +93,19 @@ bl0940::~bl0940()
  */
 float bl0940::getVoltage()
 {
-    return (((uint32_t)_rawHolder[BL0940_VRMS_HOLD_POS + 2] << 16) |
-            ((uint32_t)_rawHolder[BL0940_VRMS_HOLD_POS + 1] << 8) |
-            ((uint32_t)_rawHolder[BL0940_VRMS_HOLD_POS])) *
-           (float)BL0940_V_RMS_COEFFICIENT * (float)BL0940_VOLTAGE_DIVIDER;
+    return bl0940ReadAllFrame::vRms::raw(_readAll) * _vScale + _cal.vOffset;
+}
+
+/*!
+ * bl0940::getMilliVolts
+ * Same as getVoltage() without floating point
+ *
+ * @return Last measured voltage in mV
+ */
+uint32_t bl0940::getMilliVolts()
+{
+    int32_t mv = (int32_t)scale::apply(bl0940ReadAllFrame::vRms::raw(_readAll), _mvScale) + _mvOffset;
+    return (mv > 0) ? mv : 0;
 }
 
 /*!
@@ -68,10 +123,19 @@ float bl0940::getVoltage()
  */
 float bl0940::getCurrent()
 {
-    return (((uint32_t)_rawHolder[BL0940_IRMS_HOLD_POS + 2] << 16) |
-            ((uint32_t)_rawHolder[BL0940_IRMS_HOLD_POS + 1] << 8) |
-            ((uint32_t)_rawHolder[BL0940_IRMS_HOLD_POS])) *
-           (float)BL0940_I_RMS_COEFFICIENT / (float)BL0940_SHUNT_RESISTANCE;
+    return bl0940ReadAllFrame::iRms::raw(_readAll) * _iScale + _cal.iOffset;
+}
+
+/*!
+ * bl0940::getMilliAmps
+ * Same as getCurrent() without floating point
+ *
+ * @return Last measured current in mA
+ */
+uint32_t bl0940::getMilliAmps()
+{
+    int32_t ma = (int32_t)scale::apply(bl0940ReadAllFrame::iRms::raw(_readAll), _maScale) + _maOffset;
+    return (ma > 0) ? ma : 0;
 }
 
 /*!
@@ -90,12 +154,21 @@ float bl0940::getCurrent()
  */
 double bl0940::getActivePower()
 {
-    long powerValue = 0x7FFFFF & (((uint32_t)_rawHolder[BL0940_WATT_HOLD_POS + 2] << 16) | ((uint32_t)_rawHolder[BL0940_WATT_HOLD_POS + 1] << 8) | ((uint32_t)_rawHolder[BL0940_WATT_HOLD_POS]));
-    powerValue = (_rawHolder[BL0940_WATT_HOLD_POS + 2] & 0x80) ? powerValue - 0x7FFFFF : powerValue;
-    activePow = (double)powerValue * (float)BL0940_WATT_COEFFICIENT * (float)BL0940_VOLTAGE_DIVIDER / (float)BL0940_SHUNT_RESISTANCE;
+    activePow = _rawWatt() * _pScale + _cal.pOffset;
     return activePow;
 }
 
+/*!
+ * bl0940::getMilliWatts
+ * Same as getActivePower() without floating point
+ *
+ * @return Last measured active power in mW
+ */
+int32_t bl0940::getMilliWatts()
+{
+    return scale::apply((int32_t)_rawWatt(), _mwScale) + _mwOffset;
+}
+
 /*!
  * bl0940::getReactivePower
  * Calculate Reactive Power in VAr
@@ -124,7 +197,7 @@ double bl0940::getApparentPower()
 
 uint32_t bl0940::getCF_CNT()
 {
-    return (((uint32_t)_rawHolder[BL0940_CF_CNT_HOLD_POS + 2] << 16) | ((uint32_t)_rawHolder[BL0940_CF_CNT_HOLD_POS + 1] << 8) | ((uint32_t)_rawHolder[BL0940_CF_CNT_HOLD_POS]));
+    return bl0940ReadAllFrame::cfCnt::raw(_readAll);
 }
 
 /*! Energy calculation */
@@ -133,13 +206,12 @@ uint32_t bl0940::getCF_CNT()
  * bl0940::getEnergy
  * Get measured Energy in kWh
  *
- * @return Total measured Energy
+ * @return Total measured Energy, see getTotalPulses()
  */
-
-// float bl0940::getEnergy()
-// {
-//     return getEnergy(((uint32_t)_rawHolder[BL0940_CF_CNT_HOLD_POS+2]<<16) | ((uint32_t)_rawHolder[BL0940_CF_CNT_HOLD_POS+1]<<8) | ((uint32_t)_rawHolder[BL0940_CF_CNT_HOLD_POS]));
-// }
+float bl0940::getEnergy()
+{
+    return (float)((double)getTotalPulses() * _kWhPerPulse);
+}
 
 /*!
  * bl0940::getEnergy
@@ -167,7 +239,19 @@ float bl0940::getEnergy(uint32_t cf, uint16_t calibrated_blink_second)
     {
         Serial.println("CF count is zero, check sensor connection.");
     }
-    return (float)cf * ((BL0940_ACTIVE_ENERGY_COEFFICIENT * BL0940_WATT_COEFFICIENT * (float)BL0940_VOLTAGE_DIVIDER) * 6120 / (6120 * 3600000.0 * (float)BL0940_SHUNT_RESISTANCE));
+    return (float)cf * _kWhPerPulse;
+}
+
+/*!
+ * bl0940::getMilliWattHours
+ * Same as getEnergy() without floating point
+ *
+ * @param Counted Energy pulses
+ * @return Energy in mWh
+ */
+uint32_t bl0940::getMilliWattHours(uint32_t cf)
+{
+    return scale::apply(cf, _mwhScale);
 }
 
 /*!
@@ -176,14 +260,141 @@ float bl0940::getEnergy(uint32_t cf, uint16_t calibrated_blink_second)
  *
  * @return Measured Energy delta
  */
-// float bl0940::getEnergyDelta()
-// {
-//     float energyDelta = 0;
-//     uint32_t cf = ((uint32_t)_rawHolder[BL0940_CF_CNT_HOLD_POS+2]<<16) | ((uint32_t)_rawHolder[BL0940_CF_CNT_HOLD_POS+1]<<8) | ((uint32_t)_rawHolder[BL0940_CF_CNT_HOLD_POS]);
-//     energyDelta = ( cf < _lastCF ) ? getEnergy( 0xFFFFFF - _lastCF + cf ) : getEnergy( cf - _lastCF );
-//     _lastCF = cf;
-//     return energyDelta;
-// }
+float bl0940::getEnergyDelta()
+{
+    uint64_t total = getTotalPulses();
+    float energyDelta = (float)(total - _cfDeltaMark) * _kWhPerPulse;
+    _cfDeltaMark = total;
+    return energyDelta;
+}
+
+/*!
+ * bl0940::beginPulseCounter
+ * Count the CF pin in a PCNT unit, so the energy total keeps
+ * moving between CF_CNT reads without extra UART traffic
+ *
+ * @param cfPin GPIO connected to the BL0940 CF output
+ * @param unit PCNT unit to use
+ * @return true if the counter is running
+ */
+bool bl0940::beginPulseCounter(uint8_t cfPin, pcnt_unit_t unit)
+{
+    pcnt_config_t cfg = {};
+    cfg.pulse_gpio_num = cfPin;
+    cfg.ctrl_gpio_num = PCNT_PIN_NOT_USED;
+    cfg.lctrl_mode = PCNT_MODE_KEEP;
+    cfg.hctrl_mode = PCNT_MODE_KEEP;
+    cfg.pos_mode = PCNT_COUNT_INC;
+    cfg.neg_mode = PCNT_COUNT_DIS;
+    cfg.counter_h_lim = BL0940_PCNT_LIMIT;
+    cfg.counter_l_lim = 0;
+    cfg.unit = unit;
+    cfg.channel = PCNT_CHANNEL_0;
+    if (pcnt_unit_config(&cfg) != ESP_OK)
+        return false;
+    // pcnt_unit_config() turns the pull-up on, CF idles low
+    gpio_pullup_dis((gpio_num_t)cfPin);
+    gpio_pulldown_en((gpio_num_t)cfPin);
+
+    pcnt_set_filter_value(unit, BL0940_PCNT_FILTER);
+    pcnt_filter_enable(unit);
+    pcnt_event_disable(unit, PCNT_EVT_ZERO);
+    pcnt_event_disable(unit, PCNT_EVT_L_LIM);
+    pcnt_event_disable(unit, PCNT_EVT_THRES_0);
+    pcnt_event_disable(unit, PCNT_EVT_THRES_1);
+    pcnt_event_enable(unit, PCNT_EVT_H_LIM);
+    pcnt_counter_pause(unit);
+    pcnt_counter_clear(unit);
+
+    esp_err_t err = pcnt_isr_service_install(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) // already installed by another unit
+        return false;
+    _pcntUnit = unit;
+    _pcntWraps = 0;
+    _pcntLast = 0;
+    _pinAtCF = 0;
+    _cfSynced = false;
+    if (pcnt_isr_handler_add(unit, _pcntIsr, this) != ESP_OK)
+        return false;
+    _pcntOn = true;
+    pcnt_counter_resume(unit);
+    return true;
+}
+
+/*!
+ * bl0940::getTotalPulses
+ * CF pulses since start or since the restored checkpoint. The last
+ * CF_CNT read plus the pin pulses counted after it; never decreases.
+ *
+ * @return Total energy pulses
+ */
+uint64_t bl0940::getTotalPulses()
+{
+    uint64_t total = _cfTotal;
+    if (_pcntOn)
+        total += _pinPulses() - _pinAtCF;
+    // The pin ran ahead of the register that just came in
+    if (total < _cfReported)
+        total = _cfReported;
+    _cfReported = total;
+    return total;
+}
+
+/*!
+ * bl0940::getTotalMilliWattHours
+ * Same as getEnergy() without floating point
+ *
+ * @return Total energy in mWh
+ */
+uint64_t bl0940::getTotalMilliWattHours()
+{
+    uint64_t pulses = getTotalPulses();
+    // Q24 scale split in two, so the products fit 64 bits
+    return (pulses >> BL0940_FIXED_SHIFT) * _mwhScale +
+           (((pulses & ((1UL << BL0940_FIXED_SHIFT) - 1)) * _mwhScale) >> BL0940_FIXED_SHIFT);
+}
+
+/*!
+ * bl0940::getPulseMismatches
+ * CF_CNT reads where the pin count differed by more than one pulse,
+ * a CF line that is open or picks up noise
+ *
+ * @return Number of mismatched reads
+ */
+uint32_t bl0940::getPulseMismatches()
+{
+    return _cfMismatches;
+}
+
+/*!
+ * bl0940::getEnergyCheckpoint
+ * Energy total as of the last CF_CNT read, for the application to save
+ *
+ * @return Checkpoint for restoreEnergy()
+ */
+bl0940EnergyCheckpoint_t bl0940::getEnergyCheckpoint()
+{
+    bl0940EnergyCheckpoint_t checkpoint = {_cfTotal, _lastCF};
+    return checkpoint;
+}
+
+/*!
+ * bl0940::restoreEnergy
+ * Continue the total from a saved checkpoint. Call it before the first
+ * read of a session, the total starts over from the checkpoint.
+ *
+ * @param checkpoint Value saved from getEnergyCheckpoint()
+ */
+void bl0940::restoreEnergy(const bl0940EnergyCheckpoint_t &checkpoint)
+{
+    _cfTotal = checkpoint.pulses;
+    _cfReported = checkpoint.pulses;
+    _cfDeltaMark = checkpoint.pulses;
+    _lastCF = checkpoint.cfCnt & BL0940_CF_CNT_MASK;
+    if (_pcntOn)
+        _pinAtCF = _pinPulses();
+    _cfSynced = false;
+}
 /*! End Energy calculation */
 
 /*!
@@ -202,7 +413,7 @@ float bl0940::getPhaseAngle()
 {
     // pAngle = 2*PI*((uint16_t)_rawHolderPA[1]<<8 | _rawHolderPA[0])*(float)_cfg.acFreq/(float)BL0940_SAMPLING_FREQUENCY;
     // return pAngle;
-    return 2 * PI * ((uint16_t)_rawHolder[BL0940_CORNER_HOLD_POS + 1] << 8 | _rawHolder[BL0940_CORNER_HOLD_POS]) * (float)_cfg.acFreq / (float)BL0940_SAMPLING_FREQUENCY;
+    return 2 * PI * _corner * (float)_cfg.acFreq / (float)BL0940_SAMPLING_FREQUENCY;
 }
 
 float bl0940::getPhaseAngleMod()
@@ -245,8 +456,45 @@ float bl0940::getPowerFactorMod(bool percentage)
  */
 float bl0940::getTemperature()
 {
-    return BL0940_TEMPERATURE_COEFFICIENT *
-           ((float)(((uint32_t)(_rawHolder[BL0940_TPS1_HOLD_POS + 1] & 0x0F) << 8) | ((uint32_t)_rawHolder[BL0940_TPS1_HOLD_POS])) / 2 - 45);
+    return BL0940_TEMPERATURE_COEFFICIENT * ((float)(bl0940ReadAllFrame::tps1::raw(_readAll) & 0x0FFF) / 2 - 45);
+}
+
+/*!
+ * bl0940::setCalibration
+ * Apply a per-unit correction to all getters. Gains are folded into
+ * the scale factors here, so the getters stay one multiply and one add.
+ *
+ * @param Gains and offsets ( see bl0940Calibration_t )
+ */
+void bl0940::setCalibration(const bl0940Calibration_t &cal)
+{
+    _cal = cal;
+    _vScale = (float)(scale::volts() * cal.vGain);
+    _iScale = (float)(scale::amps() * cal.iGain);
+    _pScale = scale::watts() * cal.pGain;
+    _kWhPerPulse = (float)(scale::kWhPerPulse() * cal.eGain);
+    _mvScale = _fixedScale(scale::milliVolts(), cal.vGain);
+    _maScale = _fixedScale(scale::milliAmps(), cal.iGain);
+    _mwScale = _fixedScale(scale::milliWatts(), cal.pGain);
+    _mwhScale = _fixedScale(scale::milliWattHours(), cal.eGain);
+    _mvOffset = lroundf(cal.vOffset * 1000);
+    _maOffset = lroundf(cal.iOffset * 1000);
+    _mwOffset = lroundf(cal.pOffset * 1000);
+}
+
+bl0940Calibration_t bl0940::getCalibration()
+{
+    return _cal;
+}
+
+/*!
+ * bl0940::resetCalibration
+ * Back to the board scale factors only ( unity gain, no offset )
+ */
+void bl0940::resetCalibration()
+{
+    bl0940Calibration_t cal = {1, 0, 1, 0, 1, 0, 1};
+    setCalibration(cal);
 }
 
 /*!
@@ -514,24 +762,411 @@ bool bl0940::writeTpsRegister()
  */
 bool bl0940::readValues()
 {
-    if (((millis() - _frame.lastRcv) < _cfg.rmsUpdate) && (_frame.Payload[BL0940_FRM_ADDR_POS] == BL0940_READALL_REG_ADDR))
+    if (_haveReadAll && ((millis() - _readAllMs) < _cfg.rmsUpdate))
         return true;
-    _frame.Bytes = BL0940_MAX_FRAME;
-    _frame.Index = 2;
-    _frame.Payload[BL0940_FRM_HEAD_POS] = BL0940_READ_CMD;
-    _frame.Payload[BL0940_FRM_ADDR_POS] = BL0940_READALL_REG_ADDR;
-    _sendFrame();
-    _rcvFrame();
+    if (_async != ASYNC_IDLE)
+        return false;
+    _readAllTransaction();
+    while (!poll())
+    {
+    }
+    return (_state == NO_ERROR);
+}
+
+/*!
+ * bl0940::requestReadAll
+ * Start the same measurement as readValues() without waiting for it.
+ * Call poll() until it returns true, then use the getters as usual.
+ *
+ * @return false if a request is already running
+ */
+bool bl0940::requestReadAll()
+{
+    if (_async != ASYNC_IDLE)
+        return false;
+    _readAllTransaction();
+    return true;
+}
+
+/*!
+ * bl0940::poll
+ * Move received bytes into the frame and advance the request.
+ * Never blocks, the result is in getState() once it returns true.
+ *
+ * @return true when no request is running ( anymore )
+ */
+bool bl0940::poll()
+{
+    if (_async == ASYNC_IDLE)
+        return true;
+    uint32_t start = micros();
+    if (_async == ASYNC_TXN)
+    {
+        bool done = _serviceTransaction();
+        _cpuUs += micros() - start;
+        return done;
+    }
+
+    _rcvBytes();
+    if (_frame.Index < _frame.Bytes)
+    {
+        if ((millis() - _frame.lastRcv) > BL0940_TIMEOUT)
+        {
+            _state = TIMEOUT_ERR;
+            _linkResult();
+            if (!_waveStop)
+            {
+                // Lost answer, keep the stream going
+                _waveErrors++;
+                _requestRegister(_waveReg);
+            }
+            else
+            {
+                _async = ASYNC_IDLE;
+            }
+        }
+        _cpuUs += micros() - start;
+        return (_async == ASYNC_IDLE);
+    }
+
+    _parseFrame();
+    _linkResult();
     if (_state == NO_ERROR)
+        _storeWaveSample();
+    else
+        _waveErrors++;
+    if (_waveStop)
+        _async = ASYNC_IDLE;
+    else
+        _requestRegister(_waveReg);
+    _cpuUs += micros() - start;
+    return (_async == ASYNC_IDLE);
+}
+
+bool bl0940::busy()
+{
+    return (_async != ASYNC_IDLE);
+}
+
+/*!
+ * bl0940::setNotifyTask
+ * Give task a notification ( xTaskNotifyGive ) whenever the UART
+ * received data, so it can sleep in ulTaskNotifyTake() instead of polling
+ *
+ * @param Task to wake up, NULL to disable
+ */
+void bl0940::setNotifyTask(TaskHandle_t task)
+{
+    _notifyTask = task;
+    static_cast<HardwareSerial *>(_serial)->onReceive([this]() {
+        if (_notifyTask != NULL)
+            xTaskNotifyGive(_notifyTask);
+    });
+}
+
+/*!
+ * bl0940::startWaveStream
+ * Read a waveform register back-to-back from poll() into two sample
+ * blocks. At 4800 baud one register read takes 6 bytes on the wire,
+ * so the rate is limited to about 80 samples per second.
+ *
+ * @param BL0940_V_WAVE_REG_ADDR or BL0940_I_WAVE_REG_ADDR
+ * @return false if another request is running
+ */
+bool bl0940::startWaveStream(uint8_t regAddress)
+{
+    if (_async != ASYNC_IDLE)
+        return false;
+    if ((regAddress != BL0940_V_WAVE_REG_ADDR) && (regAddress != BL0940_I_WAVE_REG_ADDR))
+        return false;
+    _waveReg = regAddress;
+    _waveFill = 0;
+    _waveReady = -1;
+    _waveIndex = 0;
+    _waveSamples = 0;
+    _waveStartMs = millis();
+    _waveOverruns = 0;
+    _waveErrors = 0;
+    _waveStop = false;
+    _async = ASYNC_WAVE;
+    _requestRegister(_waveReg);
+    return true;
+}
+
+/*!
+ * bl0940::stopWaveStream
+ * Stop streaming after the read in flight, poll() returns true once
+ * that answer is in. A block already handed out stays valid until released.
+ */
+void bl0940::stopWaveStream()
+{
+    if (_async == ASYNC_WAVE)
+        _waveStop = true;
+}
+
+/*!
+ * bl0940::getWaveBlock
+ * Get the oldest completed block without copying it
+ *
+ * @return BL0940_WAVE_BLOCK signed samples, NULL if none is ready.
+ * Valid until releaseWaveBlock()
+ */
+const int32_t *bl0940::getWaveBlock()
+{
+    return (_waveReady < 0) ? NULL : _wave[_waveReady];
+}
+
+/*!
+ * bl0940::releaseWaveBlock
+ * Hand the block from getWaveBlock() back for filling
+ */
+void bl0940::releaseWaveBlock()
+{
+    _waveReady = -1;
+}
+
+/*!
+ * bl0940::getWaveRate
+ * Achieved samples per second since startWaveStream()
+ */
+float bl0940::getWaveRate()
+{
+    uint32_t ms = millis() - _waveStartMs;
+    return ms ? _waveSamples * 1000.0f / ms : 0;
+}
+
+/*!
+ * bl0940::getWaveOverruns
+ * Blocks dropped because the consumer still held the other one
+ */
+uint32_t bl0940::getWaveOverruns()
+{
+    return _waveOverruns;
+}
+
+/*!
+ * bl0940::getWaveErrors
+ * Waveform reads lost to timeouts or bad frames
+ */
+uint32_t bl0940::getWaveErrors()
+{
+    return _waveErrors;
+}
+
+/*!
+ * bl0940::getCpuUs
+ * CPU time spent in readValues(), poll() and their receive loops
+ *
+ * @return Total microseconds since start
+ */
+uint32_t bl0940::getCpuUs()
+{
+    return _cpuUs;
+}
+
+/*!
+ * bl0940::getMeasurements
+ * Number of finished readValues() or requestReadAll() measurements
+ */
+uint32_t bl0940::getMeasurements()
+{
+    return _measurements;
+}
+
+/*!
+ * bl0940::beginTransaction
+ * Start collecting register reads that go out as one burst. The
+ * replies come back in request order and are checked in a single
+ * pass once the last one is in:
+ *
+ *   beginTransaction(); addRead(...); addRead(...); sendTransaction();
+ *   while (!poll()) ...; getTransactionValue(i)
+ *
+ * READALL can only be the first read.
+ *
+ * @return false if a request is running
+ */
+bool bl0940::beginTransaction()
+{
+    if (_async != ASYNC_IDLE)
+        return false;
+    _txnCount = 0;
+    return true;
+}
+
+/*!
+ * bl0940::addRead
+ * Add a register read to the transaction
+ *
+ * @param Register address ( see definitions in header file )
+ * @return false if the transaction is full
+ */
+bool bl0940::addRead(uint8_t regAddress)
+{
+    if ((_async != ASYNC_IDLE) || (_txnCount >= BL0940_TXN_MAX_READS))
+        return false;
+    if ((regAddress == BL0940_READALL_REG_ADDR) && (_txnCount > 0))
+        return false;
+    _txnReg[_txnCount] = regAddress;
+    _txnValue[_txnCount] = BL0940_MAX_REG_VALUE;
+    _txnCount++;
+    return true;
+}
+
+/*!
+ * bl0940::sendTransaction
+ * Put the requests on the wire, all of them back-to-back when
+ * pipelining is on ( default ), else each after the previous reply.
+ * Finish it with poll().
+ *
+ * @return false if a request is running or nothing was added
+ */
+bool bl0940::sendTransaction()
+{
+    if ((_async != ASYNC_IDLE) || (_txnCount == 0))
+        return false;
+    _txnSent = 0;
+    _txnExpect = 0;
+    _txnIndex = 0;
+    _txnRx = _spareBuf();
+    _txnStartUs = micros();
+    _frame.lastRcv = millis();
+    _sendTransactionRequests(_pipelined ? _txnCount : 1);
+    _async = ASYNC_TXN;
+    return true;
+}
+
+/*!
+ * bl0940::getTransactionValue
+ * Register value from the last transaction, 24 bit as received
+ *
+ * @param Position of the read in the transaction
+ * @return Register value, BL0940_MAX_REG_VALUE or more if it was not received
+ */
+long bl0940::getTransactionValue(uint8_t index)
+{
+    if (index >= _txnCount)
+        return BL0940_MAX_REG_VALUE;
+    return _txnValue[index];
+}
+
+/*!
+ * bl0940::setPipelining
+ * Send all requests of a transaction at once or one per round trip.
+ * Pipelining is switched off by itself when a burst loses replies.
+ *
+ * @param true to pipeline
+ */
+void bl0940::setPipelining(bool on)
+{
+    _pipelined = on;
+}
+
+bool bl0940::getPipelining()
+{
+    return _pipelined;
+}
+
+/*!
+ * bl0940::getBusUs
+ * Smoothed time from the first request to the last reply of a
+ * readValues() or requestReadAll() measurement
+ *
+ * @param Pipelined or one-by-one measurements
+ * @return Microseconds, 0 if there was none of that kind yet
+ */
+uint32_t bl0940::getBusUs(bool pipelined)
+{
+    return _busUs[pipelined ? 1 : 0];
+}
+
+/*!
+ * bl0940::getPipelineFallbacks
+ * Times a pipelined burst got only part of its replies and pipelining
+ * was switched off
+ */
+uint32_t bl0940::getPipelineFallbacks()
+{
+    return _pipelineFallbacks;
+}
+
+/*!
+ * bl0940::negotiateBaudRate
+ * Find the fastest UART rate the chip answers on reliably, trying the
+ * candidates from the highest down. The rate itself is set by how the
+ * chip is strapped, a BL0940 only talks at 4800 baud.
+ * Transfers that keep failing later step down to the next candidate.
+ *
+ * @param rates Candidate baud rates, any order
+ * @param count Number of candidates, at most BL0940_MAX_BAUD_RATES
+ * @return Rate in use, 0 if none answered ( the lowest is kept )
+ */
+uint32_t bl0940::negotiateBaudRate(const uint32_t *rates, uint8_t count)
+{
+    if ((_async != ASYNC_IDLE) || (count == 0))
+        return 0;
+    if (count > BL0940_MAX_BAUD_RATES)
+        count = BL0940_MAX_BAUD_RATES;
+    for (uint8_t i = 0; i < count; i++)
     {
-        long pa = readRegister(BL0940_CORNER_REG_ADDR);
-        if (pa < BL0940_MAX_REG_VALUE)
+        uint8_t j = i;
+        for (; (j > 0) && (_baudRates[j - 1] < rates[i]); j--)
+            _baudRates[j] = _baudRates[j - 1];
+        _baudRates[j] = rates[i];
+    }
+    // No fallback while probing, failures are expected here
+    _baudCount = 0;
+    uint32_t rate = 0;
+    for (_baudIndex = 0; _baudIndex < count; _baudIndex++)
+    {
+        if (_probeBaudRate(_baudRates[_baudIndex]))
         {
-            _rawHolder[BL0940_CORNER_HOLD_POS] = (pa & 0xFF);
-            _rawHolder[BL0940_CORNER_HOLD_POS + 1] = (pa >> 8 & 0xFF);
+            rate = _baudRates[_baudIndex];
+            break;
         }
     }
-    return (_state == NO_ERROR);
+    if (rate == 0)
+    {
+        _baudIndex = count - 1;
+        _setBaudRate(_baudRates[_baudIndex]);
+    }
+    _baudCount = count;
+    _linkErrors = 0;
+    _crcErrors = 0;
+    _frameErrors = 0;
+    return rate;
+}
+
+uint32_t bl0940::getBaudRate()
+{
+    return _baudRates[_baudIndex];
+}
+
+/*!
+ * bl0940::getCrcErrors
+ * Frames received with a checksum mismatch since negotiateBaudRate()
+ */
+uint32_t bl0940::getCrcErrors()
+{
+    return _crcErrors;
+}
+
+/*!
+ * bl0940::getFrameErrors
+ * Transfers that timed out or came back short since negotiateBaudRate()
+ */
+uint32_t bl0940::getFrameErrors()
+{
+    return _frameErrors;
+}
+
+/*!
+ * bl0940::getBaudFallbacks
+ * Times the UART stepped down to a slower rate after repeated errors
+ */
+uint32_t bl0940::getBaudFallbacks()
+{
+    return _baudFallbacks;
 }
 
 bool bl0940::readValuesPhAngle()
@@ -562,9 +1197,15 @@ bool bl0940::readValuesPhAngle()
 
 void bl0940::calcEnergy()
 {
-
-    pwf = cos(pAngle) * (double)100.0;
-    reactivePow = activePow * tan(pAngle);
+    // The phase angle register rarely changes between readings
+    if (pAngle != _trigAngle)
+    {
+        _cos = cos(pAngle);
+        _tan = tan(pAngle);
+        _trigAngle = pAngle;
+    }
+    pwf = _cos * (double)100.0;
+    reactivePow = activePow * _tan;
     appPow = (activePow * 100) / pwf;
 }
 
@@ -584,7 +1225,50 @@ void bl0940::_init()
         .wprot = true,
     };
     _lastCF = 0;
+    _cfTotal = 0;
+    _cfReported = 0;
+    _cfDeltaMark = 0;
+    _cfSynced = false;
+    _cfMismatches = 0;
+    _pcntOn = false;
+    _pcntUnit = PCNT_UNIT_0;
+    _pcntWraps = 0;
+    _pcntLast = 0;
+    _pinAtCF = 0;
+    portMUX_INITIALIZE(&_pcntMux);
+    resetCalibration();
+    pAngle = 0;
+    _trigAngle = 0;
+    _cos = 1;
+    _tan = 0;
     _frame.lastRcv = 0;
+    _async = ASYNC_IDLE;
+    _notifyTask = NULL;
+    _cpuUs = 0;
+    _measurements = 0;
+    _haveReadAll = false;
+    _readAllMs = 0;
+    memset(_txnBuf, 0, sizeof(_txnBuf));
+    _readAll = _txnBuf[0];
+    _txnRx = _txnBuf[1];
+    _corner = 0;
+    memset(_rawHolderPA, 0, sizeof(_rawHolderPA));
+    _txnCount = 0;
+    _pipelined = true;
+    _busUs[0] = 0;
+    _busUs[1] = 0;
+    _pipelineFallbacks = 0;
+    _baudRates[0] = BL0940_DEFAULT_BAUD_RATE;
+    _baudCount = 1;
+    _baudIndex = 0;
+    _linkErrors = 0;
+    _crcErrors = 0;
+    _frameErrors = 0;
+    _baudFallbacks = 0;
+    _waveReady = -1;
+    _waveSamples = 0;
+    _waveOverruns = 0;
+    _waveErrors = 0;
     setTSelector(BL0940_TEMPERATURE_INTERNAL);
     _state = (writeModeRegister() && writeTpsRegister()) ? NO_ERROR : COMM_ERROR;
 }
@@ -620,6 +1304,7 @@ void bl0940::_sendFrame()
 
 void bl0940::_rcvFrameSingle()
 {
+    JIG_TRACE_SCOPE("BL0940 _rcvFrameSingle");
     int bytesAvailable;
     uint8_t payloadReceived[40];
     _frame.lastRcv = millis();
@@ -652,21 +1337,43 @@ void bl0940::_rcvFrameSingle()
  */
 void bl0940::_rcvFrame()
 {
-    int bytesAvailable;
+    JIG_TRACE_SCOPE("BL0940 _rcvFrame");
     _frame.lastRcv = millis();
     while ((_frame.Index < _frame.Bytes) && !((millis() - _frame.lastRcv) > BL0940_TIMEOUT))
     {
-        bytesAvailable = _serial->available();
-        if (bytesAvailable > 0)
-        {
-            for (int bytesIndex = 0; bytesIndex < bytesAvailable; bytesIndex++)
-            {
-                _frame.Payload[_frame.Index++] = (uint8_t)_serial->read();
-            }
-            _frame.lastRcv = millis(); // Reset timeout counter
-        }
+        _rcvBytes();
+    }
+    _parseFrame();
+    _linkResult();
+}
+
+/*!
+ * bl0940::_rcvBytes
+ * Move what the UART has received so far into the frame, never more
+ * than the frame expects. Noise in front of a READALL answer is skipped
+ * until its head byte.
+ */
+void bl0940::_rcvBytes()
+{
+    while ((_frame.Index < _frame.Bytes) && (_serial->available() > 0))
+    {
+        uint8_t b = (uint8_t)_serial->read();
+        _frame.lastRcv = millis(); // Reset timeout counter
+        if ((_frame.Index == BL0940_FRM_SEND_MODE_HEAD_POS) &&
+            (_frame.Payload[BL0940_FRM_ADDR_POS] == BL0940_READALL_REG_ADDR) &&
+            (b != BL0940_SEND_MODE_HEAD))
+            continue;
+        _frame.Payload[_frame.Index++] = b;
     }
+}
 
+/*!
+ * bl0940::_parseFrame
+ * Check a received frame and copy READALL data to internal holder.
+ * Update internal status
+ */
+void bl0940::_parseFrame()
+{
     if (_frame.Index != _frame.Bytes)
     {
         _state = BADFRAME_ERR;
@@ -690,12 +1397,10 @@ void bl0940::_rcvFrame()
             Serial.println(_crcCalc(_frame.Payload, _frame.Bytes), HEX); // Assuming _crcCalc returns the calculated CRC
             return;
         }
-        memcpy(_rawHolder, (_frame.Payload + BL0940_FRM_SEND_MODE_HEAD_POS + BL0940_IFRMS_FRM_POS), 6);
-        memcpy((_rawHolder + BL0940_VRMS_HOLD_POS), (_frame.Payload + BL0940_FRM_SEND_MODE_HEAD_POS + BL0940_VRMS_FRM_POS), 3);
-        memcpy((_rawHolder + BL0940_WATT_HOLD_POS), (_frame.Payload + BL0940_FRM_SEND_MODE_HEAD_POS + BL0940_WATT_FRM_POS), 3);
-        memcpy((_rawHolder + BL0940_CF_CNT_HOLD_POS), (_frame.Payload + BL0940_FRM_SEND_MODE_HEAD_POS + BL0940_CF_CNT_FRM_POS), 3);
-        memcpy((_rawHolder + BL0940_TPS1_HOLD_POS), (_frame.Payload + BL0940_FRM_SEND_MODE_HEAD_POS + BL0940_TPS1_FRM_POS), 2);
-        memcpy((_rawHolder + BL0940_TPS2_HOLD_POS), (_frame.Payload + BL0940_FRM_SEND_MODE_HEAD_POS + BL0940_TPS2_FRM_POS), 2);
+        // _frame.Payload is reused by the next register read, keep the frame
+        uint8_t *frame = _spareBuf();
+        memcpy(frame, (_frame.Payload + BL0940_FRM_SEND_MODE_HEAD_POS), BL0940_SEND_MODE_FRAME_BYTES);
+        _storeReadAll(frame);
     }
     else
     {
@@ -714,6 +1419,339 @@ void bl0940::_rcvFrame()
     return;
 }
 
+/*!
+ * bl0940::_reconcileEnergy
+ * Add the CF_CNT increase since the last read to the total
+ *
+ * @param cf CF_CNT register value
+ */
+void bl0940::_reconcileEnergy(uint32_t cf)
+{
+    uint32_t delta;
+    if (cf >= _lastCF)
+        delta = cf - _lastCF;
+    else if (_lastCF > BL0940_CF_CNT_MASK / 2)
+        delta = (cf - _lastCF) & BL0940_CF_CNT_MASK; // 24 bit wraparound
+    else
+        delta = cf; // chip was reset, CF_CNT started over from 0
+    _lastCF = cf;
+    _cfTotal += delta;
+
+    if (!_pcntOn)
+        return;
+    uint32_t pin = _pinPulses();
+    uint32_t pinDelta = pin - _pinAtCF;
+    _pinAtCF = pin;
+    // The pin is read a frame after the register latched, allow a pulse either way
+    if (_cfSynced && (pinDelta > delta + 1 || delta > pinDelta + 1))
+        _cfMismatches++;
+    _cfSynced = true;
+}
+
+/*!
+ * bl0940::_pinPulses
+ * 32 bit CF pin count from the 16 bit PCNT counter and its wraps
+ */
+uint32_t bl0940::_pinPulses()
+{
+    int16_t count = 0;
+    portENTER_CRITICAL(&_pcntMux);
+    uint32_t wraps = _pcntWraps;
+    pcnt_get_counter_value(_pcntUnit, &count);
+    portEXIT_CRITICAL(&_pcntMux);
+    uint32_t pulses = wraps * BL0940_PCNT_LIMIT + (uint16_t)count;
+    // The counter restarted at 0 but its interrupt has not run yet
+    if (pulses < _pcntLast)
+        pulses += BL0940_PCNT_LIMIT;
+    _pcntLast = pulses;
+    return pulses;
+}
+
+void IRAM_ATTR bl0940::_pcntIsr(void *arg)
+{
+    bl0940 *self = static_cast<bl0940 *>(arg);
+    portENTER_CRITICAL_ISR(&self->_pcntMux);
+    self->_pcntWraps++;
+    portEXIT_CRITICAL_ISR(&self->_pcntMux);
+}
+
+/*!
+ * bl0940::_fixedScale
+ * Q24 scale factor times a gain, saturated to 32 bits
+ */
+uint32_t bl0940::_fixedScale(uint32_t base, float gain)
+{
+    if (gain <= 0)
+        return 0;
+    double scaled = (double)base * gain + 0.5;
+    return (scaled >= 4294967295.0) ? 0xFFFFFFFF : (uint32_t)scaled;
+}
+
+/*!
+ * bl0940::_rawWatt
+ * Signed WATT register value
+ */
+long bl0940::_rawWatt()
+{
+    uint32_t raw = bl0940ReadAllFrame::watt::raw(_readAll);
+    long powerValue = 0x7FFFFF & raw;
+    return (raw & 0x800000) ? powerValue - 0x7FFFFF : powerValue;
+}
+
+/*!
+ * bl0940::_storeCorner
+ * Keep a valid phase angle register value for getPhaseAngle() and getPhaseAngleMod()
+ */
+void bl0940::_storeCorner(long pa)
+{
+    if (pa >= BL0940_MAX_REG_VALUE)
+        return;
+    _corner = (uint16_t)pa;
+    _rawHolderPA[0] = (pa & 0xFF);
+    _rawHolderPA[1] = (pa >> 8 & 0xFF);
+}
+
+/*!
+ * bl0940::_storeReadAll
+ * Make a checked READALL frame ( starting at its 0x55 head ) the one the
+ * getters decode from. It stays in place, the next replies go to the
+ * other buffer.
+ */
+void bl0940::_storeReadAll(const uint8_t *frame)
+{
+    _readAll = frame;
+    _reconcileEnergy(bl0940ReadAllFrame::cfCnt::raw(frame));
+    _haveReadAll = true;
+    _readAllMs = millis();
+}
+
+/*!
+ * bl0940::_spareBuf
+ * Receive buffer that does not hold the current READALL frame
+ */
+uint8_t *bl0940::_spareBuf()
+{
+    return (_readAll >= _txnBuf[1]) ? _txnBuf[0] : _txnBuf[1];
+}
+
+/*!
+ * bl0940::_readAllTransaction
+ * One full measurement: READALL and the phase angle, which is not part of it
+ */
+void bl0940::_readAllTransaction()
+{
+    beginTransaction();
+    addRead(BL0940_READALL_REG_ADDR);
+    addRead(BL0940_CORNER_REG_ADDR);
+    sendTransaction();
+}
+
+/*!
+ * bl0940::_sendTransactionRequests
+ * Send the next requests of the transaction in a single UART write
+ */
+void bl0940::_sendTransactionRequests(uint8_t count)
+{
+    uint8_t request[BL0940_TXN_MAX_READS * 2];
+    uint8_t len = 0;
+    while ((count-- > 0) && (_txnSent < _txnCount))
+    {
+        request[len++] = BL0940_READ_CMD;
+        request[len++] = _txnReg[_txnSent];
+        _txnExpect += _replyBytes(_txnReg[_txnSent]);
+        _txnSent++;
+    }
+    _serial->write(request, len);
+}
+
+/*!
+ * bl0940::_serviceTransaction
+ * Receive transaction replies, parse them once all are in
+ *
+ * @return true when the transaction is finished
+ */
+bool bl0940::_serviceTransaction()
+{
+    while ((_txnIndex < _txnExpect) && (_serial->available() > 0))
+    {
+        uint8_t b = (uint8_t)_serial->read();
+        _frame.lastRcv = millis(); // Reset timeout counter
+        // Noise in front of a READALL answer is skipped until its head byte
+        if ((_txnIndex == 0) && (_txnReg[0] == BL0940_READALL_REG_ADDR) && (b != BL0940_SEND_MODE_HEAD))
+            continue;
+        _txnRx[_txnIndex++] = b;
+    }
+    if (_txnIndex < _txnExpect)
+    {
+        if ((millis() - _frame.lastRcv) <= BL0940_TIMEOUT)
+            return false;
+        _state = TIMEOUT_ERR;
+        _linkResult();
+        if (_pipelined && (_txnCount > 1) && (_txnIndex >= _replyBytes(_txnReg[0])))
+        {
+            // The chip answered the first request only, go one by one
+            _pipelined = false;
+            _pipelineFallbacks++;
+        }
+        _async = ASYNC_IDLE;
+        _measurements++;
+        return true;
+    }
+    if (_txnSent < _txnCount)
+    {
+        _sendTransactionRequests(1);
+        return false;
+    }
+
+    _parseTransaction();
+    _linkResult();
+    if (_state == NO_ERROR)
+    {
+        uint32_t *bus = &_busUs[_pipelined ? 1 : 0];
+        uint32_t us = micros() - _txnStartUs;
+        *bus = (*bus == 0) ? us : *bus - (*bus >> 3) + (us >> 3);
+    }
+    _async = ASYNC_IDLE;
+    _measurements++;
+    return true;
+}
+
+/*!
+ * bl0940::_parseTransaction
+ * Check all replies of a transaction first, then store them, so a bad
+ * reply leaves the last measurement and the energy total untouched.
+ * A READALL reply is decoded in place by the getters, the phase angle
+ * register is kept for getPhaseAngle(). Update internal status
+ */
+void bl0940::_parseTransaction()
+{
+    const uint8_t *reply = _txnRx;
+    for (uint8_t i = 0; i < _txnCount; i++)
+    {
+        // Register read CRC covers the request bytes as well
+        bool good = (_txnReg[i] == BL0940_READALL_REG_ADDR) ? bl0940ReadAllFrame::check(reply)
+                                                            : bl0940RegisterReply::check(reply, _txnReg[i]);
+        if (!good)
+        {
+            _state = CRCFRAME_ERR;
+            return;
+        }
+        reply += _replyBytes(_txnReg[i]);
+    }
+
+    reply = _txnRx;
+    for (uint8_t i = 0; i < _txnCount; i++)
+    {
+        if (_txnReg[i] == BL0940_READALL_REG_ADDR)
+        {
+            _storeReadAll(reply);
+            _txnValue[i] = 0;
+        }
+        else
+        {
+            _txnValue[i] = bl0940RegisterReply::data::raw(reply);
+            if (_txnReg[i] == BL0940_CORNER_REG_ADDR)
+                _storeCorner(_txnValue[i] & 0x007FFFFF);
+        }
+        reply += _replyBytes(_txnReg[i]);
+    }
+    _state = NO_ERROR;
+}
+
+uint8_t bl0940::_replyBytes(uint8_t regAddress)
+{
+    return (regAddress == BL0940_READALL_REG_ADDR) ? BL0940_SEND_MODE_FRAME_BYTES : BL0940_REG_REPLY_BYTES;
+}
+
+/*!
+ * bl0940::_probeBaudRate
+ * Read back the MODE register written by _init() a few times at rate
+ */
+bool bl0940::_probeBaudRate(uint32_t rate)
+{
+    _setBaudRate(rate);
+    for (uint8_t i = 0; i < BL0940_BAUD_PROBES; i++)
+    {
+        if (readRegister(BL0940_MODE_REG_ADDR) != _cfg.modeRegister)
+            return false;
+    }
+    return true;
+}
+
+/*!
+ * bl0940::_setBaudRate
+ * Switch the UART and drop whatever arrived at the old rate
+ */
+void bl0940::_setBaudRate(uint32_t rate)
+{
+    static_cast<HardwareSerial *>(_serial)->updateBaudRate(rate);
+    while (_serial->available() > 0)
+        _serial->read();
+}
+
+/*!
+ * bl0940::_linkResult
+ * Count the outcome of a finished transfer ( _state ) and step down to
+ * the next slower rate after BL0940_BAUD_FALLBACK_ERRORS failures in a row
+ */
+void bl0940::_linkResult()
+{
+    if (_state == NO_ERROR)
+    {
+        _linkErrors = 0;
+        return;
+    }
+    if (_state == CRCFRAME_ERR)
+        _crcErrors++;
+    else
+        _frameErrors++;
+    if ((++_linkErrors < BL0940_BAUD_FALLBACK_ERRORS) || (_baudIndex + 1 >= _baudCount))
+        return;
+    _baudIndex++;
+    _setBaudRate(_baudRates[_baudIndex]);
+    _baudFallbacks++;
+    _linkErrors = 0;
+}
+
+/*!
+ * bl0940::_requestRegister
+ * Send a register read without waiting for the answer, see poll()
+ */
+void bl0940::_requestRegister(uint8_t regAddress)
+{
+    _frame.Bytes = 6;
+    _frame.Index = 2;
+    _frame.Payload[BL0940_FRM_HEAD_POS] = BL0940_READ_CMD;
+    _frame.Payload[BL0940_FRM_ADDR_POS] = regAddress;
+    _frame.lastRcv = millis();
+    _sendFrame();
+}
+
+/*!
+ * bl0940::_storeWaveSample
+ * Append the received waveform value ( 24 bit two's complement ) to the
+ * block being filled and hand the block out when it is full
+ */
+void bl0940::_storeWaveSample()
+{
+    uint32_t raw = ((uint32_t)_frame.Payload[BL0940_FRM_DATA_H_POS] << 16 |
+                    (uint32_t)_frame.Payload[BL0940_FRM_DATA_M_POS] << 8 |
+                    (uint32_t)_frame.Payload[BL0940_FRM_DATA_L_POS]);
+    _wave[_waveFill][_waveIndex++] = (int32_t)(raw << 8) >> 8;
+    _waveSamples++;
+    if (_waveIndex < BL0940_WAVE_BLOCK)
+        return;
+    _waveIndex = 0;
+    if (_waveReady >= 0)
+    {
+        // Consumer still holds the other block, refill this one
+        _waveOverruns++;
+        return;
+    }
+    _waveReady = _waveFill;
+    _waveFill ^= 1;
+}
+
 /*!
  * bl0940::_readConfig
  * Not used. Read and populate User mode selection register and Temperature mode control register values
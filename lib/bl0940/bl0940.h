@@ -7,6 +7,7 @@
 #else
 #include "WProgram.h"
 #endif
+#include <driver/pcnt.h>
 
 /*!
  * From BL0940 Calibration-free Metering IC Datasheet
@@ -59,17 +60,9 @@
 #define BL0940_TPS2_FRM_POS 0x1F
 #define BL0940_CRC_FRM_POS 0x22
 
-#define BL0940_IFRMS_HOLD_POS 0x00
-#define BL0940_IRMS_HOLD_POS 0x03
-#define BL0940_VRMS_HOLD_POS 0x06
-#define BL0940_WATT_HOLD_POS 0x09
-#define BL0940_CF_CNT_HOLD_POS 0x0C
-#define BL0940_CORNER_HOLD_POS 0x0F
-#define BL0940_TPS1_HOLD_POS 0x11
-#define BL0940_TPS2_HOLD_POS 0x13
-
 #define BL0940_MAX_REG_VALUE 0x1000000
 #define BL0940_MAX_FRAME 37
+#define BL0940_SEND_MODE_HEAD 0x55
 #define BL0940_SEND_MODE_FRAME_BYTES 35
 #define BL0940_TIMEOUT 200
 
@@ -112,6 +105,9 @@
                                                // 400mS RMS register update
 
 #define BL0940_DEFAULT_BAUD_RATE 4800
+#define BL0940_MAX_BAUD_RATES 4
+#define BL0940_BAUD_PROBES 3           // good MODE register reads to accept a rate
+#define BL0940_BAUD_FALLBACK_ERRORS 3 // failed transfers in a row before stepping down
 #define BL0940_DEFAULT_PORT_CONFIG SERIAL_8N1
 #define BL0940_DEFAULT_RMS_UPDATE 400
 #define BL0940_DEFAULT_AC_FREQUENCY 50
@@ -140,6 +136,56 @@
 
 #define BL0940_SAMPLING_FREQUENCY 1000000
 
+/*!
+ * Board description for the fixed-point conversion. Another board is
+ * selected with -D BL0940_BOARD=myBoard, a struct with the same members.
+ */
+struct bl0940DefaultBoard
+{
+    static constexpr double voltageDivider() { return BL0940_VOLTAGE_DIVIDER; }
+    static constexpr double shuntResistance() { return BL0940_SHUNT_RESISTANCE; }
+};
+
+#ifndef BL0940_BOARD
+#define BL0940_BOARD bl0940DefaultBoard
+#endif
+
+/*!
+ * Register LSB to unit scale factors, folded at compile time.
+ * The fixed-point factors are milli-units per LSB in Q24, so a conversion
+ * is one 32x32->64 bit multiply and a shift. The float factors are used
+ * by the float getters.
+ */
+#define BL0940_FIXED_SHIFT 24
+#define BL0940_FIXED_HALF (1UL << (BL0940_FIXED_SHIFT - 1))
+
+template <class Board>
+struct bl0940Scale
+{
+    static constexpr double volts() { return BL0940_V_RMS_COEFFICIENT * Board::voltageDivider(); }
+    static constexpr double amps() { return BL0940_I_RMS_COEFFICIENT / Board::shuntResistance(); }
+    static constexpr double watts() { return BL0940_WATT_COEFFICIENT * Board::voltageDivider() / Board::shuntResistance(); }
+    static constexpr double kWhPerPulse() { return BL0940_ACTIVE_ENERGY_COEFFICIENT * watts() / 3600000.0; }
+
+    static constexpr double q(double unitsPerLsb) { return unitsPerLsb * 1000.0 * (1UL << BL0940_FIXED_SHIFT) + 0.5; }
+    static constexpr uint32_t milliVolts() { return (uint32_t)q(volts()); }
+    static constexpr uint32_t milliAmps() { return (uint32_t)q(amps()); }
+    static constexpr uint32_t milliWatts() { return (uint32_t)q(watts()); }
+    static constexpr uint32_t milliWattHours() { return (uint32_t)q(kWhPerPulse() * 1000.0); }
+
+    // Rounded to the nearest milli-unit
+    static uint32_t apply(uint32_t raw, uint32_t scale) { return (uint32_t)(((uint64_t)raw * scale + BL0940_FIXED_HALF) >> BL0940_FIXED_SHIFT); }
+    static int32_t apply(int32_t raw, uint32_t scale) { return (int32_t)(((int64_t)raw * scale + BL0940_FIXED_HALF) >> BL0940_FIXED_SHIFT); }
+};
+
+// Waveform streaming, samples per block handed to the consumer
+#define BL0940_WAVE_BLOCK 64
+
+// CF pulse counting, CF_CNT is a 24 bit register
+#define BL0940_CF_CNT_MASK 0xFFFFFFUL
+#define BL0940_PCNT_LIMIT 10000 // PCNT counts to this, the interrupt carries it over
+#define BL0940_PCNT_FILTER 1023 // APB cycles, ignores CF glitches shorter than 12.8 us
+
 enum bl0940States
 {
     NO_ERROR,
@@ -150,6 +196,87 @@ enum bl0940States
     COMM_ERROR
 };
 
+enum bl0940AsyncStates
+{
+    ASYNC_IDLE,
+    ASYNC_TXN, // waiting for the replies of a transaction
+    ASYNC_WAVE // streaming a waveform register
+};
+
+// Batched register reads, see beginTransaction()
+#define BL0940_TXN_MAX_READS 4
+#define BL0940_REG_REPLY_BYTES 4 // DATA_L DATA_M DATA_H CRC, see bl0940RegisterReply
+#define BL0940_TXN_BUF (BL0940_SEND_MODE_FRAME_BYTES + (BL0940_TXN_MAX_READS - 1) * BL0940_REG_REPLY_BYTES)
+
+/*!
+ * Frame layout descriptors. Fields are decoded in place from the received
+ * bytes, the byte assembly and the checksum sum are unrolled at compile time.
+ */
+template <uint8_t N>
+struct bl0940Bytes
+{
+    // Little endian value of p[0..N-1]
+    static uint32_t value(const uint8_t *p) { return ((uint32_t)p[N - 1] << (8 * (N - 1))) | bl0940Bytes<N - 1>::value(p); }
+    static uint8_t sum(const uint8_t *p) { return (uint8_t)(p[N - 1] + bl0940Bytes<N - 1>::sum(p)); }
+};
+
+template <>
+struct bl0940Bytes<0>
+{
+    static uint32_t value(const uint8_t *) { return 0; }
+    static uint8_t sum(const uint8_t *) { return 0; }
+};
+
+template <uint8_t Offset, uint8_t Width>
+struct bl0940Field
+{
+    static_assert(Width >= 1 && Width <= 3, "BL0940 registers are 24 bit");
+    static constexpr uint8_t offset = Offset;
+    static constexpr uint8_t width = Width;
+    static uint32_t raw(const uint8_t *frame) { return bl0940Bytes<Width>::value(frame + Offset); }
+};
+
+/*!
+ * Frame of Bytes bytes, the last one is the checksum:
+ * ~( seed + all other bytes ), seed being the request bytes the chip adds
+ */
+template <uint8_t Bytes>
+struct bl0940Frame
+{
+    static constexpr uint8_t bytes = Bytes;
+    static bool check(const uint8_t *frame, uint8_t seed)
+    {
+        return (uint8_t) ~(uint8_t)(seed + bl0940Bytes<Bytes - 1>::sum(frame)) == frame[Bytes - 1];
+    }
+};
+
+// Answer to READALL, from its 0x55 head. The checksum leaves out the 0xAA address
+struct bl0940ReadAllFrame : bl0940Frame<BL0940_SEND_MODE_FRAME_BYTES>
+{
+    typedef bl0940Field<BL0940_IFRMS_FRM_POS, 3> iFastRms;
+    typedef bl0940Field<BL0940_IRMS_FRM_POS, 3> iRms;
+    typedef bl0940Field<BL0940_VRMS_FRM_POS, 3> vRms;
+    typedef bl0940Field<BL0940_WATT_FRM_POS, 3> watt;
+    typedef bl0940Field<BL0940_CF_CNT_FRM_POS, 3> cfCnt;
+    typedef bl0940Field<BL0940_TPS1_FRM_POS, 2> tps1;
+    typedef bl0940Field<BL0940_TPS2_FRM_POS, 2> tps2;
+    static_assert(BL0940_TPS2_FRM_POS + 3 == BL0940_CRC_FRM_POS, "READALL layout");
+    static_assert(BL0940_CRC_FRM_POS + 1 == BL0940_SEND_MODE_FRAME_BYTES, "READALL layout");
+
+    static bool check(const uint8_t *frame) { return bl0940Frame::check(frame, BL0940_READ_CMD); }
+};
+
+// Answer to a single register read: DATA_L DATA_M DATA_H CRC
+struct bl0940RegisterReply : bl0940Frame<BL0940_REG_REPLY_BYTES>
+{
+    typedef bl0940Field<0, 3> data;
+
+    static bool check(const uint8_t *reply, uint8_t regAddress)
+    {
+        return bl0940Frame::check(reply, (uint8_t)(BL0940_READ_CMD + regAddress));
+    }
+};
+
 /*!
  * One full measurement frame from device
  * 0x55           HEADER ( 0x58 in docs )
@@ -175,6 +302,30 @@ struct frame_t
     uint64_t lastUpdate;
 };
 
+/*!
+ * Per-unit correction on top of the board scale factors:
+ * value = gain * uncorrected value + offset ( offsets in V, A and W )
+ */
+struct bl0940Calibration_t
+{
+    float vGain;
+    float vOffset;
+    float iGain;
+    float iOffset;
+    float pGain;
+    float pOffset;
+    float eGain;
+};
+
+/*!
+ * Energy total to keep across restarts, see restoreEnergy()
+ */
+struct bl0940EnergyCheckpoint_t
+{
+    uint64_t pulses; // CF pulses counted up to cfCnt
+    uint32_t cfCnt;  // CF_CNT register at that point
+};
+
 struct bl0940Config_t
 {
     uint16_t modeRegister;
@@ -189,18 +340,31 @@ class bl0940
 {
 public:
     bl0940(HardwareSerial *hwSerial, HardwareSerial *hwSerial2);
+    bl0940(HardwareSerial *hwSerial, int8_t rxPin, int8_t txPin, HardwareSerial *hwSerial2 = &Serial);
     // bl0940();
     ~bl0940();
+    bool begin();
+    Stream *getStream();
 
     float getVoltage();
     float getCurrent();
     double getActivePower();
+    uint32_t getMilliVolts();
+    uint32_t getMilliAmps();
+    int32_t getMilliWatts();
+    uint32_t getMilliWattHours(uint32_t cf);
     double getReactivePower();
     double getApparentPower();
     uint32_t getCF_CNT();
-    // float getEnergy();
+    float getEnergy();
     float getEnergy(uint32_t cf, uint16_t calibrated_blink_second);
-    // float getEnergyDelta();
+    float getEnergyDelta();
+    bool beginPulseCounter(uint8_t cfPin, pcnt_unit_t unit = PCNT_UNIT_0);
+    uint64_t getTotalPulses();
+    uint64_t getTotalMilliWattHours();
+    uint32_t getPulseMismatches();
+    bl0940EnergyCheckpoint_t getEnergyCheckpoint();
+    void restoreEnergy(const bl0940EnergyCheckpoint_t &checkpoint);
     float getPhaseAngle();
     float getPhaseAngleMod();
     float getPowerFactor(bool percentage = true);
@@ -208,6 +372,9 @@ public:
     float getTemperature();
     bl0940States getState();
     bl0940Config_t getCurrentConfig();
+    void setCalibration(const bl0940Calibration_t &cal);
+    bl0940Calibration_t getCalibration();
+    void resetCalibration();
 
     void setRMSUpdate(uint8_t val = BL0940_RMS_REG_UPDATE_RATE_400MS);
     void setACFrequency(uint8_t val = BL0940_AC_FREQ_50HZ);
@@ -227,10 +394,41 @@ public:
     bool readValuesPhAngle();
     void calcEnergy();
 
+    bool requestReadAll();
+    bool poll();
+    bool busy();
+    void setNotifyTask(TaskHandle_t task);
+    uint32_t getCpuUs();
+    uint32_t getMeasurements();
+
+    bool beginTransaction();
+    bool addRead(uint8_t regAddress);
+    bool sendTransaction();
+    long getTransactionValue(uint8_t index);
+    void setPipelining(bool on);
+    bool getPipelining();
+    uint32_t getBusUs(bool pipelined);
+    uint32_t getPipelineFallbacks();
+
+    uint32_t negotiateBaudRate(const uint32_t *rates, uint8_t count);
+    uint32_t getBaudRate();
+    uint32_t getCrcErrors();
+    uint32_t getFrameErrors();
+    uint32_t getBaudFallbacks();
+
+    bool startWaveStream(uint8_t regAddress = BL0940_V_WAVE_REG_ADDR);
+    void stopWaveStream();
+    const int32_t *getWaveBlock();
+    void releaseWaveBlock();
+    float getWaveRate();
+    uint32_t getWaveOverruns();
+    uint32_t getWaveErrors();
+
 private:
     Stream *_serial;
     Stream *_serial2;
-    uint8_t _rawHolder[21];
+    const uint8_t *_readAll; // last good READALL frame, in one of _txnBuf
+    uint16_t _corner;        // last good phase angle register
     uint8_t _rawHolderPA[2];
     bl0940States _state;
 
@@ -238,17 +436,105 @@ private:
     bl0940Config_t _cfg;
 
     uint32_t _lastCF;
+    bl0940AsyncStates _async;
+    TaskHandle_t _notifyTask;
+    uint32_t _cpuUs;
+    uint32_t _measurements;
+    bool _haveReadAll;
+    uint32_t _readAllMs;
+
+    uint8_t _txnReg[BL0940_TXN_MAX_READS];
+    long _txnValue[BL0940_TXN_MAX_READS];
+    uint8_t _txnCount;
+    uint8_t _txnSent;   // requests on the wire
+    uint8_t _txnExpect; // reply bytes of the requests sent
+    uint8_t _txnIndex;  // reply bytes received
+    uint8_t _txnBuf[2][BL0940_TXN_BUF]; // replies land in the one _readAll is not in
+    uint8_t *_txnRx;
+    uint32_t _txnStartUs;
+    bool _pipelined;
+    uint32_t _busUs[2]; // smoothed request to last reply time, [pipelined]
+    uint32_t _pipelineFallbacks;
+
+    uint32_t _baudRates[BL0940_MAX_BAUD_RATES]; // candidates, highest first
+    uint8_t _baudCount;
+    uint8_t _baudIndex;  // rate in use
+    uint8_t _linkErrors; // failed transfers in a row
+    uint32_t _crcErrors;
+    uint32_t _frameErrors;
+    uint32_t _baudFallbacks;
+
+    int32_t _wave[2][BL0940_WAVE_BLOCK];
+    uint8_t _waveReg;
+    bool _waveStop;     // finish the read in flight, then go idle
+    uint8_t _waveFill;  // buffer being filled
+    int8_t _waveReady;  // buffer owned by the consumer, -1 = none
+    uint16_t _waveIndex;
+    uint32_t _waveSamples;
+    uint32_t _waveStartMs;
+    uint32_t _waveOverruns;
+    uint32_t _waveErrors;
     float pAngle;
     double pwf;
     double activePow;
     double reactivePow;
     double appPow;
+    // Calibrated scale factors, see setCalibration()
+    bl0940Calibration_t _cal;
+    float _vScale;
+    float _iScale;
+    double _pScale;
+    float _kWhPerPulse;
+    uint32_t _mvScale;
+    uint32_t _maScale;
+    uint32_t _mwScale;
+    uint32_t _mwhScale;
+    int32_t _mvOffset;
+    int32_t _maOffset;
+    int32_t _mwOffset;
+
+    // Energy accumulator: CF_CNT is authoritative, the CF pin fills in between reads
+    uint64_t _cfTotal;     // pulses up to the last CF_CNT read
+    uint64_t _cfReported;  // highest total handed out, keeps it monotonic
+    uint64_t _cfDeltaMark; // total at the last getEnergyDelta()
+    bool _cfSynced;        // pin count and register cover the same interval
+    uint32_t _cfMismatches;
+    bool _pcntOn;
+    pcnt_unit_t _pcntUnit;
+    volatile uint32_t _pcntWraps;
+    uint32_t _pcntLast; // last pin count handed out
+    uint32_t _pinAtCF;  // pin count at the last CF_CNT read
+    portMUX_TYPE _pcntMux;
+
+    float _trigAngle; // pAngle the cached cos/tan belong to
+    double _cos;
+    double _tan;
 
+    static uint32_t _fixedScale(uint32_t base, float gain);
+    long _rawWatt();
     void _init();
     void _unlockWRProt();
     void _sendFrame();
     void _rcvFrame();
     void _rcvFrameSingle();
+    void _rcvBytes();
+    void _parseFrame();
+    void _storeCorner(long pa);
+    void _storeReadAll(const uint8_t *frame);
+    uint8_t *_spareBuf();
+    void _readAllTransaction();
+    void _sendTransactionRequests(uint8_t count);
+    bool _serviceTransaction();
+    void _parseTransaction();
+    static uint8_t _replyBytes(uint8_t regAddress);
+    bool _probeBaudRate(uint32_t rate);
+    void _setBaudRate(uint32_t rate);
+    void _linkResult();
+    void _requestRegister(uint8_t regAddress);
+    void _storeWaveSample();
+    void _reconcileEnergy(uint32_t cf);
+    uint32_t _pinPulses();
+    static void _pcntIsr(void *arg);
     void _readConfig();
     void _setParam(uint16_t *reg, uint16_t mask, uint16_t value);
     void _setParam(uint16_t *reg, uint16_t mask, uint8_t value);
@@ -0,0 +1,187 @@
+#include "bl0940Bus.h"
+
+/*!
+ * bl0940Bus::bl0940Bus
+ * Class constructor
+ */
+bl0940Bus::bl0940Bus()
+{
+    _count = 0;
+    _next = 0;
+    _intervalMs = BL0940_DEFAULT_RMS_UPDATE;
+    resetRate();
+}
+
+/*!
+ * bl0940Bus::addChannel
+ * Add a chip to the schedule. A chip behind a select line is selected
+ * and initialized again here, it could not answer at construction.
+ *
+ * @param meter Chip driver
+ * @param selectPin GPIO that connects this chip to its UART, or BL0940_BUS_NO_SELECT
+ * @param selectLevel Level of selectPin that connects the chip
+ * @return Channel number, -1 if the bus is full
+ */
+int8_t bl0940Bus::addChannel(bl0940 *meter, int8_t selectPin, uint8_t selectLevel)
+{
+    if (_count >= BL0940_BUS_MAX_CHANNELS)
+        return -1;
+    bl0940Channel_t &c = _ch[_count];
+    c.meter = meter;
+    c.selectPin = selectPin;
+    c.selectLevel = selectLevel;
+    c.busy = false;
+    c.lastRequestMs = millis() - _intervalMs;
+    c.measurements = 0;
+    c.errors = 0;
+    if (selectPin != BL0940_BUS_NO_SELECT)
+    {
+        pinMode(selectPin, OUTPUT);
+        digitalWrite(selectPin, !selectLevel);
+        _select(_count);
+        meter->begin();
+    }
+    return _count++;
+}
+
+uint8_t bl0940Bus::getChannelCount()
+{
+    return _count;
+}
+
+bl0940 *bl0940Bus::getChannel(uint8_t ch)
+{
+    return (ch < _count) ? _ch[ch].meter : NULL;
+}
+
+/*!
+ * bl0940Bus::setInterval
+ * Time between READALL requests of one channel. Faster than the RMS
+ * register update ( 400 or 800 ms ) only reads the same values again.
+ *
+ * @param ms Interval in milliseconds
+ */
+void bl0940Bus::setInterval(uint16_t ms)
+{
+    _intervalMs = ms;
+}
+
+/*!
+ * bl0940Bus::service
+ * Collect finished measurements and start the ones that are due,
+ * round-robin so no channel waits behind another on a shared UART.
+ * Never blocks.
+ */
+void bl0940Bus::service()
+{
+    for (uint8_t i = 0; i < _count; i++)
+    {
+        bl0940Channel_t &c = _ch[i];
+        if (!c.busy || !c.meter->poll())
+            continue;
+        c.busy = false;
+        if (c.meter->getState() == NO_ERROR)
+        {
+            c.measurements++;
+            _rateMeasurements++;
+        }
+        else
+        {
+            c.errors++;
+        }
+    }
+
+    uint32_t now = millis();
+    for (uint8_t n = 0; n < _count; n++)
+    {
+        uint8_t i = (_next + n) % _count;
+        bl0940Channel_t &c = _ch[i];
+        if (c.busy || ((now - c.lastRequestMs) < _intervalMs))
+            continue;
+        if (_streamBusy(c.meter->getStream()))
+            continue;
+        _select(i);
+        if (!c.meter->requestReadAll())
+            continue; // the application has the chip busy, waveform stream or similar
+        c.busy = true;
+        c.lastRequestMs = now;
+        _next = (i + 1) % _count;
+    }
+}
+
+/*!
+ * bl0940Bus::busy
+ * @return true while any channel waits for a READALL answer
+ */
+bool bl0940Bus::busy()
+{
+    for (uint8_t i = 0; i < _count; i++)
+    {
+        if (_ch[i].busy)
+            return true;
+    }
+    return false;
+}
+
+/*!
+ * bl0940Bus::getMeasurements
+ * Finished measurements of a channel, a new value means fresh readings
+ * in its getters
+ */
+uint32_t bl0940Bus::getMeasurements(uint8_t ch)
+{
+    return (ch < _count) ? _ch[ch].measurements : 0;
+}
+
+uint32_t bl0940Bus::getErrors(uint8_t ch)
+{
+    return (ch < _count) ? _ch[ch].errors : 0;
+}
+
+/*!
+ * bl0940Bus::getRate
+ * Measurements per second of all channels together since resetRate()
+ */
+float bl0940Bus::getRate()
+{
+    uint32_t ms = millis() - _rateStartMs;
+    return (ms == 0) ? 0 : (_rateMeasurements * 1000.0f / ms);
+}
+
+void bl0940Bus::resetRate()
+{
+    _rateStartMs = millis();
+    _rateMeasurements = 0;
+}
+
+/*! private */
+/*!
+ * bl0940Bus::_streamBusy
+ * A request is in flight on this UART, a shared one can carry only one
+ */
+bool bl0940Bus::_streamBusy(Stream *stream)
+{
+    for (uint8_t i = 0; i < _count; i++)
+    {
+        if (_ch[i].busy && (_ch[i].meter->getStream() == stream))
+            return true;
+    }
+    return false;
+}
+
+/*!
+ * bl0940Bus::_select
+ * Connect a chip to its UART, disconnecting the others sharing it
+ */
+void bl0940Bus::_select(uint8_t ch)
+{
+    Stream *stream = _ch[ch].meter->getStream();
+    for (uint8_t i = 0; i < _count; i++)
+    {
+        if ((i == ch) || (_ch[i].selectPin == BL0940_BUS_NO_SELECT) || (_ch[i].meter->getStream() != stream))
+            continue;
+        digitalWrite(_ch[i].selectPin, !_ch[i].selectLevel);
+    }
+    if (_ch[ch].selectPin != BL0940_BUS_NO_SELECT)
+        digitalWrite(_ch[ch].selectPin, _ch[ch].selectLevel);
+}
@@ -0,0 +1,60 @@
+#ifndef _BL0940_BUS_H_
+#define _BL0940_BUS_H_
+
+#include "bl0940.h"
+
+/*!
+ * Several BL0940 on the ESP32 UARTs, one per fixture. Chips on their
+ * own UART measure at the same time, their READALL answers arrive in
+ * overlapping windows. Chips sharing a UART through a select line
+ * ( analog switch or buffer enable ) take turns.
+ *
+ *   bl0940Bus bus;
+ *   bus.addChannel(&meterA);
+ *   bus.addChannel(&meterB, SELECT_PIN);
+ *   loop: bus.service(); if ( bus.getMeasurements(ch) != seen ) ...
+ */
+#define BL0940_BUS_MAX_CHANNELS 4
+#define BL0940_BUS_NO_SELECT -1
+
+struct bl0940Channel_t
+{
+    bl0940 *meter;
+    int8_t selectPin;    // BL0940_BUS_NO_SELECT if the chip has the UART to itself
+    uint8_t selectLevel; // level that connects the chip
+    bool busy;           // READALL in flight
+    uint32_t lastRequestMs;
+    uint32_t measurements; // finished without error
+    uint32_t errors;
+};
+
+class bl0940Bus
+{
+public:
+    bl0940Bus();
+
+    int8_t addChannel(bl0940 *meter, int8_t selectPin = BL0940_BUS_NO_SELECT, uint8_t selectLevel = HIGH);
+    uint8_t getChannelCount();
+    bl0940 *getChannel(uint8_t ch);
+    void setInterval(uint16_t ms);
+
+    void service();
+    bool busy();
+    uint32_t getMeasurements(uint8_t ch);
+    uint32_t getErrors(uint8_t ch);
+    float getRate();
+    void resetRate();
+
+private:
+    bl0940Channel_t _ch[BL0940_BUS_MAX_CHANNELS];
+    uint8_t _count;
+    uint8_t _next; // round-robin start for the next request
+    uint16_t _intervalMs;
+    uint32_t _rateStartMs;
+    uint32_t _rateMeasurements;
+
+    bool _streamBusy(Stream *stream);
+    void _select(uint8_t ch);
+};
+
+#endif
@@ -0,0 +1,64 @@
+#include "jigtrace.h"
+
+#ifdef JIG_TRACE
+#include <atomic>
+
+static jigTraceEvent_t _events[JIG_TRACE_EVENTS];
+static std::atomic<uint32_t> _next(0);
+static volatile bool _paused = false;
+
+/*!
+ * jigTraceRecord
+ * Store one finished scope. Safe to call from both cores, the oldest
+ * events are overwritten once the ring is full.
+ */
+void jigTraceRecord(const char *name, int64_t startUs, uint32_t cycles)
+{
+    if (_paused)
+        return;
+    jigTraceEvent_t &ev = _events[_next.fetch_add(1, std::memory_order_relaxed) % JIG_TRACE_EVENTS];
+    ev.name = name;
+    ev.startUs = startUs;
+    ev.cycles = cycles;
+    ev.core = xPortGetCoreID();
+}
+
+/*!
+ * jigTraceRecordSince
+ * Store a span that started at startUs ( esp_timer_get_time() ), e.g. in
+ * an interrupt or on the other core, and ends now.
+ */
+void jigTraceRecordSince(const char *name, int64_t startUs)
+{
+    jigTraceRecord(name, startUs, (uint32_t)((esp_timer_get_time() - startUs) * ESP.getCpuFreqMHz()));
+}
+
+/*!
+ * jigTraceDump
+ * Print recorded events as Chrome trace JSON, oldest first.
+ * Each core is shown as its own thread, on the esp_timer time line both
+ * cores share.
+ */
+void jigTraceDump(Print &out)
+{
+    _paused = true;
+    uint32_t next = _next.load();
+    uint32_t count = (next < JIG_TRACE_EVENTS) ? next : JIG_TRACE_EVENTS;
+    float mhz = ESP.getCpuFreqMHz();
+    out.print("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const jigTraceEvent_t &ev = _events[(next - count + i) % JIG_TRACE_EVENTS];
+        out.printf("%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                   i ? "," : "", ev.name, (unsigned)ev.core, (double)ev.startUs, ev.cycles / mhz);
+    }
+    out.println("]}");
+    _paused = false;
+}
+
+void jigTraceClear()
+{
+    _next.store(0);
+}
+
+#endif // JIG_TRACE
@@ -0,0 +1,66 @@
+#ifndef _JIGTRACE_H_
+#define _JIGTRACE_H_
+
+/*!
+ * Hot-path timing for the test jig.
+ *
+ * JIG_TRACE_SCOPE("name") measures the enclosing block with the CPU cycle
+ * counter and stores it in a fixed-size ring buffer, stamped with the
+ * esp_timer time it started at. jigTraceDump() prints the buffer as
+ * Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+ *
+ * Tracing is only compiled in with -D JIG_TRACE (see platformio.ini),
+ * otherwise the macros expand to nothing.
+ */
+
+#ifdef JIG_TRACE
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+#include "esp_timer.h"
+
+#ifndef JIG_TRACE_EVENTS
+#define JIG_TRACE_EVENTS 512
+#endif
+
+struct jigTraceEvent_t
+{
+    const char *name;
+    int64_t startUs; // esp_timer_get_time(), the same on both cores
+    uint32_t cycles;
+    uint8_t core;
+};
+
+void jigTraceRecord(const char *name, int64_t startUs, uint32_t cycles);
+void jigTraceRecordSince(const char *name, int64_t startUs);
+void jigTraceDump(Print &out);
+void jigTraceClear();
+
+class jigTraceScope
+{
+public:
+    jigTraceScope(const char *name) : _name(name), _startUs(esp_timer_get_time()), _start(ESP.getCycleCount()) {}
+    ~jigTraceScope() { jigTraceRecord(_name, _startUs, ESP.getCycleCount() - _start); }
+
+private:
+    const char *_name;
+    int64_t _startUs;
+    uint32_t _start;
+};
+
+#define JIG_TRACE_CAT2(a, b) a##b
+#define JIG_TRACE_CAT(a, b) JIG_TRACE_CAT2(a, b)
+#define JIG_TRACE_SCOPE(name) jigTraceScope JIG_TRACE_CAT(_jigTrace, __LINE__)(name)
+#define JIG_TRACE_DUMP(out) jigTraceDump(out)
+
+#else
+
+#define JIG_TRACE_SCOPE(name)
+#define JIG_TRACE_DUMP(out)
+
+#endif // JIG_TRACE
+
+#endif //_JIGTRACE_H_
@@ -12,15 +12,20 @@ bool FLAG_LAN = true; // true = WIFI | false = GSM
 String firmware_version = "0.8.0";
 
 // #define WRITE_EEPROM
+// #define PRODUCTION_MODE // start in production line mode, toggle with 'p' on the console
 // #define DUMMY_DATA
 #define DEBUG_MON
+// #define BL0940_BLOCKING_READ // old busy-waiting energy sensor read, for CPU time comparison
+// #define BINARY_LOG // send log records as binary frames, decode with tools/jiglog_decode.py
 
 #ifdef DEBUG_MON
 #define DEBUGPRINTLN(x) Serial.println(x)
 #define DEBUGPRINT(x) Serial.print(x)
+#define JIG_LOG(...) jigLog.write(__VA_ARGS__)
 #else
 #define DEBUGPRINTLN(x)
 #define DEBUGPRINT(x)
+#define JIG_LOG(...)
 #endif
 
 // #define TINY_GSM_MODEM_BG96
@@ -138,13 +143,12 @@ const char gprsPass[] = "";
 #define BL0940_TX 26
 #define EM_CF_PIN 32
 #define EM_LED_PIN 12
-#define RELAY_PIN 15
 #define PWRKEY_PIN 17
 #define RESET_PIN 27
 #define AT_TX_PIN 19
 #define AT_RX_PIN 23
-#define DHT_PIN 10
 #define BUTTON_PIN 33
+// RELAY_PIN, DHT_PIN and LIGHT_INT_PIN are with the checks in jigChecks.h
 
 String lpwan = "NBIoT";
 int stateConn = 0;
@@ -211,31 +215,41 @@ int wdtPeriodWifiMs = 100000;
 // Energy Meter BL0940 variable and definition
 --------------------------------------------*/
 
+// SerialEM, em_bl0940 and the energy check limits are in jigChecks.h
 #include <bl0940.h>
-HardwareSerial SerialEM(2);
-
-bl0940 em_bl0940(&SerialEM, &Serial);
+// UART rates to negotiate at boot. A BL0940 only talks at 4800 baud,
+// faster rates are for parts strapped for them.
+const uint32_t bl0940BaudRates[] = {BL0940_DEFAULT_BAUD_RATE};
+// Console 'u' times these, restoring the negotiated rate afterwards
+const uint32_t bl0940BenchRates[] = {4800, 9600, 19200, 38400};
+#define BAUD_BENCH_FRAMES 20
 unsigned long lastHandleBL0940 = 0;
 int handleBL0940Ms = 3000;
 
 bl0940Config_t configbl0940;
-float voltage;
 float lastVoltage = 0.0;
-float current, lastCurrent;
-double activePower, lastActivePower;
+float lastCurrent;
+double lastActivePower;
 double activePower2;
 double reactivePower;
-double apparentPower;
 float Energy;
 float EnergyCF;
-float EnergyDelta;
 float PhaseAngle;
-float PowerFactor, PowerFactorMod, PowerFactor3, lastPowerFactor;
+float PowerFactorMod, PowerFactor3, lastPowerFactor;
 uint32_t c_f = 0;
 String lastStandKwhBuff, lastMonthlyKwhBuff;
 bool FLAG_ADD_ENERGY_CF = false;
 int counterCF = 0;
 
+// Calibration (console 'k'): RMS readings with the relay off, then with the
+// reference load switched on, fitted against these values
+#define CAL_REF_VOLTS 220.0
+#define CAL_REF_LOAD_AMPS 0.455
+#define CAL_REF_LOAD_WATTS 100.0
+#define CAL_SAMPLES 8
+#define CAL_SAMPLE_MS 400 // BL0940_RMS_REG_UPDATE_RATE_400MS
+#define CAL_SETTLE_MS 1000
+
 /*---------------------------------------------
 //       RTC variable and definition
 ---------------------------------------------*/
@@ -247,6 +261,12 @@ int counterCF = 0;
 timestamp32bits stamp = timestamp32bits();
 
 PCD85063TP clockrtc; // define a object of PCD85063TP class
+// Console 'i' timestamps with clockrtc at RTC_BENCH_HZ for RTC_BENCH_MS,
+// once reading the chip on every call and once through its time cache
+#define RTC_WIRE Wire
+#define RTC_BENCH_HZ 10
+#define RTC_BENCH_MS 30000
+#define RTC_MAX_ERROR_MS 100 // see PCF85063TP::setTimeCache()
 
 uint16_t calibrated_blink_second = 5900;
 unsigned long unixTimestamp;
@@ -254,8 +274,8 @@ unsigned long unixTimestamp;
 /*---------------------------------------------
 //            0-10V Controller
 -----------------[---------------------------*/
+// dacZeroTen is in jigChecks.h
 #include "DFRobot_GP8403.h"
-DFRobot_GP8403 dacZeroTen(&Wire, 0x58);
 
 int nilaiDAC;
 
@@ -263,41 +283,11 @@ int nilaiDAC;
 //      LIGHT SENSOR variable and definition
 ---------------------------------------------*/
 #include <LTR308.h>
+#include "lightRange.h"
 
-LTR308 light(&Wire1);
+// light, its range and the data-ready settings are in jigChecks.h
 double lux; // Resulting lux value
 
-// Global variables:
-
-// If gain = 0, device is set to 1X gain
-// If gain = 1, device is set to 3X gain (default)
-// If gain = 2, device is set to 6X gain
-// If gain = 3, device is set to 9X gain
-// If gain = 4, device is set to 18X gain
-unsigned char gain = 1; // Gain setting, values = 0-4
-
-//------------------------------------------------------
-// If integrationTime = 0, integrationTime will be 400ms / 20 bits result
-// If integrationTime = 1, integrationTime will be 200ms / 19 bits result
-// If integrationTime = 2, integrationTime will be 100ms / 18 bits result (default)
-// If integrationTime = 3, integrationTime will be 50ms / 17 bits result
-// If integrationTime = 4, integrationTime will be 25ms / 16 bits result
-unsigned char integrationTime = 0; // Integration ("shutter") time, values 0 - 4
-
-//------------------------------------------------------
-// If measurementRate = 0, measurementRate will be 25ms
-// If measurementRate = 1, measurementRate will be 50ms
-// If measurementRate = 2, measurementRate will be 100ms (default)
-// If measurementRate = 3, measurementRate will be 500ms
-// If measurementRate = 5, measurementRate will be 1000ms
-// If measurementRate = 6, measurementRate will be 2000ms
-// If measurementRate = 7, measurementRate will be 2000ms
-unsigned char measurementRate = 3; // Interval between DATA_REGISTERS update, values 0 - 7, except 4
-
-//------------------------------------------------------
-// Chip ID - should be 0xB1 for all LTR-308
-unsigned char ID;
-
 //------------------------------------------------------
 // Main Control Register
 unsigned char control;
@@ -306,7 +296,8 @@ unsigned char control;
 //      EEPROM variable and definition
 ---------------------------------------------*/
 #include <I2C_EEPROM.h>
-AT24C64<> eep;
+#include "energyCalibration.h"
+// eep and the calibration/energy checkpoint addresses are in jigChecks.h
 uint16_t FLASH_MARKING_ADDR = 0;
 uint16_t FLAG_TURN_ON_WIFI_ADD = 5;
 uint16_t ID_LAMP_ADDR = 10;
@@ -351,12 +342,10 @@ struct
 //      DHT variable and definition
 ---------------------------------------------*/
 
+// dht and temp are in jigChecks.h
 #include <DHT.h>
-#define DHTTYPE DHT22
-DHT dht(DHT_PIN, DHTTYPE);
 unsigned long lastReadDht = 0;
 int periodDhtMs = 10000;
-float temp = 0.0;
 
 /*================================
             WIFI
@@ -419,9 +408,23 @@ String boardid = "ABCDEFGHIJKLMNOPQRSTU";
 #define RS485_TX_PIN 16
 #define RS485_RX_PIN 22
 
+// Render into a 160x128 RGB565 canvas in RAM and push it to the panel
+// with one DMA flush instead of drawing every primitive over SPI
+// #define LCD_FRAMEBUFFER
+#define LCD_WIDTH 160
+#define LCD_HEIGHT 128
+
 #include <Arduino_GFX_Library.h>
+#ifdef LCD_FRAMEBUFFER
+Arduino_ESP32SPIDMA bus = Arduino_ESP32SPIDMA(TFT_DC, TFT_CS, TFT_SCK, TFT_MOSI, GFX_NOT_DEFINED);
+Arduino_ST7735 display = Arduino_ST7735(&bus, TFT_RST);
+Arduino_Canvas canvas = Arduino_Canvas(LCD_WIDTH, LCD_HEIGHT, &display);
+Arduino_GFX *gfx = &canvas;
+#else
 Arduino_ESP32SPI bus = Arduino_ESP32SPI(TFT_DC, TFT_CS, TFT_SCK, TFT_MOSI);
 Arduino_ST7735 display = Arduino_ST7735(&bus, TFT_RST);
+Arduino_GFX *gfx = &display;
+#endif
 
 const int freq = 5000;
 const int ledChannel = 0;
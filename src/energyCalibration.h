@@ -0,0 +1,143 @@
+#ifndef ENERGYCALIBRATION_H
+#define ENERGYCALIBRATION_H
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <bl0940.h>
+
+/*---------------------------------------------
+//       BL0940 per-board calibration
+---------------------------------------------*/
+
+// Least-squares line through the (reading, reference) pairs of one quantity:
+// reference = gain * reading + offset
+class LinearFit
+{
+public:
+  LinearFit() { reset(); }
+
+  void reset()
+  {
+    _n = 0;
+    _sx = _sy = _sxx = _sxy = 0;
+  }
+
+  void add(double x, double y)
+  {
+    _n++;
+    _sx += x;
+    _sy += y;
+    _sxx += x * x;
+    _sxy += x * y;
+  }
+
+  uint16_t count() const { return _n; }
+
+  // Without withOffset, or when all readings are the same, the line goes
+  // through the origin and only the gain is fitted
+  bool solve(float &gain, float &offset, bool withOffset = true) const
+  {
+    if (_n == 0 || _sxx <= 0)
+      return false;
+    double det = _n * _sxx - _sx * _sx;
+    if (withOffset && _n > 1 && det > 1e-9 * _sxx * _n)
+    {
+      gain = (_n * _sxy - _sx * _sy) / det;
+      offset = (_sy - gain * _sx) / _n;
+    }
+    else
+    {
+      gain = _sxy / _sxx;
+      offset = 0;
+    }
+    return true;
+  }
+
+private:
+  uint16_t _n;
+  double _sx;
+  double _sy;
+  double _sxx;
+  double _sxy;
+};
+
+// EEPROM image of the coefficients, see BL0940_CAL_ADDR
+#define CAL_RECORD_MAGIC 0x4C414342 // "BCAL"
+#define CAL_GAIN_MIN 0.5f
+#define CAL_GAIN_MAX 2.0f
+
+struct CalibrationRecord
+{
+  uint32_t magic;
+  bl0940Calibration_t cal;
+  uint8_t crc;
+};
+
+static inline uint8_t recordCrc(const void *rec, size_t len)
+{
+  const uint8_t *p = (const uint8_t *)rec;
+  uint8_t crc = 0;
+  for (size_t i = 0; i < len; i++)
+  {
+    crc ^= p[i];
+    for (uint8_t b = 0; b < 8; b++)
+      crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+  }
+  return crc;
+}
+
+static inline uint8_t calibrationCrc(const CalibrationRecord &rec)
+{
+  return recordCrc(&rec, offsetof(CalibrationRecord, crc));
+}
+
+static inline void calibrationSeal(CalibrationRecord &rec, const bl0940Calibration_t &cal)
+{
+  memset(&rec, 0, sizeof(rec));
+  rec.magic = CAL_RECORD_MAGIC;
+  rec.cal = cal;
+  rec.crc = calibrationCrc(rec);
+}
+
+static inline bool calibrationGainValid(float gain)
+{
+  return gain >= CAL_GAIN_MIN && gain <= CAL_GAIN_MAX;
+}
+
+// Blank or foreign EEPROM, or a fit that went wrong
+static inline bool calibrationValid(const CalibrationRecord &rec)
+{
+  if (rec.magic != CAL_RECORD_MAGIC || rec.crc != calibrationCrc(rec))
+    return false;
+  return calibrationGainValid(rec.cal.vGain) && calibrationGainValid(rec.cal.iGain) &&
+         calibrationGainValid(rec.cal.pGain) && calibrationGainValid(rec.cal.eGain);
+}
+
+/*---------------------------------------------
+//         BL0940 energy checkpoint
+---------------------------------------------*/
+
+// EEPROM image of the energy total, see ENERGY_CHECKPOINT_ADDR
+#define ENERGY_RECORD_MAGIC 0x47524E45 // "ENRG"
+
+struct EnergyRecord
+{
+  uint32_t magic;
+  bl0940EnergyCheckpoint_t checkpoint;
+  uint8_t crc;
+};
+
+static inline void energySeal(EnergyRecord &rec, const bl0940EnergyCheckpoint_t &checkpoint)
+{
+  memset(&rec, 0, sizeof(rec));
+  rec.magic = ENERGY_RECORD_MAGIC;
+  rec.checkpoint = checkpoint;
+  rec.crc = recordCrc(&rec, offsetof(EnergyRecord, crc));
+}
+
+static inline bool energyValid(const EnergyRecord &rec)
+{
+  return rec.magic == ENERGY_RECORD_MAGIC && rec.crc == recordCrc(&rec, offsetof(EnergyRecord, crc));
+}
+
+#endif
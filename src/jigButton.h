@@ -0,0 +1,73 @@
+#ifndef JIGBUTTON_H
+#define JIGBUTTON_H
+#include <Arduino.h>
+
+/*---------------------------------------------
+//        Interrupt driven push button
+---------------------------------------------*/
+
+// The edge interrupt timestamps a press immediately. Further edges within
+// BUTTON_DEBOUNCE_US are contact bounce and only counted. A press is
+// handed out once the pin is still active BUTTON_CONFIRM_US after the
+// edge, which filters short spikes on the fixture cable.
+
+#define BUTTON_DEBOUNCE_US 50000
+#define BUTTON_CONFIRM_US 5000
+
+class JigButton
+{
+public:
+  JigButton() : _pin(0), _activeLevel(HIGH), _pending(false), _pressUs(0), _lastEdgeUs(0), _bounces(0) {}
+
+  void begin(uint8_t pin, uint8_t activeLevel = HIGH)
+  {
+    _pin = pin;
+    _activeLevel = activeLevel;
+    attachInterruptArg(digitalPinToInterrupt(pin), _isr, this, activeLevel == HIGH ? RISING : FALLING);
+  }
+
+  // Poll from loop(). True once per debounced press, pressUs is the
+  // micros() of the edge that started it.
+  bool takePress(uint32_t &pressUs)
+  {
+    if (!_pending)
+      return false;
+    uint32_t edgeUs = _pressUs;
+    if ((micros() - edgeUs) < BUTTON_CONFIRM_US)
+      return false;
+    _pending = false;
+    if (digitalRead(_pin) != _activeLevel)
+      return false; // glitch, released before confirm time
+    pressUs = edgeUs;
+    return true;
+  }
+
+  // Edges ignored as contact bounce
+  uint32_t bounces() const { return _bounces; }
+
+private:
+  static void IRAM_ATTR _isr(void *arg)
+  {
+    JigButton *self = (JigButton *)arg;
+    uint32_t now = micros();
+    if ((now - self->_lastEdgeUs) < BUTTON_DEBOUNCE_US)
+    {
+      self->_bounces++;
+      return;
+    }
+    self->_lastEdgeUs = now;
+    if (self->_pending)
+      return;
+    self->_pressUs = now;
+    self->_pending = true;
+  }
+
+  uint8_t _pin;
+  uint8_t _activeLevel;
+  volatile bool _pending;
+  volatile uint32_t _pressUs;
+  volatile uint32_t _lastEdgeUs;
+  volatile uint32_t _bounces;
+};
+
+#endif
@@ -0,0 +1,501 @@
+#ifndef JIGCHECKS_H
+#define JIGCHECKS_H
+#include <Arduino.h>
+#include <HardwareSerial.h>
+#include <Wire.h>
+#include <bl0940.h>
+#include <LTR308.h>
+#include <DHT.h>
+#include <I2C_EEPROM.h>
+#include <jigtrace.h>
+#include "DFRobot_GP8403.h"
+#include "jigScheduler.h"
+#include "jigQueue.h"
+#include "jigLog.h"
+#include "lightRange.h"
+#include "runningStats.h"
+#include "energyCalibration.h"
+
+/*---------------------------------------------
+//   Fixture checks, advanced by JigScheduler
+---------------------------------------------*/
+
+// The DAC, temperature, light and energy checks with the fixture devices
+// they talk to. main.cpp pulls in WiFi, TinyGSM and the web server, so
+// the checks live here where [env:native] builds the same code against
+// the device models (test/test_native_sim).
+//
+// Whoever includes this defines postRecord(), main.cpp queues the
+// records for uiTask, and jigLog.
+
+void postRecord(uint8_t item, bool passed, uint8_t error = 0, float v0 = 0, float v1 = 0, float v2 = 0, float v3 = 0);
+extern JigLog jigLog;
+#ifndef JIG_LOG
+#define JIG_LOG(...) jigLog.write(__VA_ARGS__) // defVar.h sets it with DEBUG_MON
+#endif
+
+bool setupDAC(JigCheck &check, uint32_t now);
+bool setupTempSensor(JigCheck &check, uint32_t now);
+bool setupLightSensor(JigCheck &check, uint32_t now);
+bool startLightConversion(JigCheck &check, uint32_t now);
+bool setupEnergySensor(JigCheck &check, uint32_t now);
+bool checkVoltageWave(JigCheck &check);
+float crestFactor(const int32_t *samples, uint16_t n, float &peak, float &rms);
+AcceptVerdict energyVerdict(bool last);
+void loadCalibration();
+void loadEnergyCheckpoint();
+void saveEnergyCheckpoint();
+
+// Fixture pins of the checks, the rest of the pinout is in defVar.h
+#define RELAY_PIN 15
+#define DHT_PIN 10
+// LTR308 INT (open drain, needs an external pull-up), -1 polls STATUS.
+// Set it on fixtures where INT is wired; the input-only GPIO34-39 have
+// no internal pull-up
+#define LIGHT_INT_PIN -1
+
+/*---------------------------------------------
+// Energy Meter BL0940 variable and definition
+--------------------------------------------*/
+
+HardwareSerial SerialEM(2);
+
+bl0940 em_bl0940(&SerialEM, &Serial);
+
+// Last reading of the energy check
+float voltage;
+float current;
+double activePower;
+double apparentPower;
+float EnergyDelta;
+float PowerFactor;
+
+// Energy check acceptance: one sample per RMS update until every quantity
+// is clearly inside or outside its band, ENERGY_MAX_SAMPLES at most
+enum EnergyQuantity : uint8_t
+{
+  EQ_VOLTAGE,
+  EQ_CURRENT,
+  EQ_POWER,
+  EQ_POWER_FACTOR,
+  EQ_COUNT
+};
+// min, max, max standard deviation, for the lamp load switched by RELAY_PIN
+const AcceptLimit energyLimits[EQ_COUNT] = {
+    {198.0, 242.0, 2.0}, // V, 220 V +-10 %
+    {0.05, 1.0, 0.02},   // A
+    {10.0, 200.0, 3.0},  // W
+    {0.5, 1.0, 0.05},    // power factor
+};
+#define ENERGY_MIN_SAMPLES 3
+#define ENERGY_MAX_SAMPLES 6
+#define ENERGY_MAX_ERRORS 2      // failed reads before the check fails
+#define ENERGY_OUTLIER_SIGMA 3.0 // samples further from the mean are dropped
+#define ENERGY_VERDICT_SIGMA 3.0 // standard errors the mean must clear a band edge by
+
+// Energy total is saved to the board EEPROM every ENERGY_CHECKPOINT_MWH
+#define ENERGY_CHECKPOINT_MWH 1000
+
+// One voltage waveform block after the energy check, about 0.8 s more per
+// cycle at 4800 baud. Off on the line, console 'w' toggles it
+volatile bool waveCheckEnabled = false;
+volatile bool pipelineToggleRequested = false; // applied by the next energy check
+
+// Energy check samples of the current board, see energyLimits
+RunningStats energyStats[EQ_COUNT];
+uint8_t energyReads = 0;
+uint8_t energyErrors = 0;
+
+// Energy total of the board in the fixture, checkpointed to its EEPROM
+uint32_t boardSeq = 0;             // counted up by serviceProduction()
+uint32_t energyBoard = UINT32_MAX; // boardSeq the total was restored for
+uint64_t checkpointMwh = 0;
+
+/*---------------------------------------------
+//            0-10V Controller
+---------------------------------------------*/
+
+DFRobot_GP8403 dacZeroTen(&Wire, 0x58);
+
+/*---------------------------------------------
+//      LIGHT SENSOR variable and definition
+---------------------------------------------*/
+
+LTR308 light(&Wire1);
+
+// Gain, integration time and measurement rate of the last conversion,
+// chosen per reading by the auto-range controller (lightRange.h)
+unsigned char gain = 1;            // 0 - 4, 1X 3X 6X 9X 18X
+unsigned char integrationTime = 4; // 0 - 4, 400 200 100 50 25 ms
+unsigned char measurementRate = 0; // 0 - 7 except 4, see lightPeriodMs
+
+// The first conversion of a board uses the last good range of this
+// fixture, after power-up the shortest integration at LIGHT_START_GAIN
+#define LIGHT_START_GAIN 1
+LightRange lightFixtureRange = {LIGHT_START_GAIN, LIGHT_SHORTEST_INTEGRATION};
+LightAutoRange lightAutoRange;
+
+// Chip ID - should be 0xB1 for all LTR-308
+unsigned char ID;
+
+// Data-ready acquisition: the check waits for the INT pin, or polls the
+// STATUS register every LIGHT_POLL_MS without it. A conversion later than
+// the measurement period plus LIGHT_READY_MARGIN_MS fails the check.
+#define LIGHT_POLL_MS 5
+#define LIGHT_READY_MARGIN_MS 100
+
+// LTR308 conversion in flight since lightStartMs, lightBeginMs is the
+// start of the first one of the reading
+uint32_t lightStartMs = 0;
+uint32_t lightBeginMs = 0;
+
+/*---------------------------------------------
+//      EEPROM variable and definition
+---------------------------------------------*/
+
+AT24C64<> eep;
+const uint16_t BL0940_CAL_ADDR = 700;        // CalibrationRecord
+const uint16_t ENERGY_CHECKPOINT_ADDR = 740; // EnergyRecord
+static_assert(BL0940_CAL_ADDR + sizeof(CalibrationRecord) <= ENERGY_CHECKPOINT_ADDR,
+              "CalibrationRecord overlaps the energy checkpoint");
+
+/*---------------------------------------------
+//      DHT variable and definition
+---------------------------------------------*/
+
+#define DHTTYPE DHT22
+DHT dht(DHT_PIN, DHTTYPE);
+float temp = 0.0;
+
+/*---------------------------------------------
+//                 Checks
+---------------------------------------------*/
+
+// The checks of one cycle, in the order of the result table
+void addJigChecks(JigScheduler &jig)
+{
+  jig.add("DAC", setupDAC);
+  jig.add("TEMP", setupTempSensor);
+  jig.add("LIGHT", setupLightSensor);
+  jig.add("ENERGY", setupEnergySensor);
+}
+
+bool setupDAC(JigCheck &check, uint32_t now)
+{
+  JIG_TRACE_SCOPE("setupDAC");
+  if (dacZeroTen.begin() != 0)
+  {
+    postRecord(ITEM_DAC_READ, false);
+    postRecord(ITEM_DAC_WRITE, false);
+    return true;
+  }
+  postRecord(ITEM_DAC_READ, true);
+
+  dacZeroTen.setDACOutRange(dacZeroTen.eOutputRange10V);
+  digitalWrite(RELAY_PIN, HIGH);
+  dacZeroTen.setDACOutVoltage(5000, 1);
+  postRecord(ITEM_DAC_WRITE, true, 0, 5000);
+  return true;
+}
+
+bool setupTempSensor(JigCheck &check, uint32_t now)
+{
+  JIG_TRACE_SCOPE("setupTempSensor");
+  if (check.state == 0)
+  {
+    dht.begin();
+    // DHT22 warm-up
+    check.state = 1;
+    check.waitFor(now, 3000);
+    return false;
+  }
+
+  temp = dht.readTemperature();
+  postRecord(ITEM_TEMP, !isnan(temp), 0, temp);
+  return true;
+}
+
+bool setupEnergySensor(JigCheck &check, uint32_t now)
+{
+  JIG_TRACE_SCOPE("setupEnergySensor");
+  if (check.state == 0)
+  {
+    // Let the RMS registers settle after the relay switched the load on
+    check.state = 1;
+    check.waitFor(now, 1000);
+    // A stream left over from a timed out cycle ends with its read in flight
+    em_bl0940.stopWaveStream();
+    loadCalibration();
+    loadEnergyCheckpoint();
+    for (uint8_t i = 0; i < EQ_COUNT; i++)
+      energyStats[i].reset();
+    energyReads = 0;
+    energyErrors = 0;
+    return false;
+  }
+  if (check.state >= 3)
+    return checkVoltageWave(check);
+  if (!em_bl0940.poll())
+    return false;
+
+  if (check.state == 1 && pipelineToggleRequested)
+  {
+    pipelineToggleRequested = false;
+    em_bl0940.setPipelining(!em_bl0940.getPipelining());
+    JIG_LOG(em_bl0940.getPipelining() ? LOG_PIPELINING_ON : LOG_PIPELINING_OFF);
+  }
+#ifdef BL0940_BLOCKING_READ
+  em_bl0940.readValues();
+#else
+  // READALL and the phase angle arrive while the other checks run
+  if (check.state == 1)
+  {
+    em_bl0940.requestReadAll();
+    check.state = 2;
+    return false;
+  }
+#endif
+  voltage = em_bl0940.getVoltage();
+  current = em_bl0940.getCurrent();
+  activePower = em_bl0940.getActivePower();
+  apparentPower = voltage * current;
+  PowerFactor = activePower / apparentPower;
+
+  // CF_CNT of this read plus the CF pulses counted since
+  float energy = em_bl0940.getEnergy();
+  EnergyDelta = em_bl0940.getEnergyDelta();
+  saveEnergyCheckpoint();
+
+  if (PowerFactor > 1)
+  {
+    PowerFactor = 1;
+  }
+  if (activePower == 0 || apparentPower == 0)
+  {
+    PowerFactor = 0.01;
+  }
+  if (PowerFactor < 0.01)
+  {
+    PowerFactor = 0.01;
+  }
+
+  energyReads++;
+  if (em_bl0940.getState() == NO_ERROR)
+  {
+    const float sample[EQ_COUNT] = {voltage, current, (float)activePower, PowerFactor};
+    for (uint8_t i = 0; i < EQ_COUNT; i++)
+      energyStats[i].add(sample[i], ENERGY_OUTLIER_SIGMA, energyLimits[i].maxStddev);
+  }
+  else
+  {
+    energyErrors++;
+  }
+  AcceptVerdict verdict = energyVerdict(energyReads >= ENERGY_MAX_SAMPLES);
+  if (verdict == VERDICT_PENDING)
+  {
+    // Next sample once the RMS registers were updated
+    check.state = 1;
+    check.waitFor(now, em_bl0940.getCurrentConfig().rmsUpdate);
+    return false;
+  }
+  for (uint8_t i = 0; i < EQ_COUNT; i++)
+  {
+    const RunningStats &s = energyStats[i];
+    JIG_LOG(LOG_ENERGY_STATS, i, s.mean(), s.stddev(), s.lowest(), s.highest(), s.rejected());
+  }
+  JIG_LOG(LOG_ENERGY_SAMPLES, energyReads, energyErrors, now - check.startMs);
+
+  postRecord(ITEM_ENERGY, verdict == VERDICT_PASS, em_bl0940.getState(), energyStats[EQ_VOLTAGE].mean(),
+             energyStats[EQ_CURRENT].mean(), energyStats[EQ_POWER].mean(), energy);
+
+  // Then one block of the voltage waveform, when asked for
+  if (!waveCheckEnabled || !em_bl0940.startWaveStream(BL0940_V_WAVE_REG_ADDR))
+    return true;
+  check.state = 3;
+  return false;
+}
+
+/*
+ * Pass once all quantities are inside their band, fail as soon as one
+ * is outside or the reads keep failing
+ */
+AcceptVerdict energyVerdict(bool last)
+{
+  if (energyErrors > ENERGY_MAX_ERRORS)
+    return VERDICT_FAIL;
+  AcceptVerdict verdict = VERDICT_PASS;
+  for (uint8_t i = 0; i < EQ_COUNT; i++)
+  {
+    AcceptVerdict v = acceptVerdict(energyStats[i], energyLimits[i], ENERGY_MIN_SAMPLES, ENERGY_VERDICT_SIGMA, last);
+    if (v == VERDICT_FAIL)
+      return VERDICT_FAIL;
+    if (v == VERDICT_PENDING)
+      verdict = VERDICT_PENDING;
+  }
+  return verdict;
+}
+
+bool checkVoltageWave(JigCheck &check)
+{
+  if (check.state == 3)
+  {
+    em_bl0940.poll();
+    const int32_t *block = em_bl0940.getWaveBlock();
+    if (block == NULL)
+      return false;
+    float peak, rms;
+    float crest = crestFactor(block, BL0940_WAVE_BLOCK, peak, rms);
+    em_bl0940.releaseWaveBlock();
+    em_bl0940.stopWaveStream();
+    postRecord(ITEM_WAVE, rms > 0, 0, crest, em_bl0940.getWaveRate(), peak, rms);
+    check.state = 4;
+  }
+  return em_bl0940.poll();
+}
+
+/*
+ * Peak over RMS of one waveform block, DC removed. The UART limits the
+ * stream far below the mains frequency, so the samples land on scattered
+ * phases of the period and the peak is an estimate (1.414 for a sine).
+ */
+float crestFactor(const int32_t *samples, uint16_t n, float &peak, float &rms)
+{
+  float mean = 0;
+  for (uint16_t i = 0; i < n; i++)
+    mean += samples[i];
+  mean /= n;
+
+  float sumSq = 0;
+  peak = 0;
+  for (uint16_t i = 0; i < n; i++)
+  {
+    float v = samples[i] - mean;
+    sumSq += v * v;
+    if (fabsf(v) > peak)
+      peak = fabsf(v);
+  }
+  rms = sqrtf(sumSq / n);
+  return rms > 0 ? peak / rms : 0;
+}
+
+bool setupLightSensor(JigCheck &check, uint32_t now)
+{
+  JIG_TRACE_SCOPE("setupLightSensor");
+  if (check.state == 0)
+  {
+    light.begin();
+    light.resetBusStats();
+    bool lightPass = light.getPartID(ID); // Mark as failed if any step fails
+    lightPass = lightPass && light.setPowerUp();
+
+    // First conversion at the range that worked last on this fixture
+    lightAutoRange.begin(lightFixtureRange);
+    lightBeginMs = now;
+    if (lightPass && startLightConversion(check, now))
+    {
+      check.state = 1;
+      return false;
+    }
+    postRecord(ITEM_LIGHT, false, light.getError(), 0, 0, ID);
+    return true;
+  }
+
+  // Woken by the INT pin; without it, or once the conversion is overdue,
+  // the STATUS register is asked
+  uint32_t waited = now - lightStartMs;
+  uint16_t integrationMs = lightIntegrationMs[integrationTime];
+  uint16_t periodMs = lightPeriodMs[measurementRate & 0x07];
+  uint32_t limitMs = (periodMs > integrationMs ? periodMs : integrationMs) + LIGHT_READY_MARGIN_MS;
+  if (!light.dataReady(LIGHT_INT_PIN < 0 || waited >= limitMs))
+  {
+    if (waited < limitMs)
+    {
+      if (LIGHT_INT_PIN < 0)
+        check.waitFor(now, LIGHT_POLL_MS);
+      return false;
+    }
+  }
+
+  unsigned long rawData = 0;
+  double luxValue = 0;
+  bool lightPass = light.readLatest(rawData, 0);
+  JIG_LOG(LOG_LIGHT_READY, waited, light.getReadyLatencyUs(), light.getInterrupts());
+  if (lightPass)
+  {
+    LightRangeStep step = lightAutoRange.update(rawData);
+    if (step == RANGE_RETRY)
+    {
+      if (startLightConversion(check, now))
+        return false;
+      lightPass = false;
+    }
+    else
+    {
+      lightPass = (step == RANGE_DONE) && light.getLux(gain, integrationTime, rawData, luxValue);
+      if (lightPass)
+        lightFixtureRange = lightAutoRange.suggested();
+    }
+    JIG_LOG(LOG_LIGHT_RANGE, lightGainX[gain], lightIntegrationMs[integrationTime], rawData,
+            lightAutoRange.conversions(), now - lightBeginMs);
+  }
+  LTR308BusStats_t bus = light.getBusStats();
+  JIG_LOG(LOG_LIGHT_BUS, bus.transactions, bus.bytes, bus.busUs, bus.skippedWrites);
+  postRecord(ITEM_LIGHT, lightPass, light.getError(), luxValue, rawData, ID);
+  return true;
+}
+
+// Program the auto-range controller's range and wait for its conversion
+bool startLightConversion(JigCheck &check, uint32_t now)
+{
+  const LightRange &r = lightAutoRange.range();
+  gain = r.gain;
+  integrationTime = r.integration;
+  measurementRate = lightMeasurementRate[r.integration];
+  // One write for both registers, nothing is sent for an unchanged range
+  if (!(light.setRange(gain, integrationTime, measurementRate) && light.beginDataReady(LIGHT_INT_PIN)))
+    return false;
+  lightStartMs = now;
+  // Nothing can be ready before one integration time
+  check.waitFor(now, lightIntegrationMs[integrationTime]);
+  return true;
+}
+
+// Coefficients of the board in the fixture, identity when it has none
+void loadCalibration()
+{
+  CalibrationRecord rec;
+  eep.get(BL0940_CAL_ADDR, rec);
+  if (calibrationValid(rec))
+    em_bl0940.setCalibration(rec.cal);
+  else
+    em_bl0940.resetCalibration();
+}
+
+// Continue the total saved on the board, once per inserted board
+void loadEnergyCheckpoint()
+{
+  if (energyBoard == boardSeq)
+    return;
+  energyBoard = boardSeq;
+  EnergyRecord rec;
+  eep.get(ENERGY_CHECKPOINT_ADDR, rec);
+  bl0940EnergyCheckpoint_t checkpoint = {0, 0};
+  if (energyValid(rec))
+    checkpoint = rec.checkpoint;
+  em_bl0940.restoreEnergy(checkpoint);
+  checkpointMwh = em_bl0940.getTotalMilliWattHours();
+}
+
+void saveEnergyCheckpoint()
+{
+  uint64_t mwh = em_bl0940.getTotalMilliWattHours();
+  if (mwh - checkpointMwh < ENERGY_CHECKPOINT_MWH)
+    return;
+  EnergyRecord rec;
+  energySeal(rec, em_bl0940.getEnergyCheckpoint());
+  eep.put(ENERGY_CHECKPOINT_ADDR, rec);
+  checkpointMwh = mwh;
+  JIG_LOG(LOG_ENERGY_CHECKPOINT, mwh / 1000.0, em_bl0940.getPulseMismatches());
+}
+
+#endif
@@ -0,0 +1,258 @@
+#ifndef JIGLOG_H
+#define JIGLOG_H
+#include <Arduino.h>
+#include <string.h>
+#include "jigQueue.h"
+
+/*---------------------------------------------
+//          Deferred binary log
+---------------------------------------------*/
+
+// A log call only stores the format ID and its raw arguments; formatting
+// and the serial output happen later in the log task. With BINARY_LOG the
+// record is sent as a frame and turned back into text on the host with
+// tools/jiglog_decode.py, which reads the format table below from this file.
+//
+// Arguments are 32 bit words: %d, %u, %x, %X take integers and %f floats.
+// Keep the IDs in order once released, the decoder relies on the position.
+
+#define JIG_LOG_FORMATS(X)                                                                           \
+  X(LOG_DAC_READ_PASSED, "\n============ DAC READ =============\nDAC setup passed.")                 \
+  X(LOG_DAC_READ_FAILED, "\n============ DAC READ =============\nDAC setup failed.")                 \
+  X(LOG_DAC_WRITE_PASSED, "\n============ DAC WRITE =============\nDAC write passed.")              \
+  X(LOG_TEMP_PASSED, "\n============ Temperature Sensor =============\nTemperature :%.2f\n"         \
+                     "Temperature sensor setup passed.")                                             \
+  X(LOG_TEMP_FAILED, "\n============ Temperature Sensor =============\nTemperature :%.2f\n"         \
+                     "Temperature sensor setup failed.")                                             \
+  X(LOG_LIGHT_PART_ID, "\n============ Light Sensor =============\nGot Sensor Part ID: 0X%X")      \
+  X(LOG_I2C_SUCCESS, "\nI2C error: success\n")                                                      \
+  X(LOG_I2C_DATA_TOO_LONG, "\nI2C error: data too long for transmit buffer\n")                      \
+  X(LOG_I2C_NACK_ADDR, "\nI2C error: received NACK on address (disconnected?)\n")                   \
+  X(LOG_I2C_NACK_DATA, "\nI2C error: received NACK on data\n")                                      \
+  X(LOG_I2C_OTHER, "\nI2C error: other error\n")                                                    \
+  X(LOG_I2C_UNKNOWN, "\nI2C error: unknown error %u\n")                                             \
+  X(LOG_LIGHT_PASSED, "Lux Value: %.2f\nLight sensor setup passed.")                                \
+  X(LOG_LIGHT_FAILED, "Lux Value: %.2f\nLight sensor setup failed.")                                \
+  X(LOG_ENERGY_PASSED, "\n============ Energy Sensor =============\nState: %u\nEnergy (kWh): %f\n"  \
+                       "Voltage: %.2f\nCurrent: %.3f\nActive Power: %.2f\nApparent Power: %.2f\n"  \
+                       "Energy sensor setup passed.")                                                \
+  X(LOG_ENERGY_FAILED, "\n============ Energy Sensor =============\nState: %u\nEnergy (kWh): %f\n"  \
+                       "Voltage: %.2f\nCurrent: %.3f\nActive Power: %.2f\nApparent Power: %.2f\n"  \
+                       "Energy sensor setup failed.")                                                \
+  X(LOG_BOARD_IN, "\nBoard inserted, sequence ID %u")                                               \
+  X(LOG_BOARD_OUT, "Board removed, sequence ID %u")                                                 \
+  X(LOG_CYCLE_HEADER, "\n============ Cycle %u =============")                                     \
+  X(LOG_CHECK_TIME, "Check %u (ms): %u")                                                            \
+  X(LOG_CHECK_TIMEOUT, "Check %u (ms): %u TIMEOUT")                                                 \
+  X(LOG_CYCLE_TIME, "Cycle time (ms): %u\nSequential time (ms): %u")                                \
+  X(LOG_BOARDS_PER_HOUR, "Boards per hour: %.2f")                                                   \
+  X(LOG_LCD, "LCD pixels drawn/bytes pushed: %u/%u\nLCD update (us): %u")                           \
+  X(LOG_PROD_STATS, "Boards: %u First-pass yield (%%): %.2f Line boards per hour: %.2f")            \
+  X(LOG_DROPPED, "Dropped records: %u, log records dropped: %u, log bytes sent: %u")                \
+  X(LOG_FREE_HEAP, "Free heap: %u (%d)")                                                            \
+  X(LOG_PRODUCTION_ON, "Production mode ON")                                                        \
+  X(LOG_PRODUCTION_OFF, "Production mode OFF")                                                       \
+  X(LOG_RESTART, "\nRestart, button to screen (us): %u (worst %u), bounces ignored: %u, cycles cancelled: %u") \
+  X(LOG_ENERGY_CPU, "Energy sensor CPU per measurement (us): %u over %u")                            \
+  X(LOG_WAVE, "Voltage waveform crest factor: %.3f (peak %.0f, RMS %.0f, %.1f samples/s)")          \
+  X(LOG_CONVERSION_BENCH, "BL0940 V/I/P conversion (CPU cycles): float %u, fixed point %u")        \
+  X(LOG_CAL_START, "\n============ Calibration =============\nReference %.1f V, load %.1f W")       \
+  X(LOG_CAL_RESULT, "V gain %.5f offset %.3f\nI gain %.5f offset %.4f\nP gain %.5f offset %.3f")  \
+  X(LOG_CAL_SAVED, "Calibration saved to EEPROM at %u")                                           \
+  X(LOG_CAL_FAILED, "Calibration failed (%u of %u readings or gain out of range), using defaults") \
+  X(LOG_ENERGY_CHECKPOINT, "Energy checkpoint (Wh): %.3f, CF pin/register mismatches: %u")         \
+  X(LOG_ENERGY_BUS, "Energy sensor bus time per measurement (us): pipelined %u, one by one %u, "      \
+                    "saved %d, pipeline fallbacks %u")                                               \
+  X(LOG_PIPELINING_ON, "BL0940 pipelined reads ON")                                                 \
+  X(LOG_PIPELINING_OFF, "BL0940 pipelined reads OFF")                                               \
+  X(LOG_BAUD, "BL0940 UART baud rate: %u (0 = no answer)")                                         \
+  X(LOG_BAUD_BENCH, "BL0940 at %u baud: %.1f measurements/s, CRC errors %u, frame errors %u")       \
+  X(LOG_BAUD_NO_ANSWER, "BL0940 at %u baud: no answer")                                             \
+  X(LOG_ENERGY_STATS, "Energy quantity %u (V, A, W, PF): mean %.4f sd %.4f min %.4f max %.4f, outliers %u") \
+  X(LOG_ENERGY_SAMPLES, "Energy samples: %u, read errors: %u, decided after (ms): %u")          \
+  X(LOG_DECODE_BENCH, "BL0940 READALL check and decode (CPU cycles): descriptors %u, copy to holder %u, CRC ok %u") \
+  X(LOG_LIGHT_READY, "Light sensor data ready after (ms): %u, INT to read (us): %u, interrupts: %u") \
+  X(LOG_LIGHT_RANGE, "Light range: gain %uX, integration %u ms, counts %u, conversions %u, reading (ms): %u") \
+  X(LOG_LUX_BENCH, "LTR308 lux conversion (CPU cycles): double %u, table %u, template %u")       \
+  X(LOG_LIGHT_BUS, "Light sensor I2C per cycle: transactions %u, bytes %u, bus time (us) %u, writes skipped %u") \
+  X(LOG_RTC_NO_ANSWER, "RTC bench: no answer on I2C")                                                \
+  X(LOG_RTC_BENCH, "RTC getTime at %u Hz, I2C transactions/s: %.2f reading the chip, %.2f cached (%u chip reads, %u from millis), cached time off by %d s") \
+  X(LOG_WAVE_CHECK_ON, "Voltage waveform check ON")                                                 \
+  X(LOG_WAVE_CHECK_OFF, "Voltage waveform check OFF")
+
+#define JIG_LOG_ID(id, fmt) id,
+enum JigLogId : uint16_t
+{
+  JIG_LOG_FORMATS(JIG_LOG_ID)
+  LOG_FORMAT_COUNT
+};
+#undef JIG_LOG_ID
+
+#define JIG_LOG_FMT(id, fmt) fmt,
+static const char *const jigLogFormats[LOG_FORMAT_COUNT] = {JIG_LOG_FORMATS(JIG_LOG_FMT)};
+#undef JIG_LOG_FMT
+
+#define JIG_LOG_MAX_ARGS 6
+#define JIG_LOG_QUEUE 64
+
+// Binary frame, little endian:
+//  0xA5 0x5A, u16 format ID, u8 argument count, u32 millis, u32 arguments
+#define JIG_LOG_SYNC0 0xA5
+#define JIG_LOG_SYNC1 0x5A
+#define JIG_LOG_HEADER_LEN 9
+
+struct JigLogRecord
+{
+  uint32_t timeMs;
+  uint16_t id;
+  uint8_t argc;
+  uint8_t reserved;
+  uint32_t arg[JIG_LOG_MAX_ARGS];
+};
+
+class JigLog
+{
+public:
+  JigLog() : _sent(0)
+  {
+    portMUX_INITIALIZE(&_mux);
+  }
+
+  // Safe from any task on either core
+  template <typename... Args>
+  void write(uint16_t id, Args... args)
+  {
+    static_assert(sizeof...(Args) <= JIG_LOG_MAX_ARGS, "too many log arguments");
+    JigLogRecord rec;
+    rec.timeMs = millis();
+    rec.id = id;
+    rec.argc = sizeof...(Args);
+    rec.reserved = 0;
+    _pack(rec.arg, args...);
+    portENTER_CRITICAL(&_mux);
+    _queue.push(rec);
+    portEXIT_CRITICAL(&_mux);
+  }
+
+  // Log task only: print everything queued so far
+  void flush(Print &out)
+  {
+    JigLogRecord rec;
+    while (_queue.pop(rec))
+    {
+#ifdef BINARY_LOG
+      _sent += _writeBinary(out, rec);
+#else
+      _sent += _writeText(out, rec);
+#endif
+    }
+  }
+
+  uint32_t dropped() const { return _queue.dropped(); }
+  uint32_t bytesSent() const { return _sent; }
+
+private:
+  static uint32_t _word(float v)
+  {
+    uint32_t w;
+    memcpy(&w, &v, sizeof(w));
+    return w;
+  }
+  static uint32_t _word(double v) { return _word((float)v); }
+  template <typename T>
+  static uint32_t _word(T v) { return (uint32_t)v; }
+
+  static void _pack(uint32_t *) {}
+  template <typename T, typename... Rest>
+  static void _pack(uint32_t *w, T v, Rest... rest)
+  {
+    *w = _word(v);
+    _pack(w + 1, rest...);
+  }
+
+  static size_t _writeBinary(Print &out, const JigLogRecord &rec)
+  {
+    uint8_t frame[JIG_LOG_HEADER_LEN + JIG_LOG_MAX_ARGS * 4];
+    frame[0] = JIG_LOG_SYNC0;
+    frame[1] = JIG_LOG_SYNC1;
+    frame[2] = (uint8_t)rec.id;
+    frame[3] = (uint8_t)(rec.id >> 8);
+    frame[4] = rec.argc;
+    size_t len = 5;
+    len = _putU32(frame, len, rec.timeMs);
+    for (uint8_t i = 0; i < rec.argc; i++)
+      len = _putU32(frame, len, rec.arg[i]);
+    return out.write(frame, len);
+  }
+
+  static size_t _putU32(uint8_t *frame, size_t len, uint32_t v)
+  {
+    frame[len++] = (uint8_t)v;
+    frame[len++] = (uint8_t)(v >> 8);
+    frame[len++] = (uint8_t)(v >> 16);
+    frame[len++] = (uint8_t)(v >> 24);
+    return len;
+  }
+
+  // Same text the host decoder produces, formatted one conversion at a time
+  static size_t _writeText(Print &out, const JigLogRecord &rec)
+  {
+    if (rec.id >= LOG_FORMAT_COUNT)
+      return 0;
+    const char *fmt = jigLogFormats[rec.id];
+    size_t sent = 0;
+    uint8_t argi = 0;
+    while (*fmt)
+    {
+      const char *pct = strchr(fmt, '%');
+      if (pct == NULL)
+      {
+        sent += out.print(fmt);
+        break;
+      }
+      sent += out.write((const uint8_t *)fmt, pct - fmt);
+      if (pct[1] == '%')
+      {
+        sent += out.write('%');
+        fmt = pct + 2;
+        continue;
+      }
+      const char *conv = pct + 1;
+      while (*conv && strchr("dufxX", *conv) == NULL)
+        conv++;
+      if (*conv == '\0' || (size_t)(conv - pct) >= 8)
+        break;
+
+      char spec[8];
+      char buf[24];
+      memcpy(spec, pct, conv - pct + 1);
+      spec[conv - pct + 1] = '\0';
+      uint32_t w = argi < rec.argc ? rec.arg[argi] : 0;
+      argi++;
+      if (*conv == 'f')
+      {
+        float f;
+        memcpy(&f, &w, sizeof(f));
+        snprintf(buf, sizeof(buf), spec, (double)f);
+      }
+      else if (*conv == 'd')
+      {
+        snprintf(buf, sizeof(buf), spec, (int)(int32_t)w);
+      }
+      else
+      {
+        snprintf(buf, sizeof(buf), spec, (unsigned)w);
+      }
+      sent += out.print(buf);
+      fmt = conv + 1;
+    }
+    sent += out.println();
+    return sent;
+  }
+
+  JigQueue<JigLogRecord, JIG_LOG_QUEUE> _queue;
+  portMUX_TYPE _mux; // JigQueue is single producer, writers from both cores share the push
+  uint32_t _sent;
+};
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef JIGQUEUE_H
+#define JIGQUEUE_H
+#include <stdint.h>
+#include <atomic>
+#include "jigResults.h"
+
+/*---------------------------------------------
+//     Measurement -> UI result records
+---------------------------------------------*/
+
+// Everything the UI/logging core needs to know about a check result.
+// Fixed size, so it can be copied through the queue without touching the heap.
+// Check results use their CheckId, events follow after CHECK_COUNT.
+enum JigItem : uint8_t
+{
+  ITEM_DAC_READ = CHECK_DAC_READ,
+  ITEM_DAC_WRITE = CHECK_DAC_WRITE,
+  ITEM_LIGHT = CHECK_LIGHT,
+  ITEM_ENERGY = CHECK_ENERGY,
+  ITEM_TEMP = CHECK_TEMP,
+  ITEM_TIMING = CHECK_COUNT, // index = check slot, value[0] = duration ms, value[1] = timed out
+  ITEM_CYCLE,   // value[0] = cycle ms, value[1] = sequential ms
+  ITEM_RESTART, // restart button pressed
+  ITEM_BOARD_IN,  // production mode, board detected
+  ITEM_BOARD_OUT, // production mode, board removed
+  ITEM_WAVE,      // value[0] = crest factor, value[1] = samples/s, value[2] = peak, value[3] = RMS
+  ITEM_CYCLE_START, // a new cycle began, results of the last one are void
+  ITEM_ENERGY_CPU,  // value[0] = CPU us per measurement, value[1] = measurements
+  ITEM_ENERGY_BUS,  // value[0] = pipelined bus us, value[1] = one by one bus us, value[2] = pipeline fallbacks
+};
+
+struct JigRecord
+{
+  uint32_t cycle;
+  uint32_t board; // production sequence ID, 0 outside production mode
+  uint32_t timeMs;
+  uint8_t item;
+  uint8_t index;
+  uint8_t passed;
+  uint8_t error; // I2C or driver error code, 0 = none
+  float value[4];
+};
+
+/*
+ * Lock-free single-producer/single-consumer ring.
+ * push() must only be called from one task and pop() from one other task.
+ * N must be a power of two.
+ */
+template <typename T, uint32_t N>
+class JigQueue
+{
+  static_assert(N && !(N & (N - 1)), "JigQueue size must be a power of two");
+
+public:
+  JigQueue() : _head(0), _tail(0), _dropped(0) {}
+
+  bool push(const T &item)
+  {
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    if (head - _tail.load(std::memory_order_acquire) >= N)
+    {
+      _dropped++;
+      return false;
+    }
+    _buf[head & (N - 1)] = item;
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T &item)
+  {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail == _head.load(std::memory_order_acquire))
+      return false;
+    item = _buf[tail & (N - 1)];
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Records lost because the consumer fell behind
+  uint32_t dropped() const { return _dropped; }
+
+private:
+  T _buf[N];
+  std::atomic<uint32_t> _head;
+  std::atomic<uint32_t> _tail;
+  uint32_t _dropped;
+};
+
+#endif
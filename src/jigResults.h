@@ -0,0 +1,64 @@
+#ifndef JIGRESULTS_H
+#define JIGRESULTS_H
+#include <stdint.h>
+
+/*---------------------------------------------
+//          Typed jig result table
+---------------------------------------------*/
+
+// One slot per reported check, in the order shown on the status screen
+enum CheckId : uint8_t
+{
+  CHECK_DAC_READ,
+  CHECK_DAC_WRITE,
+  CHECK_LIGHT,
+  CHECK_ENERGY,
+  CHECK_TEMP,
+  CHECK_COUNT
+};
+
+enum CheckStatus : uint8_t
+{
+  STATUS_INITIATING,
+  STATUS_PASSED,
+  STATUS_NOT_PASSED
+};
+
+// Error code of a check that never reported within the cycle
+#define CHECK_ERR_TIMEOUT 0xFF
+
+struct CheckResult
+{
+  CheckStatus status;
+  uint8_t error;        // I2C or driver error code, 0 = none
+  float value;          // main measured value of the check
+  uint32_t timestampMs; // millis() when the result was measured
+};
+
+// Screen label and row of every check
+struct CheckInfo
+{
+  const char *label;
+  int16_t y;
+};
+
+static const CheckInfo checkInfo[CHECK_COUNT] = {
+    {"DAC READ:", 40},
+    {"DAC WRITE:", 55},
+    {"LIGHT SENSOR:", 70},
+    {"ENERGY SENSOR:", 85},
+    {"TEMP SENSOR:", 100},
+};
+
+static const char *const checkStatusText[] = {
+    "Initiating",
+    "PASSED",
+    "NOT PASSED",
+};
+
+inline const char *statusText(CheckStatus status)
+{
+  return checkStatusText[status];
+}
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef JIGSCHEDULER_H
+#define JIGSCHEDULER_H
+#include <stdint.h>
+
+/*---------------------------------------------
+//        Non-blocking self-test scheduler
+---------------------------------------------*/
+
+// Every jig check is a small state machine. Instead of calling delay() it
+// stores a wake-up deadline and returns, so the DHT warm-up, the LTR308
+// integration and the BL0940 RMS window all run at the same time. One jig
+// cycle then takes about as long as the slowest single check.
+
+#define JIG_MAX_CHECKS 8
+#define JIG_CHECK_TIMEOUT_MS 6000
+
+struct JigCheck;
+
+// Step function of a check. Called once its deadline is reached.
+// Return true when the check is finished, false to be polled again.
+typedef bool (*JigStepFn)(JigCheck &check, uint32_t now);
+
+struct JigCheck
+{
+  const char *name;
+  JigStepFn step;
+  uint8_t state;       // private state of the step function, 0 on start
+  bool done;
+  bool timedOut;
+  uint32_t startMs;
+  uint32_t deadlineMs; // do not poll before this time
+  uint32_t durationMs; // valid once done
+
+  // Sleep without blocking: next poll happens ms from now
+  void waitFor(uint32_t now, uint32_t ms)
+  {
+    deadlineMs = now + ms;
+  }
+};
+
+class JigScheduler
+{
+public:
+  JigScheduler() : _count(0), _running(false), _cycleStartMs(0), _cycleMs(0), _cycles(0), _cancelled(0) {}
+
+  bool add(const char *name, JigStepFn step)
+  {
+    if (_count >= JIG_MAX_CHECKS)
+      return false;
+    _checks[_count].name = name;
+    _checks[_count].step = step;
+    _checks[_count].done = true;
+    _count++;
+    return true;
+  }
+
+  // Start a new cycle, all checks become runnable immediately
+  void begin(uint32_t now)
+  {
+    for (uint8_t i = 0; i < _count; i++)
+    {
+      _checks[i].state = 0;
+      _checks[i].done = false;
+      _checks[i].timedOut = false;
+      _checks[i].startMs = now;
+      _checks[i].deadlineMs = now;
+      _checks[i].durationMs = 0;
+    }
+    _cycleStartMs = now;
+    _running = true;
+  }
+
+  // Poll every check whose deadline has passed.
+  // Returns true exactly once, when the last check of the cycle finished.
+  bool run(uint32_t now)
+  {
+    if (!_running)
+      return false;
+    bool allDone = true;
+    for (uint8_t i = 0; i < _count; i++)
+    {
+      JigCheck &check = _checks[i];
+      if (check.done)
+        continue;
+      if ((now - check.startMs) > JIG_CHECK_TIMEOUT_MS)
+      {
+        check.timedOut = true;
+        _finish(check, now);
+        continue;
+      }
+      if ((int32_t)(now - check.deadlineMs) >= 0 && check.step(check, now))
+      {
+        _finish(check, now);
+        continue;
+      }
+      allDone = false;
+    }
+    if (!allDone)
+      return false;
+    _running = false;
+    _cycleMs = now - _cycleStartMs;
+    _cycles++;
+    return true;
+  }
+
+  // Abort the running cycle, it is not counted and reports nothing
+  void cancel()
+  {
+    if (!_running)
+      return;
+    _running = false;
+    _cancelled++;
+  }
+
+  bool running() const { return _running; }
+  uint8_t count() const { return _count; }
+  const JigCheck &check(uint8_t i) const { return _checks[i]; }
+  uint32_t cycleMs() const { return _cycleMs; }
+  uint32_t cycles() const { return _cycles; }
+  uint32_t cancelled() const { return _cancelled; }
+
+  // Sum of all check durations, i.e. the cycle time if they ran back-to-back
+  uint32_t serialMs() const
+  {
+    uint32_t sum = 0;
+    for (uint8_t i = 0; i < _count; i++)
+      sum += _checks[i].durationMs;
+    return sum;
+  }
+
+private:
+  void _finish(JigCheck &check, uint32_t now)
+  {
+    check.done = true;
+    check.durationMs = now - check.startMs;
+  }
+
+  JigCheck _checks[JIG_MAX_CHECKS];
+  uint8_t _count;
+  bool _running;
+  uint32_t _cycleStartMs;
+  uint32_t _cycleMs;
+  uint32_t _cycles;
+  uint32_t _cancelled;
+};
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef LIGHTRANGE_H
+#define LIGHTRANGE_H
+#include <stdint.h>
+
+/*---------------------------------------------
+//          LTR308 auto-ranging
+---------------------------------------------*/
+
+// Settings are the LTR308 register codes: gain 0-4 (1X to 18X),
+// integration 0-4 (400 ms / 20 bit down to 25 ms / 16 bit)
+#define LIGHT_GAINS 5
+#define LIGHT_INTEGRATIONS 5
+#define LIGHT_SHORTEST_INTEGRATION 4
+
+static const uint8_t lightGainX[LIGHT_GAINS] = {1, 3, 6, 9, 18};
+static const uint16_t lightIntegrationMs[LIGHT_INTEGRATIONS] = {400, 200, 100, 50, 25};
+static const uint8_t lightResolutionBits[LIGHT_INTEGRATIONS] = {20, 19, 18, 17, 16};
+// Fastest measurementRate that is not shorter than the integration
+static const uint8_t lightMeasurementRate[LIGHT_INTEGRATIONS] = {3, 3, 2, 1, 0};
+// Data register update period per measurementRate setting (4 is taken as 0)
+static const uint16_t lightPeriodMs[8] = {25, 50, 100, 500, 25, 1000, 2000, 2000};
+
+// A reading is kept when it has at least LIGHT_RANGE_MIN_COUNTS, enough
+// resolution, and stays under LIGHT_RANGE_HIGH_PERCENT of full scale.
+// Past LIGHT_RANGE_MAX_CONVERSIONS the last unsaturated reading is kept.
+#define LIGHT_RANGE_MIN_COUNTS 1000
+#define LIGHT_RANGE_HIGH_PERCENT 80
+#define LIGHT_RANGE_MAX_CONVERSIONS 2
+
+struct LightRange
+{
+  uint8_t gain;
+  uint8_t integration;
+};
+
+enum LightRangeStep : uint8_t
+{
+  RANGE_DONE,  // reading kept
+  RANGE_RETRY, // convert again with range()
+  RANGE_FAIL   // saturated at the least sensitive range
+};
+
+class LightAutoRange
+{
+public:
+  static uint32_t fullScale(uint8_t integration) { return (1UL << lightResolutionBits[integration]) - 1; }
+
+  // Same scale as LTR308::getLux(): 0.6 lux per count at 1X and 100 ms
+  static float lux(uint32_t counts, const LightRange &r)
+  {
+    return counts * 60.0f / (lightGainX[r.gain] * (float)lightIntegrationMs[r.integration]);
+  }
+
+  static uint32_t expectedCounts(float lux, const LightRange &r)
+  {
+    float counts = lux * lightGainX[r.gain] * lightIntegrationMs[r.integration] / 60.0f;
+    return counts < 0x7FFFFFFF ? (uint32_t)counts : 0x7FFFFFFF;
+  }
+
+  // Shortest integration that reaches LIGHT_RANGE_MIN_COUNTS without
+  // going over the high mark, at the highest gain that allows it
+  static LightRange choose(float lux)
+  {
+    for (int8_t i = LIGHT_SHORTEST_INTEGRATION; i >= 0; i--)
+    {
+      uint32_t high = fullScale(i) / 100 * LIGHT_RANGE_HIGH_PERCENT;
+      for (int8_t g = LIGHT_GAINS - 1; g >= 0; g--)
+      {
+        LightRange r = {(uint8_t)g, (uint8_t)i};
+        uint32_t counts = expectedCounts(lux, r);
+        if (counts > high)
+          continue;
+        if (counts >= LIGHT_RANGE_MIN_COUNTS)
+          return r;
+        break; // lower gains give even fewer counts, try a longer integration
+      }
+    }
+    // Too dark for any range or too bright for all: the nearest end
+    LightRange darkest = {LIGHT_GAINS - 1, 0};
+    LightRange brightest = {0, LIGHT_SHORTEST_INTEGRATION};
+    return expectedCounts(lux, brightest) > LIGHT_RANGE_MIN_COUNTS ? brightest : darkest;
+  }
+
+  void begin(const LightRange &start)
+  {
+    _range = start;
+    _conversions = 0;
+    _lastCounts = 0;
+  }
+
+  const LightRange &range() const { return _range; }
+  uint8_t conversions() const { return _conversions; }
+
+  // Range to start the next reading with: a reading kept at a slower range
+  // than needed still moves the next one to the faster range
+  LightRange suggested() const
+  {
+    if (_lastCounts >= fullScale(_range.integration))
+    {
+      LightRange brightest = {0, LIGHT_SHORTEST_INTEGRATION};
+      return brightest;
+    }
+    return choose(lux(_lastCounts, _range));
+  }
+
+  // Judge a conversion taken at range()
+  LightRangeStep update(uint32_t counts)
+  {
+    _conversions++;
+    _lastCounts = counts;
+    uint32_t fs = fullScale(_range.integration);
+    bool saturated = counts >= fs;
+    if (!saturated && counts >= LIGHT_RANGE_MIN_COUNTS && counts <= fs / 100 * LIGHT_RANGE_HIGH_PERCENT)
+      return RANGE_DONE;
+    if (_conversions >= LIGHT_RANGE_MAX_CONVERSIONS)
+      return saturated ? RANGE_FAIL : RANGE_DONE;
+
+    // Saturated says nothing about the level, go to the least sensitive range
+    LightRange next = {0, LIGHT_SHORTEST_INTEGRATION};
+    if (!saturated)
+      next = choose(lux(counts, _range));
+    if (next.gain == _range.gain && next.integration == _range.integration)
+      return saturated ? RANGE_FAIL : RANGE_DONE;
+    _range = next;
+    return RANGE_RETRY;
+  }
+
+private:
+  LightRange _range;
+  uint8_t _conversions;
+  uint32_t _lastCounts; // last conversion, taken at _range
+};
+
+#endif
@@ -3,6 +3,16 @@
 #include <defVar.h>
 #include <Arduino.h>
 #include <Wire.h>
+#include "jigScheduler.h"
+#include "jigQueue.h"
+#include "jigResults.h"
+#include "statusView.h"
+#include "productionStats.h"
+#include "jigLog.h"
+#include "jigButton.h"
+#include "energyCalibration.h"
+#include "jigChecks.h"
+#include <jigtrace.h>
 
 #define SHARP_SCK 13  // Define the clock pin
 #define SHARP_MOSI 14 // Define the data pin
@@ -19,21 +29,106 @@ int x2 = 240;
 int margin_y = 20;
 int delaymb = 500;
 
-void setupDAC();
-void setupTempSensor();
-void setupLightSensor();
-void setupEnergySensor();
 void printError(byte error);
-void frameDisplay(String sensorName, int x);
 void writeLCD();
 void initSensors();
+void serviceSensors();
+void reportCycleTime();
 void initWire();
-
-String dacReadPassed = "Initiating";
-String dacWritePassed = "Initiating";
-String tempPassed = "Initiating";
-String energyPassed = "Initiating";
-String lightPassed = "Initiating";
+void postRecord(JigRecord &rec);
+void uiTask(void *param);
+void logTask(void *param);
+void handleRecord(const JigRecord &rec);
+void logRecord(const JigRecord &rec);
+void resetResults();
+void serviceProduction();
+bool boardPresent();
+void handleSerialCommand();
+void updateStatsFooter();
+void exportStatsCsv();
+void exportStatsBinary();
+void benchConversions();
+void benchFrameDecode();
+void benchLux();
+void startCalibration();
+void serviceCalibration(uint32_t now);
+void finishCalibration();
+void benchBaudRates();
+void benchRtc();
+
+JigScheduler jig;
+
+// Measurement (loop(), core 1) -> display/serial logging (uiTask, core 0)
+#define UI_TASK_CORE 0
+#define UI_TASK_STACK 4096
+#define UI_TASK_PRIORITY 1
+JigQueue<JigRecord, 32> resultQueue;
+TaskHandle_t uiTaskHandle = NULL;
+
+// Log records are formatted and sent by logTask, below uiTask
+#define LOG_TASK_STACK 3072
+#define LOG_TASK_PRIORITY 0
+#define LOG_FLUSH_MS 10
+JigLog jigLog;
+
+// Restart button, pressUs is written by loop() before ITEM_RESTART is posted
+JigButton restartButton;
+volatile uint32_t restartPressUs = 0;
+uint32_t restartLatencyUs = 0; // owned by uiTask
+uint32_t restartWorstUs = 0;
+
+// Throughput, owned by uiTask
+uint32_t firstCycleMs = 0;
+uint32_t cyclesDone = 0;
+uint32_t lastFreeHeap = 0;
+
+// Cost of the last writeLCD(), for comparing LCD_FRAMEBUFFER against immediate mode
+uint32_t lcdUpdateUs = 0;
+uint32_t lcdBytes = 0;
+
+// Production line mode: one test cycle per inserted board
+#define BOARD_PROBE_MS 100
+#define BOARD_DEBOUNCE_PROBES 3
+#define DAC_I2C_ADDR 0x58
+enum BoardState : uint8_t
+{
+  BOARD_WAIT,    // fixture empty
+  BOARD_TESTING, // test cycle running
+  BOARD_DONE     // result shown, waiting for removal
+};
+#ifdef PRODUCTION_MODE
+volatile bool productionMode = true;
+#else
+volatile bool productionMode = false;
+#endif
+BoardState boardState = BOARD_WAIT;
+uint32_t lastProbeMs = 0;
+uint8_t probeCount = 0; // consecutive probes that disagree with boardState
+
+// Owned by uiTask
+ProductionStats prodStats;
+uint32_t boardStartMs = 0;
+
+// BL0940 calibration, requested by uiTask and run by loop() instead of the checks
+enum CalState : uint8_t
+{
+  CAL_IDLE,
+  CAL_SETTLE,  // waiting for the RMS registers after a relay change
+  CAL_MEASURE, // READALL in flight
+};
+volatile bool calibrationRequested = false;
+volatile bool baudBenchRequested = false;
+volatile bool rtcBenchRequested = false;
+volatile bool conversionBenchRequested = false; // the benches read em_bl0940 and light, owned by loop()
+CalState calState = CAL_IDLE;
+bool calLoadOn = false;
+uint8_t calSamples = 0;
+uint32_t calWakeMs = 0;
+LinearFit calFitV, calFitI, calFitP;
+
+// Written by uiTask only, read by writeLCD() and the logger
+CheckResult checkResults[CHECK_COUNT];
+StatusView statusView(gfx, TEXT_COLOR, HIGHLIGHT_COLOR, RED, HEADER_COLOR, BACKGROUND_COLOR);
 
 void setup()
 {
@@ -47,11 +142,12 @@ void setup()
   DEBUGPRINTLN("");
   DEBUGPRINTLN("");
   pinMode(EM_LED_PIN, INPUT);
-  pinMode(EM_CF_PIN, INPUT_PULLDOWN);
+  em_bl0940.beginPulseCounter(EM_CF_PIN); // CF input with pull-down
   pinMode(RELAY_PIN, OUTPUT);
   pinMode(PWRKEY_PIN, OUTPUT);
   pinMode(RESET_PIN, OUTPUT);
   pinMode(BUTTON_PIN, INPUT);
+  restartButton.begin(BUTTON_PIN);
   digitalWrite(RELAY_PIN, LOW);
   digitalWrite(PWRKEY_PIN, LOW);
   digitalWrite(RESET_PIN, LOW);
@@ -60,41 +156,45 @@ void setup()
   pinMode(10, INPUT_PULLUP);
   delay(2000);
 
-  display.begin();
+  gfx->begin(); // with LCD_FRAMEBUFFER this also starts the panel
   display.setRotation(1);
-  display.fillScreen(BACKGROUND_COLOR);
-  display.setCursor(40, 50);
+  gfx->fillScreen(BACKGROUND_COLOR);
+  gfx->setCursor(40, 50);
+  gfx->flush();
   delay(2000);
 
   initWire();
+
+  // From here on only uiTask touches the display and the debug console
+  resetResults();
+  xTaskCreatePinnedToCore(uiTask, "ui", UI_TASK_STACK, NULL, UI_TASK_PRIORITY, &uiTaskHandle, UI_TASK_CORE);
+  xTaskCreatePinnedToCore(logTask, "log", LOG_TASK_STACK, NULL, LOG_TASK_PRIORITY, NULL, UI_TASK_CORE);
+
+  em_bl0940.setNotifyTask(xTaskGetCurrentTaskHandle());
+  light.setNotifyTask(xTaskGetCurrentTaskHandle());
+  uint32_t baud = em_bl0940.negotiateBaudRate(bl0940BaudRates, sizeof(bl0940BaudRates) / sizeof(bl0940BaudRates[0]));
+  JIG_LOG(LOG_BAUD, baud);
+  addJigChecks(jig);
+  initSensors();
 }
 
 void loop()
 {
-  int buttonState = digitalRead(33);
-  if (buttonState == 1)
+  uint32_t pressUs;
+  if (restartButton.takePress(pressUs))
   {
-    // Display "restarting" message
-    display.fillScreen(BLACK);
-    display.setCursor(20, 50);
-    display.setTextColor(WHITE, BLACK); // Assuming WHITE is defined for text color
-    display.setTextSize(2);
-    display.println("Restarting");
-
-    delay(200); // Optional delay to allow the message to be visible
-
-    // Reset status messages
-    dacReadPassed = "Initiating";
-    dacWritePassed = "Initiating";
-    tempPassed = "Initiating";
-    energyPassed = "Initiating";
-    lightPassed = "Initiating";
-    delay(200);
-
-    // Reinitialize sensors and update display
+    // Drop the cycle in flight and start over, "Restarting" stays on
+    // screen until the new cycle reports
+    jig.cancel();
+    restartPressUs = pressUs;
+    postRecord(ITEM_RESTART, false);
     initSensors();
+    if (boardState == BOARD_DONE)
+      boardState = BOARD_TESTING; // retest of the same board
   }
-  initSensors();
+  serviceSensors();
+  // Woken early when the BL0940 UART received a frame
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1));
 }
 
 void initWire()
@@ -103,280 +203,805 @@ void initWire()
   Wire.setPins(13, 14);
   // Set Light Sensor Pins
   Wire1.setPins(21, 22);
+  // Both buses are probed for board presence before any sensor begin()
+  Wire.begin();
+  Wire1.begin();
 }
 
+/*
+ * Start a new self-test cycle. The checks themselves are advanced
+ * from serviceSensors() without blocking loop().
+ */
 void initSensors()
 {
-  setupDAC();
-  setupTempSensor();
-  setupLightSensor();
-  setupEnergySensor();
-  writeLCD();
+  jig.begin(millis());
+  postRecord(ITEM_CYCLE_START, true);
 }
 
-void setupDAC()
+void serviceSensors()
 {
-  DEBUGPRINTLN("");
-  DEBUGPRINTLN("============ DAC READ =============");
-  bool setupPassed = true;
-  bool dacWrite = false;
-
-  if (dacZeroTen.begin() != 0)
+  if (calibrationRequested && calState == CAL_IDLE)
+    startCalibration();
+  if (calState != CAL_IDLE)
   {
-    DEBUGPRINTLN("DAC setup failed.");
-    setupPassed = false;
-    dacReadPassed = "NOT PASSED";
-    dacWritePassed = "NOT PASSED";
-    delay(1000);
+    serviceCalibration(millis());
+    return;
   }
-  else
+  if (baudBenchRequested)
   {
-    DEBUGPRINTLN("DAC setup passed.");
-    dacReadPassed = "PASSED";
+    baudBenchRequested = false;
+    jig.cancel();
+    benchBaudRates();
+    initSensors();
   }
-  if (setupPassed)
+  if (rtcBenchRequested)
   {
-    DEBUGPRINTLN("");
-    DEBUGPRINTLN("============ DAC WRITE =============");
-    qc_dimming = 1;
-    dacZeroTen.setDACOutRange(dacZeroTen.eOutputRange10V);
-    digitalWrite(RELAY_PIN, HIGH);
-    dacZeroTen.setDACOutVoltage(5000, 1);
-    dacWritePassed = "PASSED";
-    DEBUGPRINTLN("DAC write passed.");
-    dacWrite = true;
+    rtcBenchRequested = false;
+    jig.cancel();
+    benchRtc();
+    initSensors();
+  }
+  if (conversionBenchRequested)
+  {
+    // No bus traffic, the cycle in flight carries on
+    conversionBenchRequested = false;
+    benchConversions();
+    benchFrameDecode();
+    benchLux();
+  }
+  if (productionMode)
+  {
+    serviceProduction();
+    return;
+  }
+  boardState = BOARD_WAIT;
+  if (jig.run(millis()))
+  {
+    reportCycleTime();
+    initSensors();
   }
 }
 
-void setupTempSensor()
+/*
+ * Production line: wait for a board, run one cycle on it and wait
+ * until it is pulled out again before accepting the next one.
+ */
+void serviceProduction()
 {
-  DEBUGPRINTLN("");
-  DEBUGPRINTLN("============ Temperature Sensor =============");
-  dht.begin();
+  uint32_t now = millis();
+  if (boardState == BOARD_TESTING)
+  {
+    if (jig.run(now))
+    {
+      reportCycleTime();
+      boardState = BOARD_DONE;
+    }
+    return;
+  }
 
-  delay(3000);
-  temp = dht.readTemperature();
+  if ((now - lastProbeMs) < BOARD_PROBE_MS)
+    return;
+  lastProbeMs = now;
+  bool present = boardPresent();
+  if (present != (boardState == BOARD_WAIT))
+  {
+    probeCount = 0;
+    return;
+  }
+  if (++probeCount < BOARD_DEBOUNCE_PROBES)
+    return;
+  probeCount = 0;
 
-  bool tempPassed = !isnan(temp);
-  if (tempPassed)
+  if (boardState == BOARD_WAIT)
   {
-    DEBUGPRINTLN("Temperature sensor setup passed.");
-    tempPassed = "PASSED";
+    boardSeq++;
+    postRecord(ITEM_BOARD_IN, true);
+    initSensors();
+    boardState = BOARD_TESTING;
   }
   else
   {
-    DEBUGPRINTLN("Temperature sensor setup failed.");
-    tempPassed = "NOT PASSED";
+    postRecord(ITEM_BOARD_OUT, true);
+    digitalWrite(RELAY_PIN, LOW);
+    boardState = BOARD_WAIT;
   }
 }
 
-void setupEnergySensor()
+// A board is in the fixture when its DAC or its light sensor answers
+bool boardPresent()
 {
-  DEBUGPRINTLN("");
-  DEBUGPRINTLN("============ Energy Sensor =============");
-  DEBUGPRINTLN(em_bl0940.getState());
-  delay(1000);
+  JIG_TRACE_SCOPE("boardPresent");
+  Wire.beginTransmission(DAC_I2C_ADDR);
+  if (Wire.endTransmission() == 0)
+    return true;
+  Wire1.beginTransmission(LTR308_ADDR);
+  return (Wire1.endTransmission() == 0);
+}
+
+void reportCycleTime()
+{
+  for (uint8_t i = 0; i < jig.count(); i++)
+  {
+    const JigCheck &check = jig.check(i);
+    JigRecord rec = {};
+    rec.item = ITEM_TIMING;
+    rec.index = i;
+    rec.value[0] = check.durationMs;
+    rec.value[1] = check.timedOut;
+    postRecord(rec);
+  }
+  // The driver's counters go to the log core by value
+  uint32_t measurements = em_bl0940.getMeasurements();
+  if (measurements > 0)
+    postRecord(ITEM_ENERGY_CPU, true, 0, em_bl0940.getCpuUs() / measurements, measurements);
+  uint32_t pipelinedUs = em_bl0940.getBusUs(true);
+  uint32_t sequentialUs = em_bl0940.getBusUs(false);
+  if (pipelinedUs > 0 || sequentialUs > 0)
+    postRecord(ITEM_ENERGY_BUS, true, 0, pipelinedUs, sequentialUs, em_bl0940.getPipelineFallbacks());
+  postRecord(ITEM_CYCLE, true, 0, jig.cycleMs(), jig.serialMs());
+}
 
-  // Uncomment the following lines to read and print energy values
-  em_bl0940.readValues();
-  voltage = em_bl0940.getVoltage();
-  current = em_bl0940.getCurrent();
-  activePower = em_bl0940.getActivePower();
-  em_bl0940.readValuesPhAngle();
-  apparentPower = voltage * current;
-  PowerFactor = activePower / apparentPower;
+/*
+ * Hand a result over to uiTask. Never blocks: if the UI core falls
+ * behind, the record is dropped and counted by the queue.
+ */
+void postRecord(JigRecord &rec)
+{
+  rec.cycle = jig.cycles();
+  rec.board = productionMode ? boardSeq : 0;
+  rec.timeMs = millis();
+  resultQueue.push(rec);
+  if (uiTaskHandle != NULL)
+    xTaskNotifyGive(uiTaskHandle);
+}
 
-  // Print the energy value
-  float energy = em_bl0940.getEnergy(em_bl0940.getCF_CNT(), calibrated_blink_second);
-  DEBUGPRINTLN("Energy (kWh):");
-  DEBUGPRINTLN(energy);
+void postRecord(uint8_t item, bool passed, uint8_t error, float v0, float v1, float v2, float v3)
+{
+  JigRecord rec = {};
+  rec.item = item;
+  rec.passed = passed;
+  rec.error = error;
+  rec.value[0] = v0;
+  rec.value[1] = v1;
+  rec.value[2] = v2;
+  rec.value[3] = v3;
+  postRecord(rec);
+}
 
-  DEBUGPRINTLN("Voltage :");
-  DEBUGPRINTLN(voltage);
-  DEBUGPRINTLN("Current :");
-  DEBUGPRINTLN(current);
-  DEBUGPRINTLN("Active Power :");
-  DEBUGPRINTLN(activePower);
-  DEBUGPRINTLN("Apparent Power :");
-  DEBUGPRINTLN(apparentPower);
+/*---------------------------------------------
+//        Display and logging (core 0)
+---------------------------------------------*/
 
-  if (PowerFactor > 1)
+void uiTask(void *param)
+{
+  JigRecord rec;
+  for (;;)
   {
-    PowerFactor = 1;
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(50));
+    while (resultQueue.pop(rec))
+    {
+      handleRecord(rec);
+      logRecord(rec);
+    }
+    handleSerialCommand();
   }
-  if (activePower == 0 || apparentPower == 0)
+}
+
+/*
+ * Serial output of the deferred log. Runs only when uiTask is idle, so
+ * slow console output never holds up the display.
+ */
+void logTask(void *param)
+{
+  for (;;)
   {
-    PowerFactor = 0.01;
+    vTaskDelay(pdMS_TO_TICKS(LOG_FLUSH_MS));
+    jigLog.flush(Serial);
   }
-  if (PowerFactor < 0.01)
+}
+
+void handleRecord(const JigRecord &rec)
+{
+  if (rec.item < CHECK_COUNT)
   {
-    PowerFactor = 0.01;
+    CheckResult &result = checkResults[rec.item];
+    result.status = rec.passed ? STATUS_PASSED : STATUS_NOT_PASSED;
+    result.error = rec.error;
+    // Energy reports V, I, P, kWh; keep the active power
+    result.value = rec.value[rec.item == CHECK_ENERGY ? 2 : 0];
+    result.timestampMs = rec.timeMs;
+    return;
   }
 
-  if (em_bl0940.getState() == 0)
+  switch (rec.item)
   {
-    DEBUGPRINTLN("Energy sensor setup passed.");
-    energyPassed = "PASSED";
+  case ITEM_BOARD_IN:
+    boardStartMs = rec.timeMs;
+    resetResults();
+    break;
+  case ITEM_CYCLE_START:
+    // A check that passed last cycle and does not report in this one must
+    // not keep showing PASSED; the screen is redrawn at the cycle end
+    resetResults();
+    break;
+  case ITEM_TIMING:
+    if (rec.board != 0)
+      prodStats.addStage(rec.index, (uint32_t)rec.value[0]);
+    break;
+  case ITEM_CYCLE:
+    // Checks that never reported within the cycle did not pass
+    for (uint8_t i = 0; i < CHECK_COUNT; i++)
+    {
+      if (checkResults[i].status == STATUS_INITIATING)
+      {
+        checkResults[i].status = STATUS_NOT_PASSED;
+        checkResults[i].error = CHECK_ERR_TIMEOUT;
+        checkResults[i].timestampMs = rec.timeMs;
+      }
+    }
+    if (cyclesDone++ == 0)
+      firstCycleMs = rec.timeMs - (uint32_t)rec.value[0];
+    if (rec.board != 0)
+    {
+      bool passed = true;
+      for (uint8_t i = 0; i < CHECK_COUNT; i++)
+        passed = passed && (checkResults[i].status == STATUS_PASSED);
+      prodStats.addStage(PROD_STAGE_CYCLE, (uint32_t)rec.value[0]);
+      prodStats.boardFinished(rec.board, passed, boardStartMs, rec.timeMs);
+      updateStatsFooter();
+    }
+    writeLCD();
+    break;
+  case ITEM_RESTART:
+    gfx->fillScreen(BLACK);
+    gfx->setCursor(20, 50);
+    gfx->setTextColor(WHITE, BLACK); // Assuming WHITE is defined for text color
+    gfx->setTextSize(2);
+    gfx->println("Restarting");
+    gfx->flush();
+    statusView.invalidate();
+    restartLatencyUs = micros() - restartPressUs;
+    if (restartLatencyUs > restartWorstUs)
+      restartWorstUs = restartLatencyUs;
+
+    resetResults();
+    break;
   }
-  else
+}
+
+void resetResults()
+{
+  for (uint8_t i = 0; i < CHECK_COUNT; i++)
   {
-    DEBUGPRINTLN("Energy sensor setup failed.");
-    energyPassed = "NOT PASSED";
+    checkResults[i].status = STATUS_INITIATING;
+    checkResults[i].error = 0;
+    checkResults[i].value = 0;
+    checkResults[i].timestampMs = 0;
   }
 }
 
-void setupLightSensor()
+void logRecord(const JigRecord &rec)
 {
-  DEBUGPRINTLN("");
-  DEBUGPRINTLN("============ Light Sensor =============");
-  light.begin();
-  bool lightPass = true; // Assume success initially
+  switch (rec.item)
+  {
+  case ITEM_DAC_READ:
+    JIG_LOG(rec.passed ? LOG_DAC_READ_PASSED : LOG_DAC_READ_FAILED);
+    break;
+  case ITEM_DAC_WRITE:
+    if (rec.passed)
+      JIG_LOG(LOG_DAC_WRITE_PASSED);
+    break;
+  case ITEM_TEMP:
+    JIG_LOG(rec.passed ? LOG_TEMP_PASSED : LOG_TEMP_FAILED, rec.value[0]);
+    break;
+  case ITEM_LIGHT:
+    JIG_LOG(LOG_LIGHT_PART_ID, (uint8_t)rec.value[2]);
+    if (rec.error != 0)
+      printError(rec.error);
+    JIG_LOG(rec.passed ? LOG_LIGHT_PASSED : LOG_LIGHT_FAILED, rec.value[0]);
+    break;
+  case ITEM_ENERGY:
+    JIG_LOG(rec.passed ? LOG_ENERGY_PASSED : LOG_ENERGY_FAILED, rec.error, rec.value[3],
+            rec.value[0], rec.value[1], rec.value[2], rec.value[0] * rec.value[1]);
+    break;
+  case ITEM_RESTART:
+    JIG_LOG(LOG_RESTART, restartLatencyUs, restartWorstUs, restartButton.bounces(), jig.cancelled());
+    break;
+  case ITEM_WAVE:
+    JIG_LOG(LOG_WAVE, rec.value[0], rec.value[2], rec.value[3], rec.value[1]);
+    break;
+  case ITEM_BOARD_IN:
+    JIG_LOG(LOG_BOARD_IN, rec.board);
+    break;
+  case ITEM_BOARD_OUT:
+    JIG_LOG(LOG_BOARD_OUT, rec.board);
+    break;
+  case ITEM_ENERGY_CPU:
+    JIG_LOG(LOG_ENERGY_CPU, (uint32_t)rec.value[0], (uint32_t)rec.value[1]);
+    break;
+  case ITEM_ENERGY_BUS:
+    JIG_LOG(LOG_ENERGY_BUS, (uint32_t)rec.value[0], (uint32_t)rec.value[1],
+            (rec.value[0] > 0 && rec.value[1] > 0) ? (int32_t)(rec.value[1] - rec.value[0]) : 0,
+            (uint32_t)rec.value[2]);
+    break;
+  case ITEM_TIMING:
+    if (rec.index == 0)
+      JIG_LOG(LOG_CYCLE_HEADER, rec.cycle);
+    JIG_LOG(rec.value[1] != 0 ? LOG_CHECK_TIMEOUT : LOG_CHECK_TIME, rec.index, (uint32_t)rec.value[0]);
+    break;
+  case ITEM_CYCLE:
+    JIG_LOG(LOG_CYCLE_TIME, (uint32_t)rec.value[0], (uint32_t)rec.value[1]);
+    if (cyclesDone > 0 && rec.timeMs != firstCycleMs)
+      JIG_LOG(LOG_BOARDS_PER_HOUR, 3600000.0 * cyclesDone / (rec.timeMs - firstCycleMs));
+    JIG_LOG(LOG_LCD, statusView.pixels(), lcdBytes, lcdUpdateUs);
+    if (rec.board != 0)
+      JIG_LOG(LOG_PROD_STATS, prodStats.boards(), prodStats.yield(), prodStats.boardsPerHour());
+    JIG_LOG(LOG_DROPPED, resultQueue.dropped(), jigLog.dropped(), jigLog.bytesSent());
+    // Must stay constant from the second cycle on
+    JIG_LOG(LOG_FREE_HEAP, ESP.getFreeHeap(), (int32_t)(ESP.getFreeHeap() - lastFreeHeap));
+    lastFreeHeap = ESP.getFreeHeap();
+    break;
+  }
+}
 
-  if (light.getPartID(ID))
+/*
+ * Console commands:
+ *  p  toggle production line mode
+ *  c  export production statistics as CSV
+ *  b  export production statistics as binary
+ *  r  reset production statistics
+ *  t  dump the timing trace as Chrome trace JSON (JIG_TRACE builds)
+ *  m  benchmark the BL0940 float and fixed-point conversions and the frame decode,
+ *     and the LTR308 lux conversion
+ *  k  calibrate the BL0940 against the reference load (CAL_REF_* in defVar.h)
+ *  e  toggle pipelined BL0940 reads, to compare the bus time of both
+ *  u  benchmark BL0940 measurements per second at each UART rate
+ *  i  benchmark RTC getTime() I2C transactions/s with and without the time cache (blocks ~60 s)
+ *  w  toggle the voltage waveform check after the energy check (~0.8 s per cycle)
+ */
+void handleSerialCommand()
+{
+  while (Serial.available() > 0)
   {
-    DEBUGPRINT("Got Sensor Part ID: 0X");
-    DEBUGPRINT(ID);
-    DEBUGPRINTLN();
+    switch (Serial.read())
+    {
+    case 'p':
+      productionMode = !productionMode;
+      JIG_LOG(productionMode ? LOG_PRODUCTION_ON : LOG_PRODUCTION_OFF);
+      break;
+    case 'c':
+      exportStatsCsv();
+      break;
+    case 'b':
+      exportStatsBinary();
+      break;
+    case 'm':
+      conversionBenchRequested = true;
+      break;
+    case 'k':
+      calibrationRequested = true;
+      break;
+    case 'e':
+      pipelineToggleRequested = true;
+      break;
+    case 'u':
+      baudBenchRequested = true;
+      break;
+    case 'i':
+      rtcBenchRequested = true;
+      break;
+    case 'w':
+      waveCheckEnabled = !waveCheckEnabled;
+      JIG_LOG(waveCheckEnabled ? LOG_WAVE_CHECK_ON : LOG_WAVE_CHECK_OFF);
+      break;
+    case 'r':
+      prodStats.reset();
+      updateStatsFooter();
+      writeLCD();
+      break;
+#ifdef JIG_TRACE
+    case 't':
+      JIG_TRACE_DUMP(Serial);
+      break;
+#endif
+    }
   }
-  else
+}
+
+void updateStatsFooter()
+{
+  char footer[STATUS_VIEW_FOOTER_LEN + 1];
+  snprintf(footer, sizeof(footer), "BPH %u FPY %u%% P95 %ums",
+           (unsigned)prodStats.boardsPerHour(), (unsigned)prodStats.yield(),
+           (unsigned)prodStats.percentile(PROD_STAGE_CYCLE, 95));
+  statusView.setFooter(footer);
+}
+
+void exportStatsCsv()
+{
+  Serial.println("stage,samples,p50_ms,p95_ms,p99_ms");
+  for (uint8_t i = 0; i <= jig.count(); i++)
   {
-    byte error = light.getError();
-    printError(error);
-    lightPass = false; // Mark as failed if this step fails
+    uint8_t stage = (i < jig.count()) ? i : PROD_STAGE_CYCLE;
+    Serial.printf("%s,%u,%u,%u,%u\n", (i < jig.count()) ? jig.check(i).name : "CYCLE",
+                  (unsigned)prodStats.samples(stage), (unsigned)prodStats.percentile(stage, 50),
+                  (unsigned)prodStats.percentile(stage, 95), (unsigned)prodStats.percentile(stage, 99));
   }
+  Serial.println("boards,first_pass,yield_pct,boards_per_hour");
+  Serial.printf("%u,%u,%.1f,%.1f\n", (unsigned)prodStats.boards(), (unsigned)prodStats.firstPass(),
+                prodStats.yield(), prodStats.boardsPerHour());
+}
+
+static void writeU16(uint16_t v)
+{
+  Serial.write((uint8_t)v);
+  Serial.write((uint8_t)(v >> 8));
+}
+
+static void writeU32(uint32_t v)
+{
+  writeU16((uint16_t)v);
+  writeU16((uint16_t)(v >> 16));
+}
 
-  // Power up the sensor
-  if (light.setPowerUp())
+/*
+ * Little-endian frame:
+ *  'J' 'S' version stages
+ *  u32 boards, u32 first pass, u32 boards/hour * 100
+ *  per stage: u16 samples, u32 p50 ms, u32 p95 ms, u32 p99 ms
+ */
+void exportStatsBinary()
+{
+  Serial.write('J');
+  Serial.write('S');
+  Serial.write((uint8_t)1);
+  Serial.write((uint8_t)(jig.count() + 1));
+  writeU32(prodStats.boards());
+  writeU32(prodStats.firstPass());
+  writeU32((uint32_t)(prodStats.boardsPerHour() * 100));
+  for (uint8_t i = 0; i <= jig.count(); i++)
   {
-    DEBUGPRINT("Powering up...");
-    DEBUGPRINTLN();
+    uint8_t stage = (i < jig.count()) ? i : PROD_STAGE_CYCLE;
+    writeU16(prodStats.samples(stage));
+    writeU32(prodStats.percentile(stage, 50));
+    writeU32(prodStats.percentile(stage, 95));
+    writeU32(prodStats.percentile(stage, 99));
   }
-  else
+}
+
+// CPU cycles for one voltage, current and power conversion from the last reading
+void benchConversions()
+{
+  const uint16_t rounds = 1000;
+  volatile float f;
+  volatile int32_t fixed;
+
+  uint32_t start = ESP.getCycleCount();
+  for (uint16_t i = 0; i < rounds; i++)
   {
-    byte error = light.getError();
-    printError(error);
-    lightPass = false; // Mark as failed if this step fails
+    f = em_bl0940.getVoltage();
+    f = em_bl0940.getCurrent();
+    f = em_bl0940.getActivePower();
   }
+  uint32_t floatCycles = ESP.getCycleCount() - start;
 
-  // Set gain and measurement rate
-  if (light.setGain(gain) && light.setMeasurementRate(integrationTime, measurementRate))
+  start = ESP.getCycleCount();
+  for (uint16_t i = 0; i < rounds; i++)
   {
-    unsigned long rawData;
-    if (light.getData(rawData))
-    {
-      double luxValue;
-      if (light.getLux(gain, integrationTime, rawData, luxValue))
-      {
-        DEBUGPRINT("Lux Value: ");
-        DEBUGPRINTLN(luxValue);
-      }
-      else
-      {
-        DEBUGPRINTLN("Failed to calculate lux value.");
-        lightPass = false;
-      }
-    }
-    else
-    {
-      DEBUGPRINTLN("Failed to get raw data.");
-      lightPass = false;
-    }
+    fixed = em_bl0940.getMilliVolts();
+    fixed = em_bl0940.getMilliAmps();
+    fixed = em_bl0940.getMilliWatts();
   }
-  else
+  uint32_t fixedCycles = ESP.getCycleCount() - start;
+  (void)f;
+  (void)fixed;
+  JIG_LOG(LOG_CONVERSION_BENCH, floatCycles / rounds, fixedCycles / rounds);
+}
+
+// READALL answer captured on the bench (see bl0940.cpp), checksum with the 0x58 seed
+static const uint8_t benchReadAll[BL0940_SEND_MODE_FRAME_BYTES] = {
+    0x55, 0x5C, 0x03, 0x00, 0x33, 0x00, 0x00, 0x03, 0x00, 0x00, 0x4E, 0x69,
+    0x6E, 0xE4, 0x01, 0x00, 0xF4, 0xFF, 0xFF, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0xD2, 0x01, 0x00, 0x00, 0x00, 0x00, 0xED};
+
+// The decode the driver did before the frame descriptors: checksum loop,
+// fields copied to a holder, then assembled byte by byte
+static uint32_t holderDecode(const uint8_t *frame)
+{
+  uint8_t holder[21];
+  uint8_t crc = BL0940_READ_CMD;
+  for (int i = 0; i < BL0940_SEND_MODE_FRAME_BYTES - 1; i++)
+    crc += frame[i];
+  if ((uint8_t)~crc != frame[BL0940_SEND_MODE_FRAME_BYTES - 1])
+    return 0;
+  memcpy(holder, frame + BL0940_IFRMS_FRM_POS, 6);
+  memcpy(holder + 6, frame + BL0940_VRMS_FRM_POS, 3);
+  memcpy(holder + 9, frame + BL0940_WATT_FRM_POS, 3);
+  memcpy(holder + 12, frame + BL0940_CF_CNT_FRM_POS, 3);
+  memcpy(holder + 17, frame + BL0940_TPS1_FRM_POS, 2);
+  memcpy(holder + 19, frame + BL0940_TPS2_FRM_POS, 2);
+  uint32_t sum = 0;
+  for (uint8_t pos = 0; pos < 15; pos += 3)
+    sum += ((uint32_t)holder[pos + 2] << 16) | ((uint32_t)holder[pos + 1] << 8) | holder[pos];
+  sum += ((uint32_t)holder[18] << 8 | holder[17]) + ((uint32_t)holder[20] << 8 | holder[19]);
+  return sum;
+}
+
+static uint32_t descriptorDecode(const uint8_t *frame)
+{
+  typedef bl0940ReadAllFrame F;
+  if (!F::check(frame))
+    return 0;
+  return F::iFastRms::raw(frame) + F::iRms::raw(frame) + F::vRms::raw(frame) + F::watt::raw(frame) +
+         F::cfCnt::raw(frame) + F::tps1::raw(frame) + F::tps2::raw(frame);
+}
+
+// CPU cycles to check and decode one READALL frame, both ways
+void benchFrameDecode()
+{
+  const uint16_t rounds = 1000;
+  volatile uint32_t sink = 0;
+  const uint8_t *volatile frame = benchReadAll; // keep the frame out of constant folding
+
+  uint32_t start = ESP.getCycleCount();
+  for (uint16_t i = 0; i < rounds; i++)
+    sink = descriptorDecode(frame);
+  uint32_t descriptorCycles = ESP.getCycleCount() - start;
+
+  start = ESP.getCycleCount();
+  for (uint16_t i = 0; i < rounds; i++)
+    sink = holderDecode(frame);
+  uint32_t holderCycles = ESP.getCycleCount() - start;
+  (void)sink;
+  JIG_LOG(LOG_DECODE_BENCH, descriptorCycles / rounds, holderCycles / rounds, descriptorDecode(benchReadAll) != 0);
+}
+
+// CPU cycles for one LTR308 lux conversion: double result, integer at a
+// runtime setting, integer at a setting known at compile time
+void benchLux()
+{
+  const uint16_t rounds = 1000;
+  volatile unsigned long raw = 12345;
+  volatile uint8_t g = 1;
+  volatile uint8_t i = LIGHT_SHORTEST_INTEGRATION;
+  volatile double d;
+  volatile unsigned long ml;
+  double dv;
+  unsigned long mv;
+
+  uint32_t start = ESP.getCycleCount();
+  for (uint16_t n = 0; n < rounds; n++)
   {
-    DEBUGPRINTLN("Failed to set gain or measurement rate.");
-    lightPass = false;
+    light.getLux(g, i, raw, dv);
+    d = dv;
   }
+  uint32_t doubleCycles = ESP.getCycleCount() - start;
 
-  // Update the global status
-  if (lightPass)
+  start = ESP.getCycleCount();
+  for (uint16_t n = 0; n < rounds; n++)
   {
-    DEBUGPRINTLN("Light sensor setup passed.");
-    lightPassed = "PASSED";
+    light.getMilliLux(g, i, raw, mv);
+    ml = mv;
   }
-  else
+  uint32_t tableCycles = ESP.getCycleCount() - start;
+
+  start = ESP.getCycleCount();
+  for (uint16_t n = 0; n < rounds; n++)
   {
-    DEBUGPRINTLN("Light sensor setup failed.");
-    lightPassed = "NOT PASSED";
+    light.getLux<1, LIGHT_SHORTEST_INTEGRATION>(raw, mv);
+    ml = mv;
   }
+  uint32_t templateCycles = ESP.getCycleCount() - start;
+  (void)d;
+  (void)ml;
+  JIG_LOG(LOG_LUX_BENCH, doubleCycles / rounds, tableCycles / rounds, templateCycles / rounds);
 }
 
-void printError(byte error)
+/*
+ * Calibration: CAL_SAMPLES readings with the relay off (no load, only
+ * the mains voltage is known) and CAL_SAMPLES with the reference load on.
+ * Readings are taken uncalibrated and fitted against the CAL_REF_* values.
+ */
+void startCalibration()
 {
-  DEBUGPRINTLN("");
-  DEBUGPRINT("I2C error: ");
-  switch (error)
+  calibrationRequested = false;
+  jig.cancel();
+  em_bl0940.stopWaveStream();
+  em_bl0940.resetCalibration();
+  calFitV.reset();
+  calFitI.reset();
+  calFitP.reset();
+  calLoadOn = false;
+  calSamples = 0;
+  digitalWrite(RELAY_PIN, LOW);
+  calWakeMs = millis() + CAL_SETTLE_MS;
+  calState = CAL_SETTLE;
+  JIG_LOG(LOG_CAL_START, (float)CAL_REF_VOLTS, (float)CAL_REF_LOAD_WATTS);
+}
+
+void serviceCalibration(uint32_t now)
+{
+  if (!em_bl0940.poll())
+    return;
+  if (calState == CAL_SETTLE)
   {
-  case 0:
-    DEBUGPRINTLN("success");
-    break;
-  case 1:
-    DEBUGPRINTLN("data too long for transmit buffer");
-    break;
-  case 2:
-    DEBUGPRINTLN("received NACK on address (disconnected?)");
-    break;
-  case 3:
-    DEBUGPRINTLN("received NACK on data");
-    break;
-  case 4:
-    DEBUGPRINTLN("other error");
-    break;
-  default:
-    DEBUGPRINTLN("unknown error");
+    if ((int32_t)(now - calWakeMs) < 0)
+      return;
+    em_bl0940.requestReadAll();
+    calState = CAL_MEASURE;
+    return;
   }
-  DEBUGPRINTLN("");
+
+  if (em_bl0940.getState() != 0)
+  {
+    finishCalibration(); // fails, the sample count is short
+    return;
+  }
+  calFitV.add(em_bl0940.getVoltage(), CAL_REF_VOLTS);
+  calFitI.add(em_bl0940.getCurrent(), calLoadOn ? CAL_REF_LOAD_AMPS : 0);
+  calFitP.add(em_bl0940.getActivePower(), calLoadOn ? CAL_REF_LOAD_WATTS : 0);
+  calState = CAL_SETTLE;
+  calWakeMs = now + CAL_SAMPLE_MS;
+  if (++calSamples < CAL_SAMPLES)
+    return;
+
+  if (!calLoadOn)
+  {
+    digitalWrite(RELAY_PIN, HIGH);
+    calLoadOn = true;
+    calSamples = 0;
+    calWakeMs = now + CAL_SETTLE_MS;
+    return;
+  }
+  finishCalibration();
 }
 
-void frameDisplay(String sensorName, int x)
+void finishCalibration()
 {
-  // size 128 x 160 tft 1.8 inch
-  display.fillScreen(BACKGROUND_COLOR);
-  display.fillRoundRect(8, 8, 145, 25, 3, YELLOW); // yellow BGR
-  display.setCursor(x, 12);
-  display.setTextColor(BLACK);
-  display.setTextSize(2);
-  display.print(sensorName);
+  calState = CAL_IDLE;
+  digitalWrite(RELAY_PIN, LOW);
 
-  display.setCursor(10, 40);
-  display.setTextSize(1);
-  display.setTextColor(TEXT_COLOR);
-  display.println("DAC READ:");
+  // One reference voltage only, so voltage gets a gain and no offset
+  bl0940Calibration_t cal;
+  uint16_t samples = calFitV.count();
+  bool ok = samples == 2 * CAL_SAMPLES;
+  ok = ok && calFitV.solve(cal.vGain, cal.vOffset, false);
+  ok = ok && calFitI.solve(cal.iGain, cal.iOffset);
+  ok = ok && calFitP.solve(cal.pGain, cal.pOffset);
+  cal.eGain = cal.pGain; // CF pulses count the same active power
+  if (ok)
+  {
+    CalibrationRecord rec;
+    calibrationSeal(rec, cal);
+    ok = calibrationValid(rec);
+    if (ok)
+    {
+      em_bl0940.setCalibration(cal);
+      eep.put(BL0940_CAL_ADDR, rec);
+    }
+  }
+  if (ok)
+  {
+    JIG_LOG(LOG_CAL_RESULT, cal.vGain, cal.vOffset, cal.iGain, cal.iOffset, cal.pGain, cal.pOffset);
+    JIG_LOG(LOG_CAL_SAVED, BL0940_CAL_ADDR);
+  }
+  else
+  {
+    em_bl0940.resetCalibration();
+    JIG_LOG(LOG_CAL_FAILED, samples, 2 * CAL_SAMPLES);
+  }
+  initSensors();
+}
 
-  display.setCursor(10, 55);
-  display.setTextSize(1);
-  display.setTextColor(TEXT_COLOR);
-  display.println("DAC WRITE:");
+/*
+ * Full READALL+CORNER measurements per second at every bench rate the
+ * chip answers on. Blocks loop() for a few seconds, console only.
+ */
+void benchBaudRates()
+{
+  em_bl0940.stopWaveStream();
+  while (!em_bl0940.poll())
+  {
+  }
+  for (uint8_t i = 0; i < sizeof(bl0940BenchRates) / sizeof(bl0940BenchRates[0]); i++)
+  {
+    uint32_t rate = bl0940BenchRates[i];
+    if (em_bl0940.negotiateBaudRate(&rate, 1) == 0)
+    {
+      JIG_LOG(LOG_BAUD_NO_ANSWER, rate);
+      continue;
+    }
+    uint32_t frames = 0;
+    uint32_t start = micros();
+    for (uint8_t n = 0; n < BAUD_BENCH_FRAMES; n++)
+    {
+      em_bl0940.beginTransaction();
+      em_bl0940.addRead(BL0940_READALL_REG_ADDR);
+      em_bl0940.addRead(BL0940_CORNER_REG_ADDR);
+      em_bl0940.sendTransaction();
+      while (!em_bl0940.poll())
+      {
+      }
+      if (em_bl0940.getState() == NO_ERROR)
+        frames++;
+    }
+    uint32_t us = micros() - start;
+    JIG_LOG(LOG_BAUD_BENCH, rate, frames * 1000000.0 / us, em_bl0940.getCrcErrors(), em_bl0940.getFrameErrors());
+  }
+  uint32_t baud = em_bl0940.negotiateBaudRate(bl0940BaudRates, sizeof(bl0940BaudRates) / sizeof(bl0940BaudRates[0]));
+  JIG_LOG(LOG_BAUD, baud);
+}
 
-  display.setCursor(10, 70);
-  display.setTextSize(1);
-  display.setTextColor(TEXT_COLOR);
-  display.println("LIGHT SENSOR:");
+/*
+ * I2C transactions per second of RTC timestamps taken at RTC_BENCH_HZ,
+ * reading the chip on every getTime() and through the time cache.
+ * Blocks loop() for twice RTC_BENCH_MS, console only.
+ */
+void benchRtc()
+{
+  RTC_WIRE.beginTransmission(PCF85063TP_I2C_ADDRESS);
+  if (RTC_WIRE.endTransmission() != 0)
+  {
+    JIG_LOG(LOG_RTC_NO_ANSWER);
+    return;
+  }
+  clockrtc.begin(&RTC_WIRE);
+  float rate[2];
+  for (uint8_t pass = 0; pass < 2; pass++)
+  {
+    clockrtc.setTimeCache(pass == 0 ? 0 : RTC_MAX_ERROR_MS);
+    clockrtc.invalidateTime();
+    clockrtc.resetBusStats();
+    uint32_t start = millis();
+    for (uint32_t n = 0; n < (uint32_t)RTC_BENCH_MS * RTC_BENCH_HZ / 1000; n++)
+    {
+      while ((int32_t)(millis() - (start + n * 1000 / RTC_BENCH_HZ)) < 0)
+        delay(1);
+      clockrtc.getTime();
+    }
+    rate[pass] = clockrtc.getBusStats().transactions * 1000.0f / (millis() - start);
+  }
+  PCF85063TPBusStats_t bus = clockrtc.getBusStats();
+
+  // The last cached time against a fresh chip read
+  clockrtc.getTime();
+  int32_t cached = clockrtc.hour * 3600L + clockrtc.minute * 60 + clockrtc.second;
+  clockrtc.invalidateTime();
+  clockrtc.getTime();
+  int32_t chip = clockrtc.hour * 3600L + clockrtc.minute * 60 + clockrtc.second;
+  JIG_LOG(LOG_RTC_BENCH, RTC_BENCH_HZ, rate[0], rate[1], bus.timeReads, bus.timeCached, cached - chip);
+}
 
-  display.setCursor(10, 85);
-  display.setTextSize(1);
-  display.setTextColor(TEXT_COLOR);
-  display.println("ENERGY SENSOR:");
+void printError(byte error)
+{
+  // LOG_I2C_SUCCESS..LOG_I2C_OTHER follow the Wire error codes 0..4
+  if (error <= 4)
+    JIG_LOG(LOG_I2C_SUCCESS + error);
+  else
+    JIG_LOG(LOG_I2C_UNKNOWN, error);
 }
 
+/*
+ * Only cells whose status changed since the last call are pushed to the panel
+ */
 void writeLCD()
 {
-  display.fillScreen(BLACK);
-  frameDisplay("TESTJIG ID", 10);
-
-  display.setCursor(95, 40);
-  display.setTextColor(dacReadPassed == "PASSED" ? HIGHLIGHT_COLOR : RED, BLACK);
-  display.println(dacReadPassed);
-
-  display.setCursor(95, 55);
-  display.setTextColor(dacWritePassed == "PASSED" ? HIGHLIGHT_COLOR : RED, BLACK);
-  display.println(dacWritePassed);
-
-  display.setCursor(95, 70);
-  display.setTextColor(lightPassed == "PASSED" ? HIGHLIGHT_COLOR : RED, BLACK);
-  display.println(lightPassed);
-
-  display.setCursor(95, 85);
-  display.setTextColor(energyPassed == "PASSED" ? HIGHLIGHT_COLOR : RED, BLACK);
-  display.println(energyPassed);
+  JIG_TRACE_SCOPE("writeLCD");
+  uint32_t start = micros();
+  statusView.render(checkResults);
+#ifdef LCD_FRAMEBUFFER
+  // Only the canvas in RAM changed so far, push it as a whole
+  if (statusView.pixels() > 0)
+  {
+    canvas.flush();
+    lcdBytes = (uint32_t)LCD_WIDTH * LCD_HEIGHT * 2;
+  }
+  else
+  {
+    lcdBytes = 0;
+  }
+#else
+  lcdBytes = statusView.bytes();
+#endif
+  lcdUpdateUs = micros() - start;
 }
@@ -0,0 +1,111 @@
+#ifndef PRODUCTIONSTATS_H
+#define PRODUCTIONSTATS_H
+#include <stdint.h>
+#include "jigScheduler.h"
+
+/*---------------------------------------------
+//     Production line throughput statistics
+---------------------------------------------*/
+
+// Stage latencies are kept for the last PROD_WINDOW boards. Stages are the
+// jig check slots followed by the whole test cycle.
+#define PROD_WINDOW 64
+#define PROD_STAGE_CYCLE JIG_MAX_CHECKS
+#define PROD_STAGES (JIG_MAX_CHECKS + 1)
+
+class ProductionStats
+{
+public:
+  ProductionStats() { reset(); }
+
+  void reset()
+  {
+    for (uint8_t i = 0; i < PROD_STAGES; i++)
+    {
+      _count[i] = 0;
+      _next[i] = 0;
+    }
+    _boards = 0;
+    _firstPass = 0;
+    _lastBoard = 0;
+    _firstStartMs = 0;
+    _lastFinishMs = 0;
+  }
+
+  void addStage(uint8_t stage, uint32_t ms)
+  {
+    if (stage >= PROD_STAGES)
+      return;
+    _window[stage][_next[stage]] = ms;
+    _next[stage] = (_next[stage] + 1) % PROD_WINDOW;
+    if (_count[stage] < PROD_WINDOW)
+      _count[stage]++;
+  }
+
+  // A test cycle of board seq ended. Retests of the same board only
+  // update the timing, the yield counts the first attempt.
+  void boardFinished(uint32_t seq, bool passed, uint32_t startMs, uint32_t now)
+  {
+    _lastFinishMs = now;
+    if (seq == _lastBoard)
+      return;
+    if (_boards == 0)
+      _firstStartMs = startMs;
+    _lastBoard = seq;
+    _boards++;
+    if (passed)
+      _firstPass++;
+  }
+
+  uint32_t boards() const { return _boards; }
+  uint32_t firstPass() const { return _firstPass; }
+
+  float boardsPerHour() const
+  {
+    if (_boards == 0 || _lastFinishMs == _firstStartMs)
+      return 0;
+    return 3600000.0f * _boards / (_lastFinishMs - _firstStartMs);
+  }
+
+  // First-pass yield in percent
+  float yield() const
+  {
+    return _boards ? 100.0f * _firstPass / _boards : 0;
+  }
+
+  uint16_t samples(uint8_t stage) const
+  {
+    return stage < PROD_STAGES ? _count[stage] : 0;
+  }
+
+  // Nearest-rank percentile (pct 1..100) over the stage window, 0 if empty
+  uint32_t percentile(uint8_t stage, uint8_t pct) const
+  {
+    if (stage >= PROD_STAGES || _count[stage] == 0)
+      return 0;
+    uint16_t n = _count[stage];
+    uint32_t sorted[PROD_WINDOW];
+    for (uint16_t i = 0; i < n; i++)
+    {
+      uint32_t v = _window[stage][i];
+      uint16_t j = i;
+      for (; j > 0 && sorted[j - 1] > v; j--)
+        sorted[j] = sorted[j - 1];
+      sorted[j] = v;
+    }
+    uint16_t rank = ((uint32_t)pct * n + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+  }
+
+private:
+  uint32_t _window[PROD_STAGES][PROD_WINDOW];
+  uint16_t _count[PROD_STAGES];
+  uint16_t _next[PROD_STAGES];
+  uint32_t _boards;
+  uint32_t _firstPass;
+  uint32_t _lastBoard;
+  uint32_t _firstStartMs;
+  uint32_t _lastFinishMs;
+};
+
+#endif
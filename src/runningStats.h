@@ -0,0 +1,103 @@
+#ifndef RUNNINGSTATS_H
+#define RUNNINGSTATS_H
+#include <math.h>
+#include <stdint.h>
+
+/*---------------------------------------------
+//      Running statistics and tolerance bands
+---------------------------------------------*/
+
+// Mean, variance, min and max in constant memory (Welford's method)
+class RunningStats
+{
+public:
+  RunningStats() { reset(); }
+
+  void reset()
+  {
+    _n = 0;
+    _rejected = 0;
+    _mean = 0;
+    _m2 = 0;
+    _lo = INFINITY;
+    _hi = -INFINITY;
+  }
+
+  // With rejectSigma, once three samples are in, a sample further than
+  // rejectSigma standard deviations from the mean is counted and dropped.
+  // minSigma keeps near identical first samples from rejecting everything.
+  bool add(float x, float rejectSigma = 0, float minSigma = 0)
+  {
+    if (rejectSigma > 0 && _n >= 3)
+    {
+      float sigma = stddev() > minSigma ? stddev() : minSigma;
+      if (fabsf(x - mean()) > rejectSigma * sigma)
+      {
+        _rejected++;
+        return false;
+      }
+    }
+    _n++;
+    double delta = x - _mean;
+    _mean += delta / _n;
+    _m2 += delta * (x - _mean);
+    if (x < _lo)
+      _lo = x;
+    if (x > _hi)
+      _hi = x;
+    return true;
+  }
+
+  uint16_t count() const { return _n; }
+  uint16_t rejected() const { return _rejected; }
+  float mean() const { return (float)_mean; }
+  float variance() const { return _n > 1 ? (float)(_m2 / (_n - 1)) : 0; }
+  float stddev() const { return sqrtf(variance()); }
+  float stderrOfMean() const { return _n > 0 ? stddev() / sqrtf(_n) : INFINITY; }
+  float lowest() const { return _lo; }
+  float highest() const { return _hi; }
+
+private:
+  uint16_t _n;
+  uint16_t _rejected;
+  double _mean;
+  double _m2;
+  float _lo;
+  float _hi;
+};
+
+// Accepted range of one measured quantity, see the limits table in defVar.h
+struct AcceptLimit
+{
+  float min;
+  float max;
+  float maxStddev; // noisier than this is a failure too
+};
+
+enum AcceptVerdict : uint8_t
+{
+  VERDICT_PENDING, // take another sample
+  VERDICT_PASS,
+  VERDICT_FAIL
+};
+
+// A decision is made as soon as mean +- sigmas standard errors lies clear
+// inside or clear outside the band. With last set there is no more sample
+// coming and the plain mean decides.
+static inline AcceptVerdict acceptVerdict(const RunningStats &s, const AcceptLimit &limit, uint16_t minSamples,
+                                          float sigmas, bool last)
+{
+  if (s.count() < minSamples)
+    return last ? VERDICT_FAIL : VERDICT_PENDING;
+  float margin = sigmas * s.stderrOfMean();
+  if (s.mean() + margin < limit.min || s.mean() - margin > limit.max)
+    return VERDICT_FAIL;
+  bool quiet = s.stddev() <= limit.maxStddev;
+  if (quiet && s.mean() - margin >= limit.min && s.mean() + margin <= limit.max)
+    return VERDICT_PASS;
+  if (!last)
+    return VERDICT_PENDING;
+  return (quiet && s.mean() >= limit.min && s.mean() <= limit.max) ? VERDICT_PASS : VERDICT_FAIL;
+}
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef STATUSVIEW_H
+#define STATUSVIEW_H
+#include <Arduino_GFX_Library.h>
+#include "jigResults.h"
+
+/*---------------------------------------------
+//      Retained-mode jig status screen
+---------------------------------------------*/
+
+// The static frame (header and labels) is drawn once. After that only
+// the status cells whose value changed since the last render() are
+// redrawn, so a steady-state cycle pushes no pixels at all.
+
+#define STATUS_VIEW_CELL_X 95
+#define STATUS_VIEW_CELL_H 8
+#define STATUS_VIEW_FONT_W 6 // default GFX font, text size 1
+#define STATUS_VIEW_FONT_H 8
+#define STATUS_VIEW_FOOTER_Y 115
+#define STATUS_VIEW_FOOTER_LEN 27 // 160 px / 6 px per char
+
+class StatusView
+{
+public:
+  StatusView(Arduino_GFX *gfx, uint16_t textColor, uint16_t passColor, uint16_t failColor,
+             uint16_t headerColor, uint16_t bgColor)
+      : _gfx(gfx), _textColor(textColor), _passColor(passColor), _failColor(failColor),
+        _headerColor(headerColor), _bgColor(bgColor), _frameDrawn(false),
+        _footerDirty(false), _pixels(0), _totalBytes(0)
+  {
+    _footer[0] = '\0';
+  }
+
+  // Someone else drew over the screen, repaint everything on the next render()
+  void invalidate()
+  {
+    _frameDrawn = false;
+  }
+
+  // One line of text below the status cells, redrawn only when it changes
+  void setFooter(const char *text)
+  {
+    if (strncmp(text, _footer, STATUS_VIEW_FOOTER_LEN) == 0)
+      return;
+    strncpy(_footer, text, STATUS_VIEW_FOOTER_LEN);
+    _footer[STATUS_VIEW_FOOTER_LEN] = '\0';
+    _footerDirty = true;
+  }
+
+  void render(const CheckResult *results)
+  {
+    _pixels = 0;
+    if (!_frameDrawn)
+    {
+      _drawFrame();
+      for (uint8_t i = 0; i < CHECK_COUNT; i++)
+        _shown[i] = 0xFF;
+      _frameDrawn = true;
+      _footerDirty = true;
+    }
+    for (uint8_t i = 0; i < CHECK_COUNT; i++)
+    {
+      if (results[i].status == _shown[i])
+        continue;
+      _drawCell(i, results[i].status);
+      _shown[i] = results[i].status;
+    }
+    if (_footerDirty)
+    {
+      _drawFooter();
+      _footerDirty = false;
+    }
+    _totalBytes += bytes();
+  }
+
+  // Pixels and bytes drawn by the last render() (RGB565). Without a
+  // framebuffer this is what goes over SPI.
+  uint32_t pixels() const { return _pixels; }
+  uint32_t bytes() const { return _pixels * 2; }
+  uint32_t totalBytes() const { return _totalBytes; }
+
+private:
+  void _drawFrame()
+  {
+    // size 128 x 160 tft 1.8 inch
+    _gfx->fillScreen(_bgColor);
+    _pixels += (uint32_t)_gfx->width() * _gfx->height();
+
+    _gfx->fillRoundRect(8, 8, 145, 25, 3, _headerColor);
+    _pixels += 145 * 25;
+    _gfx->setCursor(10, 12);
+    _gfx->setTextColor(_bgColor);
+    _gfx->setTextSize(2);
+    _gfx->print("TESTJIG ID");
+    _pixels += _textPixels("TESTJIG ID", 2);
+
+    _gfx->setTextSize(1);
+    _gfx->setTextColor(_textColor);
+    for (uint8_t i = 0; i < CHECK_COUNT; i++)
+    {
+      _gfx->setCursor(10, checkInfo[i].y);
+      _gfx->print(checkInfo[i].label);
+      _pixels += _textPixels(checkInfo[i].label, 1);
+    }
+  }
+
+  void _drawCell(uint8_t i, CheckStatus status)
+  {
+    int16_t cellW = _gfx->width() - STATUS_VIEW_CELL_X;
+    _gfx->fillRect(STATUS_VIEW_CELL_X, checkInfo[i].y, cellW, STATUS_VIEW_CELL_H, _bgColor);
+    _pixels += (uint32_t)cellW * STATUS_VIEW_CELL_H;
+
+    _gfx->setTextSize(1);
+    _gfx->setCursor(STATUS_VIEW_CELL_X, checkInfo[i].y);
+    _gfx->setTextColor(status == STATUS_PASSED ? _passColor : _failColor, _bgColor);
+    _gfx->print(statusText(status));
+    _pixels += _textPixels(statusText(status), 1);
+  }
+
+  void _drawFooter()
+  {
+    int16_t w = _gfx->width();
+    _gfx->fillRect(0, STATUS_VIEW_FOOTER_Y, w, STATUS_VIEW_FONT_H, _bgColor);
+    _pixels += (uint32_t)w * STATUS_VIEW_FONT_H;
+
+    _gfx->setTextSize(1);
+    _gfx->setCursor(0, STATUS_VIEW_FOOTER_Y);
+    _gfx->setTextColor(_textColor, _bgColor);
+    _gfx->print(_footer);
+    _pixels += _textPixels(_footer, 1);
+  }
+
+  static uint32_t _textPixels(const char *text, uint8_t size)
+  {
+    return (uint32_t)strlen(text) * STATUS_VIEW_FONT_W * size * STATUS_VIEW_FONT_H * size;
+  }
+
+  Arduino_GFX *_gfx;
+  uint16_t _textColor;
+  uint16_t _passColor;
+  uint16_t _failColor;
+  uint16_t _headerColor;
+  uint16_t _bgColor;
+  bool _frameDrawn;
+  uint8_t _shown[CHECK_COUNT]; // status currently on screen, 0xFF = nothing
+  char _footer[STATUS_VIEW_FOOTER_LEN + 1];
+  bool _footerDirty;
+  uint32_t _pixels;
+  uint32_t _totalBytes;
+};
+
+#endif
@@ -0,0 +1,312 @@
+#ifndef Arduino_h
+#define Arduino_h
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+#include <functional>
+#include "sim.h"
+
+/*---------------------------------------------
+//   Arduino-ESP32 core on the virtual clock
+---------------------------------------------*/
+
+// Only what src/ and lib/ use. Timing calls go to sim.h, FreeRTOS is a
+// single task whose notifications come from the device models.
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define PULLUP 0x04
+#define INPUT_PULLUP 0x05
+#define PULLDOWN 0x08
+#define INPUT_PULLDOWN 0x09
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define IRAM_ATTR
+#define SERIAL_8N1 0x800001c
+
+#ifndef PI
+#define PI 3.1415926535897932384626433832795
+#endif
+
+/*---------------------------------------------
+//                   Time
+---------------------------------------------*/
+
+inline uint32_t micros()
+{
+  sim::advance(SIM_CALL_US);
+  return (uint32_t)sim::now();
+}
+
+inline uint32_t millis()
+{
+  sim::advance(SIM_CALL_US);
+  return (uint32_t)(sim::now() / 1000);
+}
+
+inline void delay(uint32_t ms)
+{
+  sim::advance((uint64_t)ms * 1000);
+}
+
+inline void delayMicroseconds(uint32_t us)
+{
+  sim::advance(us);
+}
+
+inline void yield()
+{
+}
+
+inline int64_t esp_timer_get_time()
+{
+  return (int64_t)sim::now();
+}
+
+/*---------------------------------------------
+//                   GPIO
+---------------------------------------------*/
+
+typedef int gpio_num_t;
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_STATE 0x103
+
+#define digitalPinToInterrupt(p) (p)
+
+inline void pinMode(uint8_t pin, uint8_t mode)
+{
+  if (pin >= SIM_PINS)
+    return;
+  sim::pins()[pin].mode = mode;
+  if (mode == INPUT_PULLUP)
+    sim::setLevel(pin, HIGH);
+}
+
+inline void digitalWrite(uint8_t pin, uint8_t val)
+{
+  sim::setLevel(pin, val);
+}
+
+inline int digitalRead(uint8_t pin)
+{
+  return pin < SIM_PINS ? sim::pins()[pin].level : LOW;
+}
+
+inline void attachInterruptArg(uint8_t pin, void (*isr)(void *), void *arg, int mode)
+{
+  if (pin >= SIM_PINS)
+    return;
+  sim::Pin &p = sim::pins()[pin];
+  p.isr = isr;
+  p.isrNoArg = NULL;
+  p.arg = arg;
+  p.edge = mode;
+}
+
+inline void attachInterrupt(uint8_t pin, void (*isr)(), int mode)
+{
+  if (pin >= SIM_PINS)
+    return;
+  sim::Pin &p = sim::pins()[pin];
+  p.isr = NULL;
+  p.isrNoArg = isr;
+  p.edge = mode;
+}
+
+inline void detachInterrupt(uint8_t pin)
+{
+  if (pin >= SIM_PINS)
+    return;
+  sim::Pin &p = sim::pins()[pin];
+  p.isr = NULL;
+  p.isrNoArg = NULL;
+  p.edge = 0;
+}
+
+inline esp_err_t gpio_pullup_dis(gpio_num_t pin)
+{
+  return ESP_OK;
+}
+
+inline esp_err_t gpio_pulldown_en(gpio_num_t pin)
+{
+  return ESP_OK;
+}
+
+/*---------------------------------------------
+//                 FreeRTOS
+---------------------------------------------*/
+
+typedef void *TaskHandle_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portMAX_DELAY 0xFFFFFFFF
+
+struct portMUX_TYPE
+{
+  uint32_t owner;
+};
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portMUX_INITIALIZE(mux) ((mux)->owner = 0)
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux) ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux) ((void)(mux))
+#define portYIELD_FROM_ISR()
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+  static int task;
+  return &task;
+}
+
+inline BaseType_t xPortGetCoreID()
+{
+  return 1; // loop() runs on core 1
+}
+
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+  sim::notifications()++;
+  return pdPASS;
+}
+
+inline void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+  sim::notifications()++;
+  if (woken)
+    *woken = pdTRUE;
+}
+
+// Sleeps until a device model notifies the task or ticks ms passed
+inline uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+  sim::advanceTo(sim::now() + (uint64_t)ticks * 1000, true);
+  uint32_t n = sim::notifications();
+  if (n > 0)
+    sim::notifications() = clear ? 0 : n - 1;
+  return n;
+}
+
+inline void vTaskDelay(TickType_t ticks)
+{
+  delay(ticks);
+}
+
+/*---------------------------------------------
+//                    ESP
+---------------------------------------------*/
+
+#define SIM_CPU_MHZ 240
+
+class EspClass
+{
+public:
+  uint32_t getCycleCount() { return (uint32_t)(sim::now() * SIM_CPU_MHZ); }
+  uint32_t getCpuFreqMHz() { return SIM_CPU_MHZ; }
+  uint32_t getFreeHeap() { return 200000; }
+};
+static EspClass ESP __attribute__((unused));
+
+/*---------------------------------------------
+//               Print / Stream
+---------------------------------------------*/
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buf, size_t n)
+  {
+    for (size_t i = 0; i < n; i++)
+      write(buf[i]);
+    return n;
+  }
+  size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+
+  size_t print(const char *s) { return write(s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char n, int base = DEC) { return print((unsigned long long)n, base); }
+  size_t print(int n, int base = DEC) { return print((long long)n, base); }
+  size_t print(unsigned int n, int base = DEC) { return print((unsigned long long)n, base); }
+  size_t print(long n, int base = DEC) { return print((long long)n, base); }
+  size_t print(unsigned long n, int base = DEC) { return print((unsigned long long)n, base); }
+  size_t print(long long n, int base = DEC)
+  {
+    if (n < 0 && base == DEC)
+      return print('-') + print((unsigned long long)-n, base);
+    return print((unsigned long long)n, base);
+  }
+  size_t print(unsigned long long n, int base = DEC)
+  {
+    char buf[66];
+    char *p = &buf[sizeof(buf) - 1];
+    *p = '\0';
+    do
+    {
+      uint8_t d = n % base;
+      *--p = d < 10 ? '0' + d : 'A' + d - 10;
+      n /= base;
+    } while (n);
+    return write(p);
+  }
+  size_t print(double v, int digits = 2) { return printf("%.*f", digits, v); }
+
+  size_t println() { return write("\r\n"); }
+  template <typename T>
+  size_t println(T v) { return print(v) + println(); }
+  template <typename T>
+  size_t println(T v, int format) { return print(v, format) + println(); }
+
+  size_t printf(const char *format, ...)
+  {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    return n > 0 ? write(buf) : 0;
+  }
+
+  virtual void flush() {}
+};
+
+class Stream : public Print
+{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+#include "HardwareSerial.h"
+
+#endif
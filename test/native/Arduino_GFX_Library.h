@@ -0,0 +1,144 @@
+#ifndef _ARDUINO_GFX_LIBRARIES_H_
+#define _ARDUINO_GFX_LIBRARIES_H_
+#include <vector>
+#include "Arduino.h"
+
+/*---------------------------------------------
+//        Display that records its SPI
+---------------------------------------------*/
+
+// Arduino_GFX with the drawing calls the jig uses. Nothing is rendered;
+// every fill and every glyph of the default 6x8 font is recorded with
+// its area, which is what an unbuffered panel gets over SPI in RGB565.
+
+#ifndef BLACK
+#define BLACK 0x0000
+#endif
+#ifndef WHITE
+#define WHITE 0xFFFF
+#endif
+#ifndef RED
+#define RED 0xF800
+#endif
+#ifndef GREEN
+#define GREEN 0x07E0
+#endif
+#ifndef YELLOW
+#define YELLOW 0xFFE0
+#endif
+
+struct GfxOp
+{
+  char kind; // 'S' fillScreen, 'F' fillRect, 'R' fillRoundRect, 'T' text
+  int16_t x;
+  int16_t y;
+  int16_t w;
+  int16_t h;
+};
+
+class Arduino_GFX : public Print
+{
+public:
+  Arduino_GFX(int16_t w, int16_t h)
+      : _width(w), _height(h), _rotation(0), _cursorX(0), _cursorY(0), _textSize(1), _textColor(WHITE), _textBg(WHITE), _pixels(0) {}
+
+  virtual bool begin(int32_t speed = 0) { return true; }
+  virtual void flush() override {}
+
+  int16_t width() const { return _width; }
+  int16_t height() const { return _height; }
+
+  void setRotation(uint8_t r)
+  {
+    if ((r & 1) != (_rotation & 1))
+      std::swap(_width, _height);
+    _rotation = r;
+  }
+
+  void fillScreen(uint16_t color)
+  {
+    _record('S', 0, 0, _width, _height);
+  }
+
+  void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color)
+  {
+    _record('F', x, y, w, h);
+  }
+
+  void fillRoundRect(int16_t x, int16_t y, int16_t w, int16_t h, int16_t r, uint16_t color)
+  {
+    _record('R', x, y, w, h);
+  }
+
+  void setCursor(int16_t x, int16_t y)
+  {
+    _cursorX = x;
+    _cursorY = y;
+  }
+  int16_t getCursorX() const { return _cursorX; }
+  int16_t getCursorY() const { return _cursorY; }
+  void setTextSize(uint8_t s) { _textSize = s ? s : 1; }
+  void setTextColor(uint16_t c) { _textColor = _textBg = c; }
+  void setTextColor(uint16_t c, uint16_t bg)
+  {
+    _textColor = c;
+    _textBg = bg;
+  }
+
+  using Print::write;
+  size_t write(uint8_t c) override
+  {
+    if (c == '\n')
+    {
+      _cursorX = 0;
+      _cursorY += 8 * _textSize;
+      return 1;
+    }
+    if (c == '\r')
+      return 1;
+    _record('T', _cursorX, _cursorY, 6 * _textSize, 8 * _textSize);
+    _cursorX += 6 * _textSize;
+    return 1;
+  }
+
+  /*
+   * Recording
+   */
+
+  uint32_t pixels() const { return _pixels; }
+  uint32_t spiBytes() const { return _pixels * 2; }
+  const std::vector<GfxOp> &ops() const { return _ops; }
+  void resetStats()
+  {
+    _pixels = 0;
+    _ops.clear();
+  }
+
+private:
+  void _record(char kind, int16_t x, int16_t y, int16_t w, int16_t h)
+  {
+    // Clipped to the panel like the driver's address window
+    int16_t x1 = std::max<int16_t>(x, 0);
+    int16_t y1 = std::max<int16_t>(y, 0);
+    int16_t x2 = std::min<int16_t>(x + w, _width);
+    int16_t y2 = std::min<int16_t>(y + h, _height);
+    if (x2 <= x1 || y2 <= y1)
+      return;
+    GfxOp op = {kind, x1, y1, (int16_t)(x2 - x1), (int16_t)(y2 - y1)};
+    _ops.push_back(op);
+    _pixels += (uint32_t)op.w * op.h;
+  }
+
+  int16_t _width;
+  int16_t _height;
+  uint8_t _rotation;
+  int16_t _cursorX;
+  int16_t _cursorY;
+  uint8_t _textSize;
+  uint16_t _textColor;
+  uint16_t _textBg;
+  uint32_t _pixels;
+  std::vector<GfxOp> _ops;
+};
+
+#endif
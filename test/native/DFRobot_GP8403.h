@@ -0,0 +1,65 @@
+#ifndef _DFROBOT_GP8403_H_
+#define _DFROBOT_GP8403_H_
+#include <Wire.h>
+
+/*---------------------------------------------
+//        DFRobot GP8403 DAC over the bus
+---------------------------------------------*/
+
+// Same register writes as the library, so the GP8403 model sees what the
+// two channels get. store() is not used by the jig and not here.
+
+#define GP8403_CONFIG_CURRENT_REG 0x02
+#define OUTPUT_RANGE 0x01
+
+class DFRobot_GP8403
+{
+public:
+  typedef enum
+  {
+    eOutputRange5V = 0x00,
+    eOutputRange10V = 0x11,
+  } eOutPutRange_t;
+
+  DFRobot_GP8403(TwoWire *pWire = &Wire, uint8_t addr = 0x58) : _pWire(pWire), _addr(addr), _voltage(5000) {}
+
+  // 0 when the DAC acknowledged, 1 when nothing answered
+  uint8_t begin(void)
+  {
+    _pWire->begin();
+    _pWire->beginTransmission(_addr);
+    return _pWire->endTransmission() != 0 ? 1 : 0;
+  }
+
+  void setDACOutRange(eOutPutRange_t range)
+  {
+    _voltage = range == eOutputRange10V ? 10000 : 5000;
+    _pWire->beginTransmission(_addr);
+    _pWire->write(OUTPUT_RANGE);
+    _pWire->write(range);
+    _pWire->endTransmission();
+  }
+
+  // channel 0, 1, or 2 for both
+  void setDACOutVoltage(uint16_t data, uint8_t channel = 0)
+  {
+    uint16_t value = (uint16_t)(((float)data / _voltage) * 4095) << 4;
+    _pWire->beginTransmission(_addr);
+    _pWire->write(GP8403_CONFIG_CURRENT_REG + (channel == 1 ? 2 : 0));
+    _pWire->write(value & 0xFF);
+    _pWire->write(value >> 8);
+    if (channel == 2)
+    {
+      _pWire->write(value & 0xFF);
+      _pWire->write(value >> 8);
+    }
+    _pWire->endTransmission();
+  }
+
+private:
+  TwoWire *_pWire;
+  uint8_t _addr;
+  uint16_t _voltage;
+};
+
+#endif
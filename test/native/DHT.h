@@ -0,0 +1,69 @@
+#ifndef DHT_H
+#define DHT_H
+#include "Arduino.h"
+#include "models/dht22Model.h"
+
+/*---------------------------------------------
+//        Adafruit DHT on the DHT22 model
+---------------------------------------------*/
+
+// Like the library a transaction (start pulse, 40 bits) takes about 5 ms,
+// and the result of a read, good or not, is reused for 2 s.
+
+#define DHT22 22
+#define DHT_READ_US 5000
+#define DHT_MIN_INTERVAL_MS 2000
+
+class DHT
+{
+public:
+  DHT(uint8_t pin, uint8_t type, uint8_t count = 6) : _pin(pin), _type(type), _lastReadMs(0), _valid(false), _t(NAN), _h(NAN) {}
+
+  void begin(uint8_t usec = 55)
+  {
+    _lastReadMs = millis() - DHT_MIN_INTERVAL_MS;
+    _valid = false;
+  }
+
+  float readTemperature(bool S = false, bool force = false)
+  {
+    if (!read(force))
+      return NAN;
+    return S ? _t * 1.8f + 32 : _t;
+  }
+
+  float readHumidity(bool force = false)
+  {
+    return read(force) ? _h : NAN;
+  }
+
+  bool read(bool force = false)
+  {
+    uint32_t now = millis();
+    if (!force && now - _lastReadMs < DHT_MIN_INTERVAL_MS)
+      return _valid;
+    _lastReadMs = now;
+    Dht22Model *model = Dht22Model::find(_pin);
+    delayMicroseconds(DHT_READ_US);
+    _valid = model && model->ready();
+    if (model)
+      model->reads++;
+    if (_valid)
+    {
+      // 0.1 resolution of the wire format
+      _t = roundf(model->temperature * 10) / 10;
+      _h = roundf(model->humidity * 10) / 10;
+    }
+    return _valid;
+  }
+
+private:
+  uint8_t _pin;
+  uint8_t _type;
+  uint32_t _lastReadMs;
+  bool _valid;
+  float _t;
+  float _h;
+};
+
+#endif
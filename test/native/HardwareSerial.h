@@ -0,0 +1,172 @@
+#ifndef HardwareSerial_h
+#define HardwareSerial_h
+#include <deque>
+#include "Arduino.h"
+
+/*---------------------------------------------
+//        UART with bytes on the clock
+---------------------------------------------*/
+
+// Writes are buffered like the UART FIFO and reach the attached device
+// one byte time (10 bits at the baud rate) after the previous one. The
+// device answers through inject(); available() only counts the bytes
+// that arrived by now. onReceive() runs after the RX timeout, two byte
+// times after the last byte of a burst.
+
+class HardwareSerial;
+
+namespace sim
+{
+// Device on the other end of a UART
+class UartDevice
+{
+public:
+  virtual ~UartDevice() {}
+  // Byte fully received by the device at atUs, sent at baud
+  virtual void receive(HardwareSerial &port, uint8_t b, uint32_t baud, uint64_t atUs) = 0;
+};
+} // namespace sim
+
+class HardwareSerial : public Stream, public sim::Timed
+{
+public:
+  explicit HardwareSerial(uint8_t port) : _port(port), _baud(0), _device(NULL), _onReceive(NULL) { reset(); }
+  ~HardwareSerial() { delete _onReceive; }
+
+  void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rxPin = -1, int8_t txPin = -1)
+  {
+    _baud = baud;
+  }
+  void end() { _baud = 0; }
+  void updateBaudRate(unsigned long baud) { _baud = baud; }
+  uint32_t baudRate() { return _baud; }
+  operator bool() const { return true; }
+
+  void onReceive(std::function<void()> fn)
+  {
+    delete _onReceive;
+    _onReceive = fn ? new std::function<void()>(fn) : NULL;
+  }
+
+  int available() override
+  {
+    int n = 0;
+    for (size_t i = 0; i < _rx.size() && _rx[i].atUs <= sim::now(); i++)
+      n++;
+    return n;
+  }
+
+  int read() override
+  {
+    if (available() == 0)
+      return -1;
+    uint8_t b = _rx.front().b;
+    _rx.pop_front();
+    return b;
+  }
+
+  int peek() override
+  {
+    return available() ? _rx.front().b : -1;
+  }
+
+  using Print::write;
+  size_t write(uint8_t b) override
+  {
+    uint64_t start = std::max(sim::now(), _txFreeUs);
+    _txFreeUs = start + byteUs();
+    if (_device && _baud)
+      _device->receive(*this, b, _baud, _txFreeUs);
+    _txBytes++;
+    return 1;
+  }
+
+  // Waits until the last byte left the TX FIFO
+  void flush() override
+  {
+    sim::advanceTo(_txFreeUs);
+  }
+
+  /*
+   * Model side
+   */
+
+  void attach(sim::UartDevice *device) { _device = device; }
+  void detach(sim::UartDevice *device)
+  {
+    if (_device == device)
+      _device = NULL;
+  }
+
+  // Device sends n bytes at baud, the first starting at startUs or when
+  // its previous answer finished. Bytes sent at another rate than the
+  // UART runs at arrive as noise.
+  void inject(const uint8_t *buf, size_t n, uint32_t baud, uint64_t startUs)
+  {
+    uint64_t us = std::max(startUs, _rxFreeUs);
+    for (size_t i = 0; i < n; i++)
+    {
+      us += 10000000ULL / baud;
+      RxByte rx = {us, baud == _baud ? buf[i] : (uint8_t)(buf[i] ^ 0x5A)};
+      _rx.push_back(rx);
+    }
+    _rxFreeUs = us;
+    _rxTimeoutUs = us + 2 * byteUs();
+  }
+
+  uint32_t txBytes() const { return _txBytes; }
+  uint64_t byteUs() const { return _baud ? 10000000ULL / _baud : 0; }
+
+  uint64_t nextEventUs() override { return _rxTimeoutUs; }
+
+  void update(uint64_t nowUs) override
+  {
+    _rxTimeoutUs = UINT64_MAX;
+    if (_onReceive)
+      (*_onReceive)();
+  }
+
+  void reset() override
+  {
+    _rx.clear();
+    _txFreeUs = 0;
+    _rxFreeUs = 0;
+    _rxTimeoutUs = UINT64_MAX;
+    _txBytes = 0;
+  }
+
+private:
+  struct RxByte
+  {
+    uint64_t atUs;
+    uint8_t b;
+  };
+
+  uint8_t _port;
+  uint32_t _baud;
+  sim::UartDevice *_device;
+  std::function<void()> *_onReceive;
+  std::deque<RxByte> _rx;
+  uint64_t _txFreeUs;
+  uint64_t _rxFreeUs;
+  uint64_t _rxTimeoutUs;
+  uint32_t _txBytes;
+};
+
+namespace sim
+{
+inline HardwareSerial &serialPort(uint8_t n)
+{
+  static HardwareSerial port0(0), port1(1), port2(2);
+  return n == 0 ? port0 : n == 1 ? port1 : port2;
+}
+} // namespace sim
+
+// Same names as the core; Serial has nothing attached, prints go nowhere.
+// Not references set up per file: a driver constructed at startup, like
+// em_bl0940, may print through one before its file initialised it.
+#define Serial (sim::serialPort(0))
+#define Serial1 (sim::serialPort(1))
+#define Serial2 (sim::serialPort(2))
+
+#endif
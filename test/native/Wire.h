@@ -0,0 +1,178 @@
+#ifndef TwoWire_h
+#define TwoWire_h
+#include <vector>
+#include "Arduino.h"
+
+/*---------------------------------------------
+//         I2C bus with device models
+---------------------------------------------*/
+
+// Every byte on the bus, address included, costs 9 clock periods plus
+// start and stop (about 90 us per byte at 100 kHz). A missing or busy
+// device NACKs its address, endTransmission() then returns 2.
+
+#define I2C_BUFFER_LENGTH 128
+
+namespace sim
+{
+// Device answering on one 7 bit address
+class I2cDevice
+{
+public:
+  explicit I2cDevice(uint8_t address) : address(address), present(true) {}
+  virtual ~I2cDevice() {}
+  // false NACKs the address, e.g. during an EEPROM write cycle
+  virtual bool ack() { return present; }
+  // Bytes of a write transaction, up to its stop
+  virtual void i2cWrite(const uint8_t *buf, uint8_t n) = 0;
+  // Bytes the master clocks in with a read transaction
+  virtual void i2cRead(uint8_t *buf, uint8_t n) = 0;
+  // Stop condition of a write, after i2cWrite()
+  virtual void i2cStop() {}
+
+  uint8_t address;
+  bool present; // false: unplugged, every transfer is NACKed
+};
+} // namespace sim
+
+class TwoWire : public Stream
+{
+public:
+  explicit TwoWire(uint8_t bus) : _bus(bus), _clock(100000), _txAddress(0), _txLen(0), _rxLen(0), _rxIndex(0), _transactions(0), _bytes(0) {}
+
+  bool setPins(int sda, int scl) { return true; }
+  bool begin() { return true; }
+  bool begin(int sda, int scl, uint32_t frequency = 0)
+  {
+    if (frequency)
+      _clock = frequency;
+    return true;
+  }
+  bool end() { return true; }
+  bool setClock(uint32_t frequency)
+  {
+    _clock = frequency;
+    return true;
+  }
+  uint32_t getClock() { return _clock; }
+
+  void beginTransmission(int address)
+  {
+    _txAddress = address;
+    _txLen = 0;
+  }
+
+  uint8_t endTransmission(bool sendStop = true)
+  {
+    sim::I2cDevice *device = _find(_txAddress);
+    _transfer(device ? 1 + _txLen : 1);
+    if (!device)
+      return 2;
+    device->i2cWrite(_txBuf, _txLen);
+    if (sendStop)
+      device->i2cStop();
+    return 0;
+  }
+
+  uint8_t requestFrom(int address, int quantity, int sendStop = 1)
+  {
+    _rxLen = 0;
+    _rxIndex = 0;
+    if (quantity > I2C_BUFFER_LENGTH)
+      quantity = I2C_BUFFER_LENGTH;
+    sim::I2cDevice *device = _find(address);
+    _transfer(device ? 1 + quantity : 1);
+    if (!device)
+      return 0;
+    device->i2cRead(_rxBuf, quantity);
+    _rxLen = quantity;
+    return quantity;
+  }
+
+  using Print::write;
+  size_t write(uint8_t b) override
+  {
+    if (_txLen >= I2C_BUFFER_LENGTH)
+      return 0;
+    _txBuf[_txLen++] = b;
+    return 1;
+  }
+
+  size_t write(const uint8_t *buf, size_t n) override
+  {
+    for (size_t i = 0; i < n; i++)
+    {
+      if (!write(buf[i]))
+        return i;
+    }
+    return n;
+  }
+
+  int available() override { return _rxLen - _rxIndex; }
+  int read() override { return _rxIndex < _rxLen ? _rxBuf[_rxIndex++] : -1; }
+  int peek() override { return _rxIndex < _rxLen ? _rxBuf[_rxIndex] : -1; }
+
+  /*
+   * Model side
+   */
+
+  void attach(sim::I2cDevice *device) { _devices.push_back(device); }
+  void detach(sim::I2cDevice *device)
+  {
+    _devices.erase(std::remove(_devices.begin(), _devices.end(), device), _devices.end());
+  }
+
+  // Transactions and bytes (address bytes included) since resetStats()
+  uint32_t transactions() const { return _transactions; }
+  uint32_t bytes() const { return _bytes; }
+  void resetStats()
+  {
+    _transactions = 0;
+    _bytes = 0;
+  }
+
+private:
+  sim::I2cDevice *_find(uint8_t address)
+  {
+    for (size_t i = 0; i < _devices.size(); i++)
+    {
+      if (_devices[i]->address == address)
+        return _devices[i]->ack() ? _devices[i] : NULL;
+    }
+    return NULL;
+  }
+
+  // Start, bytes with their ACK bit, stop
+  void _transfer(uint32_t bytes)
+  {
+    _transactions++;
+    _bytes += bytes;
+    sim::advance((bytes * 9 + 2) * 1000000ULL / _clock);
+  }
+
+  uint8_t _bus;
+  uint32_t _clock;
+  uint8_t _txAddress;
+  uint8_t _txBuf[I2C_BUFFER_LENGTH];
+  uint8_t _txLen;
+  uint8_t _rxBuf[I2C_BUFFER_LENGTH];
+  uint8_t _rxLen;
+  uint8_t _rxIndex;
+  uint32_t _transactions;
+  uint32_t _bytes;
+  std::vector<sim::I2cDevice *> _devices;
+};
+
+namespace sim
+{
+inline TwoWire &i2cBus(uint8_t n)
+{
+  static TwoWire bus0(0), bus1(1);
+  return n == 0 ? bus0 : bus1;
+}
+} // namespace sim
+
+static TwoWire &Wire __attribute__((unused)) = sim::i2cBus(0);
+static TwoWire &Wire1 __attribute__((unused)) = sim::i2cBus(1);
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef SIM_DRIVER_PCNT_H
+#define SIM_DRIVER_PCNT_H
+#include "Arduino.h"
+
+/*---------------------------------------------
+//   ESP-IDF pulse counter on the GPIO model
+---------------------------------------------*/
+
+// Rising edges of the pulse pin count up to counter_h_lim, which clears
+// the counter and runs the handler when PCNT_EVT_H_LIM is enabled.
+// Control pin, filter and the other events are accepted and ignored.
+
+typedef enum
+{
+  PCNT_UNIT_0,
+  PCNT_UNIT_1,
+  PCNT_UNIT_2,
+  PCNT_UNIT_3,
+  PCNT_UNIT_4,
+  PCNT_UNIT_5,
+  PCNT_UNIT_6,
+  PCNT_UNIT_7,
+  PCNT_UNIT_MAX
+} pcnt_unit_t;
+
+typedef enum
+{
+  PCNT_CHANNEL_0,
+  PCNT_CHANNEL_1
+} pcnt_channel_t;
+
+typedef enum
+{
+  PCNT_COUNT_DIS,
+  PCNT_COUNT_INC,
+  PCNT_COUNT_DEC
+} pcnt_count_mode_t;
+
+typedef enum
+{
+  PCNT_MODE_KEEP,
+  PCNT_MODE_REVERSE,
+  PCNT_MODE_DISABLE
+} pcnt_ctrl_mode_t;
+
+typedef enum
+{
+  PCNT_EVT_THRES_1 = 1 << 2,
+  PCNT_EVT_THRES_0 = 1 << 3,
+  PCNT_EVT_L_LIM = 1 << 4,
+  PCNT_EVT_H_LIM = 1 << 5,
+  PCNT_EVT_ZERO = 1 << 6
+} pcnt_evt_type_t;
+
+#define PCNT_PIN_NOT_USED (-1)
+
+typedef struct
+{
+  int pulse_gpio_num;
+  int ctrl_gpio_num;
+  pcnt_ctrl_mode_t lctrl_mode;
+  pcnt_ctrl_mode_t hctrl_mode;
+  pcnt_count_mode_t pos_mode;
+  pcnt_count_mode_t neg_mode;
+  int16_t counter_h_lim;
+  int16_t counter_l_lim;
+  pcnt_unit_t unit;
+  pcnt_channel_t channel;
+} pcnt_config_t;
+
+inline esp_err_t pcnt_unit_config(const pcnt_config_t *cfg)
+{
+  if (cfg->unit >= SIM_PCNT_UNITS || cfg->pulse_gpio_num < 0 || cfg->pulse_gpio_num >= SIM_PINS)
+    return ESP_FAIL;
+  sim::PcntUnit &u = sim::pcntUnits()[cfg->unit];
+  if (u.configured)
+    sim::pins()[u.pin].pcnt = 0;
+  u.configured = true;
+  u.pin = cfg->pulse_gpio_num;
+  u.count = 0;
+  u.hLim = cfg->counter_h_lim;
+  u.running = true;
+  sim::pins()[u.pin].pcnt = cfg->unit + 1;
+  return ESP_OK;
+}
+
+inline esp_err_t pcnt_get_counter_value(pcnt_unit_t unit, int16_t *count)
+{
+  *count = sim::pcntUnits()[unit].count;
+  return ESP_OK;
+}
+
+inline esp_err_t pcnt_counter_pause(pcnt_unit_t unit)
+{
+  sim::pcntUnits()[unit].running = false;
+  return ESP_OK;
+}
+
+inline esp_err_t pcnt_counter_resume(pcnt_unit_t unit)
+{
+  sim::pcntUnits()[unit].running = true;
+  return ESP_OK;
+}
+
+inline esp_err_t pcnt_counter_clear(pcnt_unit_t unit)
+{
+  sim::pcntUnits()[unit].count = 0;
+  return ESP_OK;
+}
+
+inline esp_err_t pcnt_event_enable(pcnt_unit_t unit, pcnt_evt_type_t evt)
+{
+  if (evt == PCNT_EVT_H_LIM)
+    sim::pcntUnits()[unit].hLimEvent = true;
+  return ESP_OK;
+}
+
+inline esp_err_t pcnt_event_disable(pcnt_unit_t unit, pcnt_evt_type_t evt)
+{
+  if (evt == PCNT_EVT_H_LIM)
+    sim::pcntUnits()[unit].hLimEvent = false;
+  return ESP_OK;
+}
+
+inline esp_err_t pcnt_set_filter_value(pcnt_unit_t unit, uint16_t value)
+{
+  return ESP_OK;
+}
+
+inline esp_err_t pcnt_filter_enable(pcnt_unit_t unit)
+{
+  return ESP_OK;
+}
+
+inline esp_err_t pcnt_isr_service_install(int flags)
+{
+  return ESP_OK;
+}
+
+inline esp_err_t pcnt_isr_handler_add(pcnt_unit_t unit, void (*isr)(void *), void *arg)
+{
+  sim::pcntUnits()[unit].isr = isr;
+  sim::pcntUnits()[unit].arg = arg;
+  return ESP_OK;
+}
+
+#endif
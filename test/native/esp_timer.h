@@ -0,0 +1,7 @@
+#ifndef ESP_TIMER_H
+#define ESP_TIMER_H
+
+// esp_timer_get_time() is in the Arduino.h shim, on the virtual clock
+#include "Arduino.h"
+
+#endif
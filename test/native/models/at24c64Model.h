@@ -0,0 +1,86 @@
+#ifndef AT24C64MODEL_H
+#define AT24C64MODEL_H
+#include <Wire.h>
+
+/*---------------------------------------------
+//              AT24C64 EEPROM
+---------------------------------------------*/
+
+// 8 KB behind a two byte address. A write wraps inside its 32 byte page
+// and starts a 5 ms write cycle at the stop, during which the chip NACKs
+// its address; eephandler ack-polls through that. The memory survives
+// sim::reset() like the real part survives a power cycle.
+
+#define AT24C64_MODEL_ADDR 0x50
+#define AT24C64_MODEL_SIZE 8192
+#define AT24C64_MODEL_PAGE 32
+#define AT24C64_MODEL_WRITE_US 5000
+
+class At24c64Model : public sim::I2cDevice, public sim::Timed
+{
+public:
+  explicit At24c64Model(TwoWire &bus, uint8_t address = AT24C64_MODEL_ADDR)
+      : sim::I2cDevice(address), pageWrites(0), _bus(bus), _ptr(0), _pending(false), _readyUs(0)
+  {
+    memset(memory, 0xFF, sizeof(memory));
+    bus.attach(this);
+  }
+  ~At24c64Model() { _bus.detach(this); }
+
+  uint8_t memory[AT24C64_MODEL_SIZE];
+  uint32_t pageWrites; // write cycles since construction
+
+  bool ack() override
+  {
+    return present && sim::now() >= _readyUs;
+  }
+
+  void i2cWrite(const uint8_t *buf, uint8_t n) override
+  {
+    if (n < 2)
+      return; // ack poll, or half an address
+    _ptr = ((buf[0] << 8) | buf[1]) % AT24C64_MODEL_SIZE;
+    _pending = n > 2;
+    uint16_t page = _ptr - _ptr % AT24C64_MODEL_PAGE;
+    for (uint8_t i = 2; i < n; i++)
+    {
+      memory[_ptr] = buf[i];
+      _ptr = page + (_ptr + 1) % AT24C64_MODEL_PAGE;
+    }
+  }
+
+  void i2cStop() override
+  {
+    if (!_pending)
+      return;
+    _pending = false;
+    pageWrites++;
+    _readyUs = sim::now() + AT24C64_MODEL_WRITE_US;
+  }
+
+  // Power cycle: the write cycle is over, the memory stays
+  void reset() override
+  {
+    _ptr = 0;
+    _pending = false;
+    _readyUs = 0;
+  }
+
+  // Sequential reads run on over page boundaries
+  void i2cRead(uint8_t *buf, uint8_t n) override
+  {
+    for (uint8_t i = 0; i < n; i++)
+    {
+      buf[i] = memory[_ptr];
+      _ptr = (_ptr + 1) % AT24C64_MODEL_SIZE;
+    }
+  }
+
+private:
+  TwoWire &_bus;
+  uint16_t _ptr;
+  bool _pending;     // data bytes written, write cycle starts at the stop
+  uint64_t _readyUs; // write cycle ends
+};
+
+#endif
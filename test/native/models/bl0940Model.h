@@ -0,0 +1,225 @@
+#ifndef BL0940MODEL_H
+#define BL0940MODEL_H
+#include <math.h>
+#include <HardwareSerial.h>
+#include <bl0940.h>
+
+/*---------------------------------------------
+//        BL0940 energy meter on a UART
+---------------------------------------------*/
+
+// Answers register reads (0x58 addr), READALL (0x58 0xAA) and register
+// writes (0xA8 addr L M H CRC) at its fixed 4800 baud; bytes at another
+// rate are noise and get no answer. Requests sent back to back are
+// answered back to back. The measured quantities are scripted in volts,
+// amps, watts, power factor and degrees C and turned into register
+// values with the driver's own scale. The energy counter advances with
+// the power and pulses the CF pin, the wave registers follow a 50 Hz
+// sine in V_RMS and I_RMS units.
+
+#define BL0940_MODEL_BAUD 4800
+#define BL0940_MODEL_MAINS_HZ 50
+
+class Bl0940Model : public sim::UartDevice, public sim::Timed
+{
+public:
+  typedef bl0940Scale<BL0940_BOARD> scale;
+
+  Bl0940Model(HardwareSerial &port, int8_t cfPin = -1)
+      : volts(230), amps(0.5), watts(110), powerFactor(0.96), tempC(35), present(true), badCrcReg(-1), _port(port),
+        _cfPin(cfPin)
+  {
+    port.attach(this);
+    reset();
+  }
+  ~Bl0940Model() { _port.detach(this); }
+
+  float volts;
+  float amps;
+  float watts;
+  float powerFactor;
+  float tempC;
+  bool present;       // false: unplugged, nothing answers
+  int16_t badCrcReg;  // reads of this register are answered with a wrong CRC, -1 none
+  uint32_t requests;  // reads and writes received since power-on
+  uint32_t cfCount;   // energy pulses since power-on
+
+  // Register contents at atUs
+  uint32_t regValue(uint8_t reg, uint64_t atUs)
+  {
+    switch (reg)
+    {
+    case BL0940_I_FAST_RMS_REG_ADDR:
+    case BL0940_I_RMS_REG_ADDR:
+      return _code(amps / scale::amps());
+    case BL0940_V_RMS_REG_ADDR:
+      return _code(volts / scale::volts());
+    case BL0940_I_WAVE_REG_ADDR:
+      return _signed(sqrt(2.0) * amps / scale::amps() * _phase(atUs, acos(powerFactor)));
+    case BL0940_V_WAVE_REG_ADDR:
+      return _signed(sqrt(2.0) * volts / scale::volts() * _phase(atUs, 0));
+    case BL0940_WATT_REG_ADDR:
+      return _signed(watts / scale::watts());
+    case BL0940_CF_CNT_REG_ADDR:
+      return cfCount & BL0940_CF_CNT_MASK;
+    case BL0940_CORNER_REG_ADDR:
+      return _code(acos(powerFactor) * BL0940_SAMPLING_FREQUENCY / (2 * PI * BL0940_MODEL_MAINS_HZ));
+    case BL0940_TPS1_REG_ADDR:
+    case BL0940_TPS2_REG_ADDR:
+      return _code(2 * ((tempC + 45) * 448 / 170 + 32)) & 0x3FF;
+    default:
+      return reg < sizeof(_user) / sizeof(_user[0]) ? _user[reg] : 0;
+    }
+  }
+
+  void receive(HardwareSerial &port, uint8_t b, uint32_t baud, uint64_t atUs) override
+  {
+    if (!present || baud != BL0940_MODEL_BAUD)
+    {
+      _rxLen = 0;
+      return;
+    }
+    if (_rxLen == 0 && b != BL0940_READ_CMD && b != BL0940_WRITE_CMD)
+      return; // not a command, wait for one
+    _rx[_rxLen++] = b;
+    if (_rx[0] == BL0940_READ_CMD && _rxLen == 2)
+    {
+      _rxLen = 0;
+      requests++;
+      _answer(port, _rx[1], atUs);
+    }
+    else if (_rx[0] == BL0940_WRITE_CMD && _rxLen == 6)
+    {
+      _rxLen = 0;
+      requests++;
+      _write();
+    }
+  }
+
+  uint64_t nextEventUs() override
+  {
+    if (watts <= 0)
+      return UINT64_MAX;
+    return _lastPulseUs + (uint64_t)(_pulseWs() / watts * 1e6);
+  }
+
+  // Energy pulse: counter and a short high on the CF pin
+  void update(uint64_t nowUs) override
+  {
+    _lastPulseUs = nowUs;
+    cfCount++;
+    if (_cfPin >= 0)
+    {
+      sim::drivePin(_cfPin, HIGH);
+      sim::drivePin(_cfPin, LOW);
+    }
+  }
+
+  void reset() override
+  {
+    memset(_user, 0, sizeof(_user));
+    _user[BL0940_TPS_CTRL_REG_ADDR] = BL0940_TPS_CTRL_DEFAULT;
+    _rxLen = 0;
+    requests = 0;
+    cfCount = 0;
+    _lastPulseUs = 0;
+  }
+
+private:
+  // Energy per CF pulse in watt-seconds
+  static double _pulseWs() { return scale::kWhPerPulse() * 3.6e6; }
+
+  static uint32_t _code(double v)
+  {
+    if (v <= 0)
+      return 0;
+    return v >= 0x7FFFFF ? 0x7FFFFF : (uint32_t)(v + 0.5);
+  }
+
+  // 24 bit two's complement
+  static uint32_t _signed(double v)
+  {
+    if (v > 0x7FFFFF)
+      v = 0x7FFFFF;
+    if (v < -0x800000)
+      v = -0x800000;
+    return (uint32_t)(int32_t)lround(v) & 0xFFFFFF;
+  }
+
+  static double _phase(uint64_t atUs, double lag)
+  {
+    return sin(2 * PI * BL0940_MODEL_MAINS_HZ * (atUs * 1e-6) - lag);
+  }
+
+  void _answer(HardwareSerial &port, uint8_t reg, uint64_t atUs)
+  {
+    uint8_t reply[BL0940_SEND_MODE_FRAME_BYTES];
+    if (reg == BL0940_READALL_REG_ADDR)
+    {
+      static const uint8_t fields[] = {BL0940_I_FAST_RMS_REG_ADDR, BL0940_I_RMS_REG_ADDR, BL0940_V_RMS_REG_ADDR,
+                                       BL0940_WATT_REG_ADDR, BL0940_CF_CNT_REG_ADDR, BL0940_TPS1_REG_ADDR,
+                                       BL0940_TPS2_REG_ADDR};
+      static const uint8_t offsets[] = {BL0940_IFRMS_FRM_POS, BL0940_IRMS_FRM_POS, BL0940_VRMS_FRM_POS,
+                                        BL0940_WATT_FRM_POS, BL0940_CF_CNT_FRM_POS, BL0940_TPS1_FRM_POS,
+                                        BL0940_TPS2_FRM_POS};
+      memset(reply, 0, sizeof(reply));
+      reply[0] = BL0940_SEND_MODE_HEAD;
+      for (uint8_t i = 0; i < sizeof(fields); i++)
+        _put(reply + offsets[i], regValue(fields[i], atUs));
+      uint8_t sum = BL0940_READ_CMD;
+      for (uint8_t i = 0; i < BL0940_CRC_FRM_POS; i++)
+        sum += reply[i];
+      reply[BL0940_CRC_FRM_POS] = ~sum ^ (reg == badCrcReg);
+      port.inject(reply, BL0940_SEND_MODE_FRAME_BYTES, BL0940_MODEL_BAUD, atUs);
+      return;
+    }
+    _put(reply, regValue(reg, atUs));
+    reply[3] = ~(uint8_t)(BL0940_READ_CMD + reg + reply[0] + reply[1] + reply[2]) ^ (reg == badCrcReg);
+    port.inject(reply, BL0940_REG_REPLY_BYTES, BL0940_MODEL_BAUD, atUs);
+  }
+
+  // Write frame in _rx: CRC over command, address and data, user
+  // registers only, and only after WRPROT was unlocked
+  void _write()
+  {
+    uint8_t sum = 0;
+    for (uint8_t i = 0; i < 5; i++)
+      sum += _rx[i];
+    if ((uint8_t)~sum != _rx[5])
+      return;
+    uint8_t reg = _rx[1];
+    uint32_t value = _rx[2] | (uint32_t)_rx[3] << 8 | (uint32_t)_rx[4] << 16;
+    if (reg == BL0940_USR_WRPROT_REG_ADDR)
+    {
+      _user[reg] = value & 0xFF;
+      return;
+    }
+    if (reg < BL0940_I_FAST_RMS_CTRL_REG_ADDR || reg > BL0940_TPS2_B_REG_ADDR)
+      return;
+    if (_user[BL0940_USR_WRPROT_REG_ADDR] != BL0940_UNLOCK_USER_REG)
+      return;
+    if (reg == BL0940_SOFT_RESET_REG_ADDR)
+    {
+      if (value == 0x5A5A5A)
+        reset();
+      return;
+    }
+    _user[reg] = value;
+  }
+
+  static void _put(uint8_t *p, uint32_t value)
+  {
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+  }
+
+  HardwareSerial &_port;
+  int8_t _cfPin;
+  uint32_t _user[BL0940_TPS2_B_REG_ADDR + 1]; // user registers, by address
+  uint8_t _rx[6];
+  uint8_t _rxLen;
+  uint64_t _lastPulseUs;
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef DHT22MODEL_H
+#define DHT22MODEL_H
+#include <math.h>
+#include "Arduino.h"
+
+/*---------------------------------------------
+//           DHT22 on its data pin
+---------------------------------------------*/
+
+// The sensor answers from 2 s after power-on (sim::reset()); before that,
+// or when it is unplugged, a read times out and the library returns NAN.
+// DHT looks the model up by pin.
+
+#define DHT22_MODEL_WARMUP_US 2000000ULL
+
+class Dht22Model
+{
+public:
+  explicit Dht22Model(uint8_t pin) : temperature(25), humidity(50), present(true), reads(0), _pin(pin)
+  {
+    registry().push_back(this);
+  }
+  ~Dht22Model()
+  {
+    registry().erase(std::remove(registry().begin(), registry().end(), this), registry().end());
+  }
+
+  float temperature; // scripted, degrees C
+  float humidity;    // scripted, percent
+  bool present;
+  uint32_t reads;    // bus transactions
+
+  bool ready() const { return present && sim::now() >= DHT22_MODEL_WARMUP_US; }
+  uint8_t pin() const { return _pin; }
+
+  static Dht22Model *find(uint8_t pin)
+  {
+    for (size_t i = 0; i < registry().size(); i++)
+    {
+      if (registry()[i]->_pin == pin)
+        return registry()[i];
+    }
+    return NULL;
+  }
+
+private:
+  static std::vector<Dht22Model *> &registry()
+  {
+    static std::vector<Dht22Model *> models;
+    return models;
+  }
+
+  Dht22Model(const Dht22Model &);
+  Dht22Model &operator=(const Dht22Model &);
+
+  uint8_t _pin;
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef GP8403MODEL_H
+#define GP8403MODEL_H
+#include <Wire.h>
+
+/*---------------------------------------------
+//           GP8403 0-10 V two channel DAC
+---------------------------------------------*/
+
+// Output range register 0x01, channel data 0x02/0x04 as 12 bits left
+// aligned in little endian words. mV() is what a meter on a channel reads.
+
+#define GP8403_MODEL_ADDR 0x58
+
+class Gp8403Model : public sim::I2cDevice, public sim::Timed
+{
+public:
+  explicit Gp8403Model(TwoWire &bus, uint8_t address = GP8403_MODEL_ADDR) : sim::I2cDevice(address), _bus(bus)
+  {
+    bus.attach(this);
+    reset();
+  }
+  ~Gp8403Model() { _bus.detach(this); }
+
+  uint16_t rangeMv() const { return _range == 0x11 ? 10000 : 5000; }
+
+  uint16_t mV(uint8_t channel) const
+  {
+    return (uint32_t)_code[channel & 1] * rangeMv() / 4095;
+  }
+
+  void i2cWrite(const uint8_t *buf, uint8_t n) override
+  {
+    if (n < 2)
+      return;
+    if (buf[0] == 0x01)
+    {
+      _range = buf[1];
+      return;
+    }
+    for (uint8_t i = 1; i + 1 < n; i += 2)
+    {
+      uint8_t channel = ((buf[0] - 0x02) / 2 + (i - 1) / 2) & 1;
+      _code[channel] = (buf[i] | buf[i + 1] << 8) >> 4;
+    }
+  }
+
+  void i2cRead(uint8_t *buf, uint8_t n) override
+  {
+    memset(buf, 0, n);
+  }
+
+  void reset() override
+  {
+    _range = 0x00;
+    _code[0] = 0;
+    _code[1] = 0;
+  }
+
+private:
+  TwoWire &_bus;
+  uint8_t _range;
+  uint16_t _code[2];
+};
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef LTR308MODEL_H
+#define LTR308MODEL_H
+#include <Wire.h>
+
+/*---------------------------------------------
+//          LTR-308ALS light sensor
+---------------------------------------------*/
+
+// Register file with address auto-increment. While CONTR enables it a
+// conversion finishes every measurement period, never faster than the
+// integration time, with the counts of the scripted lux (0.6 lux per
+// count at 1X and 100 ms). A result outside the thresholds sets the INT
+// status and pulls the open-drain INT pin low until STATUS is read.
+
+#define LTR308_MODEL_ADDR 0x53
+#define LTR308_MODEL_REGS 0x27
+
+class Ltr308Model : public sim::I2cDevice, public sim::Timed
+{
+public:
+  Ltr308Model(TwoWire &bus, int8_t intPin = -1) : sim::I2cDevice(LTR308_MODEL_ADDR), lux(100), _bus(bus), _intPin(intPin)
+  {
+    bus.attach(this);
+    reset();
+  }
+  ~Ltr308Model() { _bus.detach(this); }
+
+  float lux;            // scripted illuminance
+  uint32_t conversions; // finished since power-on
+
+  static uint16_t integrationMs(uint8_t code)
+  {
+    static const uint16_t ms[8] = {400, 200, 100, 50, 25, 25, 25, 25};
+    return ms[code & 7];
+  }
+
+  static uint16_t rateMs(uint8_t code)
+  {
+    static const uint16_t ms[8] = {25, 50, 100, 500, 25, 1000, 2000, 2000};
+    return ms[code & 7];
+  }
+
+  uint32_t periodMs() const
+  {
+    uint16_t integration = integrationMs(_regs[0x04] >> 4);
+    uint16_t rate = rateMs(_regs[0x04]);
+    return rate > integration ? rate : integration;
+  }
+
+  // Counts for the scripted lux at the current gain and integration time
+  uint32_t counts() const
+  {
+    static const uint8_t gainX[8] = {1, 3, 6, 9, 18, 1, 1, 1};
+    uint8_t integration = (_regs[0x04] >> 4) & 7;
+    uint32_t fullScale = (1UL << (20 - (integration > 4 ? 4 : integration))) - 1;
+    double c = lux * gainX[_regs[0x05] & 7] * integrationMs(integration) / 60.0;
+    return c >= fullScale ? fullScale : (uint32_t)c;
+  }
+
+  void i2cWrite(const uint8_t *buf, uint8_t n) override
+  {
+    if (n == 0)
+      return;
+    _ptr = buf[0];
+    for (uint8_t i = 1; i < n; i++)
+      _write(_ptr++, buf[i]);
+  }
+
+  void i2cRead(uint8_t *buf, uint8_t n) override
+  {
+    for (uint8_t i = 0; i < n; i++)
+      buf[i] = _read(_ptr++);
+  }
+
+  uint64_t nextEventUs() override
+  {
+    return (_regs[0x00] & 0x02) ? _doneUs : UINT64_MAX;
+  }
+
+  // A conversion finished
+  void update(uint64_t nowUs) override
+  {
+    uint32_t c = counts();
+    _regs[0x0D] = c;
+    _regs[0x0E] = c >> 8;
+    _regs[0x0F] = c >> 16;
+    _regs[0x07] |= 0x08;
+    conversions++;
+    uint32_t upper = _regs[0x21] | (uint32_t)_regs[0x22] << 8 | (uint32_t)(_regs[0x23] & 0x0F) << 16;
+    uint32_t lower = _regs[0x24] | (uint32_t)_regs[0x25] << 8 | (uint32_t)(_regs[0x26] & 0x0F) << 16;
+    if ((c > upper || c < lower) && ++_outside > (_regs[0x1A] >> 4) && (_regs[0x19] & 0x04))
+    {
+      _regs[0x07] |= 0x10;
+      if (_intPin >= 0)
+        sim::drivePin(_intPin, LOW);
+    }
+    _doneUs += periodMs() * 1000ULL;
+  }
+
+  void reset() override
+  {
+    memset(_regs, 0, sizeof(_regs));
+    _regs[0x04] = 0x22; // 100 ms, 100 ms
+    _regs[0x05] = 0x01; // 3X
+    _regs[0x06] = 0xB1;
+    _regs[0x07] = 0x20; // power-on event
+    _regs[0x19] = 0x10;
+    _regs[0x21] = 0xFF;
+    _regs[0x22] = 0xFF;
+    _regs[0x23] = 0x0F;
+    _ptr = 0;
+    _outside = 0;
+    _doneUs = UINT64_MAX;
+    conversions = 0;
+    if (_intPin >= 0)
+      sim::drivePin(_intPin, -1);
+  }
+
+private:
+  void _write(uint8_t reg, uint8_t value)
+  {
+    if (reg >= LTR308_MODEL_REGS)
+      return;
+    switch (reg)
+    {
+    case 0x00:
+      if (value & 0x10)
+      {
+        reset();
+        return;
+      }
+      _regs[reg] = value & 0x02;
+      _restart();
+      break;
+    case 0x04:
+    case 0x05:
+      _regs[reg] = value;
+      _restart();
+      break;
+    case 0x06:
+    case 0x07:
+    case 0x0D:
+    case 0x0E:
+    case 0x0F:
+      break; // read only
+    default:
+      _regs[reg] = value;
+    }
+  }
+
+  uint8_t _read(uint8_t reg)
+  {
+    if (reg >= LTR308_MODEL_REGS)
+      return 0;
+    uint8_t value = _regs[reg];
+    if (reg == 0x07)
+    {
+      // Reading STATUS clears the power-on and INT flags and releases INT
+      _regs[0x07] &= ~0x30;
+      if (_intPin >= 0)
+        sim::drivePin(_intPin, -1);
+    }
+    if (reg == 0x0D)
+      _regs[0x07] &= ~0x08; // data read
+    return value;
+  }
+
+  // Settings changed or power-up: a new conversion starts now
+  void _restart()
+  {
+    _outside = 0;
+    _doneUs = sim::now() + periodMs() * 1000ULL;
+  }
+
+  TwoWire &_bus;
+  int8_t _intPin;
+  uint8_t _regs[LTR308_MODEL_REGS];
+  uint8_t _ptr;
+  uint8_t _outside; // conversions in a row outside the thresholds
+  uint64_t _doneUs; // current conversion finishes
+};
+
+#endif
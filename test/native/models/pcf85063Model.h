@@ -0,0 +1,169 @@
+#ifndef PCF85063MODEL_H
+#define PCF85063MODEL_H
+#include <math.h>
+#include <Wire.h>
+
+/*---------------------------------------------
+//            PCF85063TP real time clock
+---------------------------------------------*/
+
+// Time is kept as seconds since 2000-01-01 00:00 on the virtual clock,
+// running ppm fast. A read latches the time registers at its start like
+// the chip does. Writes to the time registers take effect at the stop of
+// the transaction; STOP in CTRL1 freezes the time and clears the
+// prescaler. Years 2000 to 2099, every fourth one a leap year.
+
+#define PCF85063_MODEL_ADDR 0x51
+#define PCF85063_MODEL_REGS 0x0B
+
+class Pcf85063Model : public sim::I2cDevice, public sim::Timed
+{
+public:
+  explicit Pcf85063Model(TwoWire &bus) : sim::I2cDevice(PCF85063_MODEL_ADDR), ppm(0), _bus(bus)
+  {
+    bus.attach(this);
+    reset();
+  }
+  ~Pcf85063Model() { _bus.detach(this); }
+
+  double ppm;        // crystal error, positive runs fast
+  uint32_t reads;    // read transactions since power-on
+  uint32_t writes;   // write transactions since power-on
+
+  // Seconds since 2000-01-01 00:00, with the fraction
+  double seconds() const
+  {
+    if (_regs[0x00] & 0x20)
+      return _base;
+    return _base + (sim::now() - _baseUs) * 1e-6 * (1 + ppm * 1e-6);
+  }
+
+  void setSeconds(double s)
+  {
+    _base = s;
+    _baseUs = sim::now();
+  }
+
+  static uint32_t secondsOf(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second)
+  {
+    uint32_t days = 0;
+    for (uint16_t y = 2000; y < year; y++)
+      days += y % 4 ? 365 : 366;
+    for (uint8_t m = 1; m < month; m++)
+      days += _monthDays(m - 1, year);
+    days += day - 1;
+    return days * 86400UL + hour * 3600UL + minute * 60UL + second;
+  }
+
+  void i2cWrite(const uint8_t *buf, uint8_t n) override
+  {
+    if (n == 0)
+      return;
+    writes++;
+    _ptr = buf[0];
+    for (uint8_t i = 1; i < n; i++)
+    {
+      uint8_t reg = _ptr++ % PCF85063_MODEL_REGS;
+      if (reg >= 0x04)
+        _timeWritten = true;
+      if (reg == 0x00)
+        _writeCtrl1(buf[i]);
+      else
+        _regs[reg] = buf[i];
+    }
+  }
+
+  void i2cStop() override
+  {
+    if (_timeWritten)
+    {
+      _timeWritten = false;
+      setSeconds(_fromRegs());
+      _regs[0x04] &= 0x7F; // OS cleared with the new time
+    }
+  }
+
+  void i2cRead(uint8_t *buf, uint8_t n) override
+  {
+    reads++;
+    _latch();
+    for (uint8_t i = 0; i < n; i++)
+      buf[i] = _regs[_ptr++ % PCF85063_MODEL_REGS];
+  }
+
+  void reset() override
+  {
+    memset(_regs, 0, sizeof(_regs));
+    _regs[0x04] = 0x80; // oscillator stopped at power-on
+    _regs[0x07] = 0x01;
+    _regs[0x08] = 0x06;
+    _regs[0x09] = 0x01;
+    _ptr = 0;
+    _timeWritten = false;
+    reads = 0;
+    writes = 0;
+    setSeconds(0);
+  }
+
+private:
+  static uint8_t _bcd(uint32_t v) { return (v / 10) * 16 + v % 10; }
+  static uint32_t _dec(uint8_t b) { return (b >> 4) * 10 + (b & 15); }
+
+  static uint8_t _monthDays(uint8_t m, uint16_t year)
+  {
+    static const uint8_t days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    return days[m] + (m == 1 && year % 4 == 0);
+  }
+
+  void _writeCtrl1(uint8_t value)
+  {
+    if (value == 0x58)
+    {
+      reset(); // software reset
+      return;
+    }
+    bool wasStopped = _regs[0x00] & 0x20;
+    double s = seconds();
+    _regs[0x00] = value;
+    if (wasStopped != (bool)(value & 0x20))
+      setSeconds(wasStopped ? floor(s) : s); // prescaler restarts at the full second
+  }
+
+  // Time registers from seconds()
+  void _latch()
+  {
+    uint32_t t = (uint32_t)floor(seconds());
+    uint32_t days = t / 86400, sod = t % 86400;
+    _regs[0x04] = (_regs[0x04] & 0x80) | _bcd(sod % 60);
+    _regs[0x05] = _bcd(sod / 60 % 60);
+    _regs[0x06] = _bcd(sod / 3600);
+    _regs[0x08] = (days + 6) % 7; // 2000-01-01 was a Saturday
+    uint16_t year = 2000;
+    while (days >= (uint32_t)(year % 4 ? 365 : 366))
+    {
+      days -= year % 4 ? 365 : 366;
+      year++;
+    }
+    uint8_t m = 0;
+    while (days >= _monthDays(m, year))
+      days -= _monthDays(m++, year);
+    _regs[0x07] = _bcd(days + 1);
+    _regs[0x09] = _bcd(m + 1);
+    _regs[0x0A] = _bcd(year - 2000);
+  }
+
+  double _fromRegs() const
+  {
+    return secondsOf(2000 + _dec(_regs[0x0A]), _dec(_regs[0x09] & 0x1F), _dec(_regs[0x07] & 0x3F),
+                     _dec(_regs[0x06] & 0x3F), _dec(_regs[0x05] & 0x7F), _dec(_regs[0x04] & 0x7F));
+  }
+
+  TwoWire &_bus;
+  uint8_t _regs[PCF85063_MODEL_REGS];
+  uint8_t _ptr;
+  bool _timeWritten;
+  double _base;     // seconds() at _baseUs
+  uint64_t _baseUs;
+};
+
+#endif
@@ -0,0 +1,210 @@
+#ifndef SIM_H
+#define SIM_H
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <algorithm>
+
+/*---------------------------------------------
+//      Virtual clock for the native tests
+---------------------------------------------*/
+
+// Time only moves when the code under test spends it: every millis() or
+// micros() call costs SIM_CALL_US, delay() and bus transfers advance the
+// clock by their duration. Device models derived from sim::Timed are
+// updated at the virtual time of each of their events, so an INT edge or
+// a UART byte turns up when it would on the bench, however fast the host.
+
+#define SIM_CALL_US 1
+#define SIM_PINS 40
+#define SIM_PCNT_UNITS 8
+
+namespace sim
+{
+
+inline uint64_t &clockUs()
+{
+  static uint64_t us = 0;
+  return us;
+}
+
+inline uint64_t now()
+{
+  return clockUs();
+}
+
+// Notifications pending for the one task the tests run in
+inline uint32_t &notifications()
+{
+  static uint32_t n = 0;
+  return n;
+}
+
+// Something that acts on its own at a known time: a conversion that
+// finishes, a byte that arrives, a write cycle that ends
+class Timed
+{
+public:
+  Timed() { list().push_back(this); }
+  virtual ~Timed() { list().erase(std::remove(list().begin(), list().end(), this), list().end()); }
+
+  // Virtual time of the next event, UINT64_MAX for none
+  virtual uint64_t nextEventUs() { return UINT64_MAX; }
+  // Called once the clock reached nextEventUs(), must move it on
+  virtual void update(uint64_t nowUs) {}
+  // Back to power-on state, see sim::reset()
+  virtual void reset() {}
+
+  static std::vector<Timed *> &list()
+  {
+    static std::vector<Timed *> timed;
+    return timed;
+  }
+
+private:
+  Timed(const Timed &);
+  Timed &operator=(const Timed &);
+};
+
+/*
+ * Move the clock to toUs, stopping at every device event on the way.
+ * With wake set it returns early, at the event that notified the task.
+ * Time spent inside an event handler (an ISR calling micros()) is added
+ * without looking for more events.
+ */
+inline void advanceTo(uint64_t toUs, bool wake = false)
+{
+  static bool inEvent = false;
+  if (inEvent)
+  {
+    if (toUs > clockUs())
+      clockUs() = toUs;
+    return;
+  }
+  for (;;)
+  {
+    if (wake && notifications() > 0)
+      return;
+    std::vector<Timed *> &timed = Timed::list();
+    uint64_t next = UINT64_MAX;
+    for (size_t i = 0; i < timed.size(); i++)
+      next = std::min(next, timed[i]->nextEventUs());
+    if (next > toUs)
+      break;
+    if (next > clockUs())
+      clockUs() = next;
+    inEvent = true;
+    for (size_t i = 0; i < timed.size(); i++)
+    {
+      if (timed[i]->nextEventUs() <= clockUs())
+        timed[i]->update(clockUs());
+    }
+    inEvent = false;
+  }
+  if (toUs > clockUs())
+    clockUs() = toUs;
+}
+
+inline void advance(uint64_t us)
+{
+  advanceTo(clockUs() + us);
+}
+
+/*---------------------------------------------
+//                    GPIO
+---------------------------------------------*/
+
+struct Pin
+{
+  uint8_t mode;
+  uint8_t level;
+  int8_t edge;    // RISING, FALLING or CHANGE, 0 = no interrupt
+  void (*isr)(void *);
+  void (*isrNoArg)();
+  void *arg;
+  uint8_t pcnt;   // PCNT unit + 1 counting its rising edges, 0 = none
+};
+
+inline Pin *pins()
+{
+  static Pin p[SIM_PINS];
+  return p;
+}
+
+struct PcntUnit
+{
+  bool configured;
+  uint8_t pin;
+  bool running;
+  bool hLimEvent;
+  int16_t count;
+  int16_t hLim;
+  void (*isr)(void *);
+  void *arg;
+};
+
+inline PcntUnit *pcntUnits()
+{
+  static PcntUnit u[SIM_PCNT_UNITS];
+  return u;
+}
+
+// Level change on a pin, runs its interrupt and PCNT counting like the chip would
+inline void setLevel(uint8_t pin, uint8_t level)
+{
+  if (pin >= SIM_PINS)
+    return;
+  Pin &p = pins()[pin];
+  uint8_t old = p.level;
+  p.level = level ? 1 : 0;
+  if (old == p.level)
+    return;
+  bool rising = p.level;
+  if (p.pcnt && rising)
+  {
+    PcntUnit &u = pcntUnits()[p.pcnt - 1];
+    if (u.running && ++u.count >= u.hLim)
+    {
+      u.count = 0;
+      if (u.hLimEvent && u.isr)
+        u.isr(u.arg);
+    }
+  }
+  // Arduino-ESP32 modes: RISING 1, FALLING 2, CHANGE 3
+  if ((p.edge == 3) || (p.edge == 1 && rising) || (p.edge == 2 && !rising))
+  {
+    if (p.isr)
+      p.isr(p.arg);
+    else if (p.isrNoArg)
+      p.isrNoArg();
+  }
+}
+
+// A model pulls the pin to level, or lets go of it (level < 0) and the
+// pull resistor decides: high for INPUT_PULLUP and for an external
+// pull-up on an open-drain line (pullUp), low otherwise
+inline void drivePin(uint8_t pin, int8_t level, bool pullUp = true)
+{
+  if (pin >= SIM_PINS)
+    return;
+  setLevel(pin, level >= 0 ? level : (pullUp ? 1 : 0));
+}
+
+// Start over at time 0: drops pending notifications, pin and PCNT state
+// and puts every live device model back to power-on
+inline void reset()
+{
+  clockUs() = 0;
+  notifications() = 0;
+  for (uint8_t i = 0; i < SIM_PINS; i++)
+    pins()[i] = Pin();
+  for (uint8_t i = 0; i < SIM_PCNT_UNITS; i++)
+    pcntUnits()[i] = PcntUnit();
+  std::vector<Timed *> &timed = Timed::list();
+  for (size_t i = 0; i < timed.size(); i++)
+    timed[i]->reset();
+}
+
+} // namespace sim
+
+#endif
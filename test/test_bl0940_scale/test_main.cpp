@@ -0,0 +1,154 @@
+#include <chrono>
+#include <unity.h>
+#include <Arduino.h>
+#include <bl0940.h>
+#include "models/bl0940Model.h"
+
+/*---------------------------------------------
+//      BL0940 Q24 getters against float
+---------------------------------------------*/
+
+// bl0940Scale turns a register value into milli-units with one 32x32 bit
+// multiply and a rounding shift. Over every value the 24 bit registers
+// can hold it has to stay within one milli-unit of the float getters.
+// test_bench reports the cost of both on the host; pio test -v shows it.
+
+typedef bl0940Scale<BL0940_BOARD> scale;
+
+#define SCALE_RAW_MAX 0x7FFFFF // RMS registers are 23 bit, WATT is signed
+#define SCALE_BENCH_ROUNDS 20
+
+// Largest |Q24 - getter| in milli-units over raw lo..hi, Ref being the
+// type the float getter multiplies in
+template <typename Raw, typename Ref>
+static double maxError(uint32_t q24, double unitsPerLsb, Raw lo, Raw hi)
+{
+  Ref refScale = (Ref)unitsPerLsb;
+  double worst = 0;
+  for (int64_t raw = lo; raw <= hi; raw++)
+  {
+    double fixed = scale::apply((Raw)raw, q24);
+    double viaGetter = (Ref)raw * refScale * 1000.0;
+    double error = fabs(fixed - viaGetter);
+    if (error > worst)
+      worst = error;
+  }
+  return worst;
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_volts_agree(void)
+{
+  double worst = maxError<uint32_t, float>(scale::milliVolts(), scale::volts(), 0, SCALE_RAW_MAX);
+  TEST_ASSERT_FLOAT_WITHIN(1.0, 0, worst);
+}
+
+void test_amps_agree(void)
+{
+  double worst = maxError<uint32_t, float>(scale::milliAmps(), scale::amps(), 0, SCALE_RAW_MAX);
+  TEST_ASSERT_FLOAT_WITHIN(1.0, 0, worst);
+}
+
+void test_watts_agree(void)
+{
+  double worst = maxError<int32_t, double>(scale::milliWatts(), scale::watts(), -SCALE_RAW_MAX, SCALE_RAW_MAX);
+  TEST_ASSERT_FLOAT_WITHIN(1.0, 0, worst);
+}
+
+void test_energy_agrees(void)
+{
+  // CF_CNT is a full 24 bit counter, a float kWh total is no reference
+  // that far up
+  double worst = maxError<uint32_t, double>(scale::milliWattHours(), scale::kWhPerPulse() * 1000, 0, BL0940_CF_CNT_MASK);
+  TEST_ASSERT_FLOAT_WITHIN(1.0, 0, worst);
+}
+
+// Both getter families of one driver on the same READALL frame, with a
+// calibration folded into the scale factors
+void test_driver_getters_agree(void)
+{
+  sim::reset();
+  Bl0940Model model(Serial1);
+  bl0940 meter(&Serial1, &Serial);
+  bl0940Calibration_t cal = {1.013f, 0.12f, 0.987f, -0.003f, 1.021f, 0.4f, 1.0f};
+  meter.setCalibration(cal);
+
+  const float volts[] = {0, 90, 229.7, 264};
+  for (uint8_t i = 0; i < sizeof(volts) / sizeof(volts[0]); i++)
+  {
+    model.volts = volts[i];
+    model.amps = volts[i] / 460;
+    model.watts = volts[i] * model.amps * 0.95f;
+    meter.requestReadAll();
+    while (!meter.poll())
+      delay(1);
+    TEST_ASSERT_EQUAL(NO_ERROR, meter.getState());
+    // The unsigned getters stop at 0 where an offset would go below
+    TEST_ASSERT_FLOAT_WITHIN(1.0, fmax(0, meter.getVoltage() * 1000), meter.getMilliVolts());
+    TEST_ASSERT_FLOAT_WITHIN(1.0, fmax(0, meter.getCurrent() * 1000), meter.getMilliAmps());
+    TEST_ASSERT_FLOAT_WITHIN(1.0, meter.getActivePower() * 1000, meter.getMilliWatts());
+  }
+}
+
+template <typename Fn>
+static double nsPerCall(Fn fn)
+{
+  volatile uint64_t sink = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (uint8_t round = 0; round < SCALE_BENCH_ROUNDS; round++)
+  {
+    for (uint32_t raw = 0; raw <= SCALE_RAW_MAX; raw += 7)
+      sink = sink + fn(raw);
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  return ns / (SCALE_BENCH_ROUNDS * (SCALE_RAW_MAX / 7 + 1));
+}
+
+static uint32_t q24Volts(uint32_t raw)
+{
+  return scale::apply(raw, scale::milliVolts());
+}
+
+static uint32_t floatVolts(uint32_t raw)
+{
+  static const float vScale = (float)scale::volts();
+  return (uint32_t)(raw * vScale * 1000);
+}
+
+static uint32_t doubleWatts(uint32_t raw)
+{
+  // getActivePower() keeps the power scale in double
+  return (uint32_t)(long)((long)raw * scale::watts() * 1000);
+}
+
+static uint32_t q24Watts(uint32_t raw)
+{
+  return (uint32_t)scale::apply((int32_t)raw, scale::milliWatts());
+}
+
+void test_bench(void)
+{
+  char msg[120];
+  snprintf(msg, sizeof(msg), "ns per conversion: Q24 V %.2f, float V %.2f, Q24 W %.2f, double W %.2f",
+           nsPerCall(q24Volts), nsPerCall(floatVolts), nsPerCall(q24Watts), nsPerCall(doubleWatts));
+  TEST_MESSAGE(msg);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_volts_agree);
+  RUN_TEST(test_amps_agree);
+  RUN_TEST(test_watts_agree);
+  RUN_TEST(test_energy_agrees);
+  RUN_TEST(test_driver_getters_agree);
+  RUN_TEST(test_bench);
+  return UNITY_END();
+}
@@ -0,0 +1,202 @@
+#include <chrono>
+#include <math.h>
+#include <unity.h>
+#include <Arduino.h>
+#include <Wire.h>
+#include <LTR308.h>
+
+/*---------------------------------------------
+//     LTR308 lux table against the old getLux
+---------------------------------------------*/
+
+// getMilliLux() replaced the gain and integration time switches of
+// getLux() with a multiplier and shift per setting. Every count of every
+// setting, up to the 20 bit maximum, has to give the old double lux
+// rounded to milli-lux. test_bench reports the cost of both on the host;
+// pio test -v shows it.
+
+#define LUX_COUNTS 0x100000UL // 20 bits at 400 ms
+#define LUX_BENCH_STEP 3
+
+static LTR308 light(&Wire);
+
+// getLux() before the scale table, kept as the reference
+static boolean referenceLux(byte gain, byte integrationTime, unsigned long CH, double &lux)
+{
+  double d0;
+
+  if (CH == 0x000FFFFF)
+  {
+    lux = 0.0;
+    return (false);
+  }
+
+  switch (gain)
+  {
+  case 0:
+    d0 = ((double)CH * 0.6);
+    break;
+  case 1:
+    d0 = ((double)CH * 0.6) / 3;
+    break;
+  case 2:
+    d0 = ((double)CH * 0.6) / 6;
+    break;
+  case 3:
+    d0 = ((double)CH * 0.6) / 9;
+    break;
+  case 4:
+    d0 = ((double)CH * 0.6) / 18;
+    break;
+  default:
+    d0 = 0.0;
+    break;
+  }
+
+  switch (integrationTime)
+  {
+  case 0:
+    lux = d0 / 4;
+    break;
+  case 1:
+    lux = d0 / 2;
+    break;
+  case 2:
+    lux = d0;
+    break;
+  case 3:
+    lux = d0 * 2;
+    break;
+  case 4:
+    lux = d0 * 4;
+    break;
+  default:
+    lux = 0.0;
+    break;
+  }
+  return (true);
+}
+
+// Counts of gain / integrationTime where getMilliLux() is not the
+// reference rounded to milli-lux
+static uint32_t mismatches(byte gain, byte integrationTime)
+{
+  uint32_t bad = 0;
+  for (unsigned long ch = 0; ch < LUX_COUNTS; ch++)
+  {
+    double lux;
+    unsigned long milliLux;
+    boolean refGood = referenceLux(gain, integrationTime, ch, lux);
+    boolean good = light.getMilliLux(gain, integrationTime, ch, milliLux);
+    if (good != refGood || milliLux != (unsigned long)lround(lux * 1000))
+      bad++;
+  }
+  return bad;
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_every_count_matches(void)
+{
+  for (byte gain = 0; gain < 5; gain++)
+  {
+    for (byte integrationTime = 0; integrationTime < 5; integrationTime++)
+    {
+      char msg[40];
+      snprintf(msg, sizeof(msg), "gain %u, integration %u", gain, integrationTime);
+      TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, mismatches(gain, integrationTime), msg);
+    }
+  }
+}
+
+void test_saturated_and_unknown_settings(void)
+{
+  double lux = 1;
+  unsigned long milliLux = 1;
+  TEST_ASSERT_FALSE(light.getLux(0, 2, LTR308_SATURATED, lux));
+  TEST_ASSERT_FALSE(light.getMilliLux(0, 2, LTR308_SATURATED, milliLux));
+  TEST_ASSERT_EQUAL_UINT32(0, milliLux);
+  TEST_ASSERT_TRUE(lux == 0.0);
+
+  // An unknown gain or integration time was 0 lux and still true
+  for (byte setting = 5; setting < 8; setting++)
+  {
+    TEST_ASSERT_TRUE(light.getMilliLux(setting, 2, 1000, milliLux));
+    TEST_ASSERT_EQUAL_UINT32(0, milliLux);
+    TEST_ASSERT_TRUE(light.getMilliLux(2, setting, 1000, milliLux));
+    TEST_ASSERT_EQUAL_UINT32(0, milliLux);
+  }
+}
+
+// The compile-time getLux<>() and the double getLux() use the same table
+void test_other_getters_match(void)
+{
+  for (unsigned long ch = 0; ch < LUX_COUNTS; ch += 7)
+  {
+    unsigned long milliLux, fixed;
+    double lux;
+    light.getMilliLux(1, 2, ch, milliLux);
+    light.getLux<1, 2>(ch, fixed);
+    TEST_ASSERT_EQUAL_UINT32(milliLux, fixed);
+    light.getMilliLux(4, 0, ch, milliLux);
+    light.getLux<4, 0>(ch, fixed);
+    TEST_ASSERT_EQUAL_UINT32(milliLux, fixed);
+    light.getLux(4, 0, ch, lux);
+    TEST_ASSERT_TRUE(lux == milliLux / 1000.0);
+  }
+}
+
+template <typename Fn>
+static double nsPerCall(Fn fn)
+{
+  volatile unsigned long sink = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  uint32_t calls = 0;
+  for (byte gain = 0; gain < 5; gain++)
+  {
+    for (byte integrationTime = 0; integrationTime < 5; integrationTime++)
+    {
+      for (unsigned long ch = 0; ch < LUX_COUNTS; ch += LUX_BENCH_STEP, calls++)
+        sink = sink + fn(gain, integrationTime, ch);
+    }
+  }
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / calls;
+}
+
+static unsigned long switchLux(byte gain, byte integrationTime, unsigned long ch)
+{
+  double lux;
+  referenceLux(gain, integrationTime, ch, lux);
+  return (unsigned long)lux;
+}
+
+static unsigned long tableLux(byte gain, byte integrationTime, unsigned long ch)
+{
+  unsigned long milliLux;
+  light.getMilliLux(gain, integrationTime, ch, milliLux);
+  return milliLux;
+}
+
+void test_bench(void)
+{
+  char msg[80];
+  snprintf(msg, sizeof(msg), "ns per conversion: switch/double %.2f, table %.2f",
+           nsPerCall(switchLux), nsPerCall(tableLux));
+  TEST_MESSAGE(msg);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_every_count_matches);
+  RUN_TEST(test_saturated_and_unknown_settings);
+  RUN_TEST(test_other_getters_match);
+  RUN_TEST(test_bench);
+  return UNITY_END();
+}
@@ -0,0 +1,370 @@
+#include <chrono>
+#include <unity.h>
+#include <Arduino.h>
+#include <Wire.h>
+#include <DHT.h>
+#include <DFRobot_GP8403.h>
+#include <bl0940.h>
+#include <LTR308.h>
+#include <PCF85063TP.h>
+#include <I2C_EEPROM.h>
+#include <jigtrace.h>
+#include "jigScheduler.h"
+#include "jigQueue.h"
+#include "jigResults.h"
+#include "productionStats.h"
+#include "jigChecks.h"
+#include "models/bl0940Model.h"
+#include "models/ltr308Model.h"
+#include "models/pcf85063Model.h"
+#include "models/gp8403Model.h"
+#include "models/at24c64Model.h"
+#include "models/dht22Model.h"
+
+/*---------------------------------------------
+//   Drivers and the jig cycle on device models
+---------------------------------------------*/
+
+// Pins as wired on the fixture
+#define TEST_DHT_PIN 10
+#define TEST_CF_PIN 27
+#define TEST_LIGHT_INT_PIN 35
+
+// The models stay on their buses for the whole run, sim::reset() powers
+// them up again before every test
+static Bl0940Model meterModel(SerialEM, TEST_CF_PIN);
+static Ltr308Model lightModel(Wire1, TEST_LIGHT_INT_PIN);
+static Pcf85063Model rtcModel(Wire1);
+static At24c64Model eepModel(Wire1);
+static Gp8403Model dacModel(Wire);
+static Dht22Model dhtModel(TEST_DHT_PIN);
+
+static double hostMs()
+{
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void setUp(void)
+{
+  sim::reset();
+  meterModel.volts = 230;
+  meterModel.amps = 0.5;
+  meterModel.watts = 110;
+  meterModel.present = true;
+  meterModel.badCrcReg = -1;
+  lightModel.lux = 100;
+  dhtModel.present = true;
+  Wire.resetStats();
+  Wire1.resetStats();
+}
+
+void tearDown(void)
+{
+}
+
+/*---------------------------------------------
+//                  Clock
+---------------------------------------------*/
+
+void test_clock_only_moves_when_spent(void)
+{
+  uint32_t start = millis();
+  delay(2500);
+  TEST_ASSERT_UINT32_WITHIN(1, 2500, millis() - start);
+
+  // A polled wait ends at the first event after its deadline
+  uint32_t t0 = micros();
+  while (micros() - t0 < 1000)
+    ;
+  TEST_ASSERT_UINT32_WITHIN(2, 1000, micros() - t0);
+}
+
+void test_notify_take_wakes_at_the_event(void)
+{
+  bl0940 meter(&SerialEM, &Serial);
+  meter.setNotifyTask(xTaskGetCurrentTaskHandle());
+  TEST_ASSERT_TRUE(meter.requestReadAll());
+  uint32_t start = micros();
+  // Sleeps until the UART RX timeout after the READALL and CORNER answers
+  TEST_ASSERT_EQUAL_UINT32(1, ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000)));
+  uint32_t waited = micros() - start;
+  uint32_t byteUs = 10000000UL / BL0940_MODEL_BAUD;
+  TEST_ASSERT_UINT32_WITHIN(4 * byteUs, (4 + BL0940_SEND_MODE_FRAME_BYTES + BL0940_REG_REPLY_BYTES + 2) * byteUs, waited);
+  TEST_ASSERT_TRUE(meter.poll());
+}
+
+/*---------------------------------------------
+//                 Drivers
+---------------------------------------------*/
+
+void test_bl0940_readall(void)
+{
+  meterModel.volts = 221.5;
+  meterModel.amps = 0.42;
+  meterModel.watts = 88.0;
+  bl0940 meter(&SerialEM, &Serial);
+  TEST_ASSERT_EQUAL(NO_ERROR, meter.getState());
+
+  meter.setNotifyTask(xTaskGetCurrentTaskHandle());
+  TEST_ASSERT_TRUE(meter.requestReadAll());
+  while (!meter.poll())
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1));
+  TEST_ASSERT_EQUAL(NO_ERROR, meter.getState());
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 221.5, meter.getVoltage());
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 0.42, meter.getCurrent());
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 88.0, meter.getActivePower());
+}
+
+// READALL and CORNER are one transaction: a bad CORNER reply must not
+// leave the new READALL frame behind
+void test_bl0940_bad_reply_changes_nothing(void)
+{
+  bl0940 meter(&SerialEM, &Serial);
+  TEST_ASSERT_TRUE(meter.requestReadAll());
+  while (!meter.poll())
+    delay(1);
+  TEST_ASSERT_EQUAL(NO_ERROR, meter.getState());
+  float volts = meter.getVoltage();
+  float energy = meter.getEnergy();
+
+  meterModel.volts = 241;
+  meterModel.cfCount += 50;
+  meterModel.badCrcReg = BL0940_CORNER_REG_ADDR;
+  TEST_ASSERT_TRUE(meter.requestReadAll());
+  while (!meter.poll())
+    delay(1);
+  TEST_ASSERT_EQUAL(CRCFRAME_ERR, meter.getState());
+  TEST_ASSERT_EQUAL_FLOAT(volts, meter.getVoltage());
+  TEST_ASSERT_EQUAL_FLOAT(energy, meter.getEnergy());
+
+  meterModel.badCrcReg = -1;
+  TEST_ASSERT_TRUE(meter.requestReadAll());
+  while (!meter.poll())
+    delay(1);
+  TEST_ASSERT_EQUAL(NO_ERROR, meter.getState());
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 241, meter.getVoltage());
+  TEST_ASSERT_TRUE(meter.getEnergy() > energy);
+}
+
+void test_bl0940_unplugged_times_out(void)
+{
+  meterModel.present = false;
+  bl0940 meter(&SerialEM, &Serial);
+  TEST_ASSERT_EQUAL(COMM_ERROR, meter.getState());
+
+  TEST_ASSERT_TRUE(meter.requestReadAll());
+  uint32_t start = millis();
+  while (!meter.poll())
+    delay(1);
+  TEST_ASSERT_EQUAL(TIMEOUT_ERR, meter.getState());
+  TEST_ASSERT_UINT32_WITHIN(5, BL0940_TIMEOUT, millis() - start);
+}
+
+void test_bl0940_cf_pulses(void)
+{
+  meterModel.watts = 100;
+  bl0940 meter(&SerialEM, &Serial);
+  TEST_ASSERT_TRUE(meter.beginPulseCounter(TEST_CF_PIN));
+  pinMode(TEST_CF_PIN, INPUT);
+  // One pulse per kWhPerPulse, ten of them at 100 W
+  double pulseMs = Bl0940Model::scale::kWhPerPulse() * 3.6e9 / 100;
+  delay((uint32_t)(10.5 * pulseMs));
+  TEST_ASSERT_EQUAL_UINT32(10, meterModel.cfCount);
+  TEST_ASSERT_EQUAL_UINT64(10, meter.getTotalPulses());
+}
+
+void test_ltr308_data_ready_interrupt(void)
+{
+  lightModel.lux = 250;
+  LTR308 light(&Wire1);
+  TEST_ASSERT_TRUE(light.begin());
+  byte id = 0;
+  TEST_ASSERT_TRUE(light.getPartID(id));
+  TEST_ASSERT_EQUAL_HEX8(0xB1, id);
+  TEST_ASSERT_TRUE(light.setPowerUp());
+  // 3X, 100 ms
+  TEST_ASSERT_TRUE(light.setRange(1, 2, 2));
+  light.setNotifyTask(xTaskGetCurrentTaskHandle());
+  TEST_ASSERT_TRUE(light.beginDataReady(TEST_LIGHT_INT_PIN));
+
+  uint32_t start = millis();
+  unsigned long counts = 0;
+  TEST_ASSERT_TRUE(light.readLatest(counts, 500));
+  TEST_ASSERT_UINT32_WITHIN(3, 100, millis() - start);
+  TEST_ASSERT_EQUAL_UINT32(250 * 3 * 100 / 60, counts);
+  TEST_ASSERT_EQUAL_UINT32(1, light.getInterrupts());
+  double lux = 0;
+  TEST_ASSERT_TRUE(light.getLux(1, 2, counts, lux));
+  TEST_ASSERT_FLOAT_WITHIN(0.5, 250, lux);
+}
+
+void test_ltr308_polled_status(void)
+{
+  LTR308 light(&Wire1);
+  TEST_ASSERT_TRUE(light.begin());
+  TEST_ASSERT_TRUE(light.setPowerUp());
+  TEST_ASSERT_TRUE(light.setRange(0, 4, 0));
+  TEST_ASSERT_TRUE(light.beginDataReady(-1));
+  unsigned long counts = 0;
+  uint32_t start = millis();
+  TEST_ASSERT_TRUE(light.readLatest(counts, 100));
+  TEST_ASSERT_UINT32_WITHIN(3, 25, millis() - start);
+  TEST_ASSERT_EQUAL_UINT32(100 * 25 / 60, counts);
+}
+
+void test_pcf85063_keeps_time(void)
+{
+  PCF85063TP rtc;
+  rtc.begin(&Wire1);
+  rtc.stopClock();
+  rtc.fillByYMD(2024, 2, 28);
+  rtc.fillByHMS(23, 59, 58);
+  rtc.fillDayOfWeek(WED);
+  rtc.setTime();
+  rtc.startClock();
+
+  delay(3000);
+  rtc.getTime();
+  TEST_ASSERT_EQUAL_UINT16(24, rtc.year); // years since 2000
+  TEST_ASSERT_EQUAL_UINT8(2, rtc.month);
+  TEST_ASSERT_EQUAL_UINT8(29, rtc.dayOfMonth);
+  TEST_ASSERT_EQUAL_UINT8(0, rtc.hour);
+  TEST_ASSERT_EQUAL_UINT8(0, rtc.minute);
+  TEST_ASSERT_EQUAL_UINT8(1, rtc.second);
+  TEST_ASSERT_EQUAL_UINT8(THU, rtc.dayOfWeek);
+}
+
+void test_at24c64_block_across_pages(void)
+{
+  AT24C64<> eep;
+  uint8_t out[48], in[48];
+  for (uint8_t i = 0; i < sizeof(out); i++)
+    out[i] = i * 7 + 1;
+  uint32_t writes = eepModel.pageWrites;
+  uint32_t start = micros();
+  // 740..787 ends in the next page
+  eep.fastBlockWrite(740, out, sizeof(out));
+  eep.fastBlockRead(740, in, sizeof(in));
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(out, in, sizeof(out));
+  TEST_ASSERT_EQUAL_UINT32(2, eepModel.pageWrites - writes);
+  // The second page and the read both waited for a write cycle
+  TEST_ASSERT_TRUE(micros() - start >= 2 * AT24C64_MODEL_WRITE_US);
+}
+
+/*---------------------------------------------
+//        Jig cycle, checks of jigChecks.h
+---------------------------------------------*/
+
+// The firmware's checks on the models, main.cpp's loop() and uiTask
+// reduced to running the scheduler and filling the result table
+
+JigLog jigLog;
+static JigScheduler jig;
+static JigQueue<JigRecord, 32> resultQueue;
+static CheckResult checkResults[CHECK_COUNT];
+static ProductionStats prodStats;
+
+void postRecord(uint8_t item, bool passed, uint8_t error, float v0, float v1, float v2, float v3)
+{
+  JigRecord rec = {};
+  rec.cycle = jig.cycles();
+  rec.timeMs = millis();
+  rec.item = item;
+  rec.passed = passed;
+  rec.error = error;
+  rec.value[0] = v0;
+  rec.value[1] = v1;
+  rec.value[2] = v2;
+  rec.value[3] = v3;
+  resultQueue.push(rec);
+}
+
+// uiTask side: the result table the status screen shows
+static void drainResults()
+{
+  JigRecord rec;
+  while (resultQueue.pop(rec))
+  {
+    if (rec.item < CHECK_COUNT)
+    {
+      checkResults[rec.item].status = rec.passed ? STATUS_PASSED : STATUS_NOT_PASSED;
+      checkResults[rec.item].value = rec.value[0];
+      checkResults[rec.item].timestampMs = rec.timeMs;
+    }
+  }
+}
+
+static void runCycle()
+{
+  for (uint8_t i = 0; i < CHECK_COUNT; i++)
+    checkResults[i].status = STATUS_INITIATING;
+  jig.begin(millis());
+  // loop(): serviceSensors(), then sleep until the next tick or UART frame
+  while (!jig.run(millis()))
+  {
+    drainResults();
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1));
+  }
+  drainResults();
+  for (uint8_t i = 0; i < jig.count(); i++)
+    prodStats.addStage(i, jig.check(i).durationMs);
+  prodStats.addStage(PROD_STAGE_CYCLE, jig.cycleMs());
+}
+
+void test_jig_cycle_faster_than_real_time(void)
+{
+  dhtModel.temperature = 27.3;
+  lightModel.lux = 300;
+  // As setup() does
+  em_bl0940.setNotifyTask(xTaskGetCurrentTaskHandle());
+  light.setNotifyTask(xTaskGetCurrentTaskHandle());
+  addJigChecks(jig);
+  prodStats.reset();
+
+  double hostStart = hostMs();
+  uint64_t virtualStart = sim::now();
+  const uint8_t cycles = 5;
+  for (uint8_t c = 0; c < cycles; c++)
+  {
+    runCycle();
+    for (uint8_t i = 0; i < CHECK_COUNT; i++)
+      TEST_ASSERT_EQUAL_MESSAGE(STATUS_PASSED, checkResults[i].status, checkInfo[i].label);
+  }
+  double hostElapsed = hostMs() - hostStart;
+  double virtualElapsed = (sim::now() - virtualStart) / 1000.0;
+
+  TEST_ASSERT_FLOAT_WITHIN(0.1, 27.3, checkResults[CHECK_TEMP].value);
+  TEST_ASSERT_FLOAT_WITHIN(1, 300, checkResults[CHECK_LIGHT].value);
+  TEST_ASSERT_FLOAT_WITHIN(0.1, 230, checkResults[CHECK_ENERGY].value);
+  TEST_ASSERT_UINT32_WITHIN(3, 5000, dacModel.mV(1)); // 12 bit code
+
+  // The checks overlap: a cycle takes the DHT warm-up, not the sum
+  TEST_ASSERT_UINT32_WITHIN(50, 3000, jig.cycleMs());
+  TEST_ASSERT_TRUE(jig.cycleMs() < jig.serialMs());
+  TEST_ASSERT_EQUAL_UINT32(jig.cycleMs(), prodStats.percentile(PROD_STAGE_CYCLE, 50));
+  TEST_ASSERT_EQUAL_UINT16(cycles, prodStats.samples(PROD_STAGE_CYCLE));
+
+  // 15 s of jig time in a fraction of that on the host
+  TEST_ASSERT_TRUE(virtualElapsed >= cycles * 3000);
+  TEST_ASSERT_TRUE(hostElapsed < virtualElapsed / 10);
+  char msg[80];
+  snprintf(msg, sizeof(msg), "%u cycles: %.0f ms virtual, %.1f ms host", cycles, virtualElapsed, hostElapsed);
+  TEST_MESSAGE(msg);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_clock_only_moves_when_spent);
+  RUN_TEST(test_notify_take_wakes_at_the_event);
+  RUN_TEST(test_bl0940_readall);
+  RUN_TEST(test_bl0940_bad_reply_changes_nothing);
+  RUN_TEST(test_bl0940_unplugged_times_out);
+  RUN_TEST(test_bl0940_cf_pulses);
+  RUN_TEST(test_ltr308_data_ready_interrupt);
+  RUN_TEST(test_ltr308_polled_status);
+  RUN_TEST(test_pcf85063_keeps_time);
+  RUN_TEST(test_at24c64_block_across_pages);
+  RUN_TEST(test_jig_cycle_faster_than_real_time);
+  return UNITY_END();
+}
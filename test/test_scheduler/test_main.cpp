@@ -0,0 +1,178 @@
+#include <unity.h>
+#include "jigScheduler.h"
+#include "lightRange.h"
+
+/*---------------------------------------------
+//      JigScheduler on a millisecond clock
+---------------------------------------------*/
+
+// The checks wait as long as their main.cpp counterparts: the DHT22
+// warm-up, the LTR308 auto-range conversions and the BL0940 settle time
+// followed by READALL samples one RMS update apart. The clock advances
+// 1 ms per loop() pass like the ulTaskNotifyTake(1) tick does.
+
+#define DHT_WARMUP_MS 3000
+#define ENERGY_SETTLE_MS 1000
+#define ENERGY_SAMPLES 3    // ENERGY_MIN_SAMPLES
+#define ENERGY_RMS_MS 400   // BL0940_DEFAULT_RMS_UPDATE
+#define ENERGY_READ_MS 90   // READALL and CORNER requests and answers, 43 bytes at 4800 baud
+#define LIGHT_FIRST 4       // shortest integration, the fixture's start range
+#define LIGHT_SECOND 2      // 100 ms, where auto-range settles
+
+static uint32_t clockMs;
+
+static uint32_t lightConversionMs(uint8_t integration)
+{
+  uint16_t periodMs = lightPeriodMs[lightMeasurementRate[integration]];
+  return periodMs > lightIntegrationMs[integration] ? periodMs : lightIntegrationMs[integration];
+}
+
+static bool stepDac(JigCheck &check, uint32_t now)
+{
+  return true;
+}
+
+static bool stepTemp(JigCheck &check, uint32_t now)
+{
+  if (check.state == 0)
+  {
+    check.state = 1;
+    check.waitFor(now, DHT_WARMUP_MS);
+    return false;
+  }
+  return true;
+}
+
+static bool stepLight(JigCheck &check, uint32_t now)
+{
+  switch (check.state)
+  {
+  case 0:
+    check.state = 1;
+    check.waitFor(now, lightConversionMs(LIGHT_FIRST));
+    return false;
+  case 1:
+    // Saturated or too dark, convert again at the better range
+    check.state = 2;
+    check.waitFor(now, lightConversionMs(LIGHT_SECOND));
+    return false;
+  default:
+    return true;
+  }
+}
+
+// Odd states send a READALL, even ones have state / 2 samples
+static bool stepEnergy(JigCheck &check, uint32_t now)
+{
+  if (check.state == 0)
+  {
+    check.state = 1;
+    check.waitFor(now, ENERGY_SETTLE_MS);
+    return false;
+  }
+  if (check.state & 1)
+  {
+    check.state++;
+    check.waitFor(now, ENERGY_READ_MS);
+    return false;
+  }
+  if (check.state / 2 == ENERGY_SAMPLES)
+    return true;
+  // Next sample once the RMS registers were updated
+  check.state++;
+  check.waitFor(now, ENERGY_RMS_MS);
+  return false;
+}
+
+static bool stepNever(JigCheck &check, uint32_t now)
+{
+  return false;
+}
+
+static uint32_t runCycle(JigScheduler &jig, uint32_t limitMs)
+{
+  jig.begin(clockMs);
+  for (uint32_t i = 0; i < limitMs; i++, clockMs++)
+  {
+    if (jig.run(clockMs))
+      return jig.cycleMs();
+  }
+  return 0;
+}
+
+void setUp(void)
+{
+  clockMs = 0;
+}
+
+void tearDown(void)
+{
+}
+
+void test_cycle_is_the_longest_check(void)
+{
+  JigScheduler jig;
+  jig.add("DAC", stepDac);
+  jig.add("TEMP", stepTemp);
+  jig.add("LIGHT", stepLight);
+  jig.add("ENERGY", stepEnergy);
+  TEST_ASSERT_TRUE(runCycle(jig, 10000) > 0);
+
+  uint32_t lightMs = lightConversionMs(LIGHT_FIRST) + lightConversionMs(LIGHT_SECOND);
+  uint32_t energyMs = ENERGY_SETTLE_MS + ENERGY_SAMPLES * ENERGY_READ_MS + (ENERGY_SAMPLES - 1) * ENERGY_RMS_MS;
+  TEST_ASSERT_UINT32_WITHIN(1, 0, jig.check(0).durationMs);
+  TEST_ASSERT_UINT32_WITHIN(1, DHT_WARMUP_MS, jig.check(1).durationMs);
+  TEST_ASSERT_UINT32_WITHIN(2, lightMs, jig.check(2).durationMs);
+  TEST_ASSERT_UINT32_WITHIN(ENERGY_SAMPLES * 2, energyMs, jig.check(3).durationMs);
+
+  // Overlapped the cycle lasts as long as the DHT warm-up, back to back it
+  // would be the sum of all checks
+  TEST_ASSERT_UINT32_WITHIN(1, DHT_WARMUP_MS, jig.cycleMs());
+  TEST_ASSERT_UINT32_WITHIN(8, DHT_WARMUP_MS + lightMs + energyMs, jig.serialMs());
+  TEST_ASSERT_TRUE(jig.cycleMs() * 10 < jig.serialMs() * 6);
+  TEST_ASSERT_EQUAL_UINT32(1, jig.cycles());
+}
+
+void test_cycle_across_millis_wrap(void)
+{
+  JigScheduler jig;
+  jig.add("TEMP", stepTemp);
+  jig.add("ENERGY", stepEnergy);
+  clockMs = 0xFFFFFFFF - 1500;
+  TEST_ASSERT_UINT32_WITHIN(1, DHT_WARMUP_MS, runCycle(jig, 10000));
+  TEST_ASSERT_FALSE(jig.check(0).timedOut);
+  TEST_ASSERT_FALSE(jig.check(1).timedOut);
+}
+
+void test_stuck_check_times_out(void)
+{
+  JigScheduler jig;
+  jig.add("TEMP", stepTemp);
+  jig.add("STUCK", stepNever);
+  TEST_ASSERT_UINT32_WITHIN(1, JIG_CHECK_TIMEOUT_MS, runCycle(jig, 10000));
+  TEST_ASSERT_FALSE(jig.check(0).timedOut);
+  TEST_ASSERT_TRUE(jig.check(1).timedOut);
+}
+
+void test_cancel_does_not_count(void)
+{
+  JigScheduler jig;
+  jig.add("TEMP", stepTemp);
+  jig.begin(clockMs);
+  jig.run(clockMs);
+  jig.cancel();
+  TEST_ASSERT_FALSE(jig.running());
+  TEST_ASSERT_FALSE(jig.run(clockMs + DHT_WARMUP_MS));
+  TEST_ASSERT_EQUAL_UINT32(0, jig.cycles());
+  TEST_ASSERT_EQUAL_UINT32(1, jig.cancelled());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_cycle_is_the_longest_check);
+  RUN_TEST(test_cycle_across_millis_wrap);
+  RUN_TEST(test_stuck_check_times_out);
+  RUN_TEST(test_cancel_does_not_count);
+  return UNITY_END();
+}
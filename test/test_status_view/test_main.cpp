@@ -0,0 +1,107 @@
+#include <unity.h>
+#include <Arduino_GFX_Library.h>
+#include "statusView.h"
+
+/*---------------------------------------------
+//     StatusView pixels on a recording GFX
+---------------------------------------------*/
+
+// The recording Arduino_GFX keeps the area of every fill and glyph,
+// which is what an unbuffered ST7735 gets over SPI. A cycle is one
+// render() with the results of a finished jig cycle.
+
+static Arduino_GFX gfx(128, 160);
+static CheckResult results[CHECK_COUNT];
+
+static void setAll(CheckStatus status)
+{
+  for (uint8_t i = 0; i < CHECK_COUNT; i++)
+    results[i].status = status;
+}
+
+// SPI bytes of one render(), checked against the view's own count
+static uint32_t renderBytes(StatusView &view)
+{
+  gfx.resetStats();
+  view.render(results);
+  TEST_ASSERT_EQUAL_UINT32(gfx.spiBytes(), view.bytes());
+  return gfx.spiBytes();
+}
+
+void setUp(void)
+{
+  gfx.setRotation(1);
+  gfx.resetStats();
+  setAll(STATUS_PASSED);
+}
+
+void tearDown(void)
+{
+}
+
+void test_identical_cycles_send_nothing(void)
+{
+  StatusView view(&gfx, WHITE, GREEN, RED, YELLOW, BLACK);
+  uint32_t full = renderBytes(view);
+  // Screen, header and the result cells
+  TEST_ASSERT_TRUE(full >= 160UL * 128 * 2);
+  TEST_ASSERT_EQUAL_UINT32(0, renderBytes(view));
+  TEST_ASSERT_EQUAL_UINT32(0, renderBytes(view));
+  TEST_ASSERT_EQUAL_UINT32(full, view.totalBytes());
+}
+
+void test_one_changed_cell(void)
+{
+  StatusView view(&gfx, WHITE, GREEN, RED, YELLOW, BLACK);
+  uint32_t full = renderBytes(view);
+  renderBytes(view);
+
+  results[CHECK_LIGHT].status = STATUS_NOT_PASSED;
+  uint32_t changed = renderBytes(view);
+  // Only the light cell: its background and "NOT PASSED"
+  const std::vector<GfxOp> &ops = gfx.ops();
+  TEST_ASSERT_TRUE(ops.size() > 1);
+  for (size_t i = 0; i < ops.size(); i++)
+  {
+    TEST_ASSERT_TRUE(ops[i].y >= checkInfo[CHECK_LIGHT].y);
+    TEST_ASSERT_TRUE(ops[i].y + ops[i].h <= checkInfo[CHECK_LIGHT].y + STATUS_VIEW_CELL_H);
+  }
+  uint32_t cellW = 160 - STATUS_VIEW_CELL_X;
+  TEST_ASSERT_EQUAL_UINT32((cellW * STATUS_VIEW_CELL_H + 10 * STATUS_VIEW_FONT_W * STATUS_VIEW_FONT_H) * 2, changed);
+
+  // Against redrawing the whole screen every cycle, as before
+  char msg[80];
+  snprintf(msg, sizeof(msg), "full %u bytes, one cell %u bytes", (unsigned)full, (unsigned)changed);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_TRUE(changed * 10 < full);
+}
+
+void test_invalidate_redraws(void)
+{
+  StatusView view(&gfx, WHITE, GREEN, RED, YELLOW, BLACK);
+  uint32_t full = renderBytes(view);
+  view.invalidate();
+  TEST_ASSERT_EQUAL_UINT32(full, renderBytes(view));
+}
+
+void test_footer_only_when_changed(void)
+{
+  StatusView view(&gfx, WHITE, GREEN, RED, YELLOW, BLACK);
+  view.setFooter("12.3 boards/h");
+  renderBytes(view);
+  view.setFooter("12.3 boards/h");
+  TEST_ASSERT_EQUAL_UINT32(0, renderBytes(view));
+  view.setFooter("12.4 boards/h");
+  TEST_ASSERT_EQUAL_UINT32((160UL * STATUS_VIEW_FONT_H + 13 * STATUS_VIEW_FONT_W * STATUS_VIEW_FONT_H) * 2,
+                           renderBytes(view));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_identical_cycles_send_nothing);
+  RUN_TEST(test_one_changed_cell);
+  RUN_TEST(test_invalidate_redraws);
+  RUN_TEST(test_footer_only_when_changed);
+  return UNITY_END();
+}
@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+"""Turn the jig's binary log (BINARY_LOG in src/defVar.h) back into text.
+
+The format table is read from src/jigLog.h, so the decoder always matches
+the firmware it was checked out with. Bytes outside of log frames (boot
+messages, CSV exports) are passed through unchanged.
+
+    python3 tools/jiglog_decode.py capture.bin
+    python3 tools/jiglog_decode.py --port /dev/ttyUSB0   # needs pyserial
+"""
+
+import argparse
+import codecs
+import os
+import re
+import struct
+import sys
+
+SYNC = b"\xa5\x5a"
+HEADER_LEN = 9
+MAX_ARGS = 6
+SPEC = re.compile(r"%%|%[-+ #0]*\d*(?:\.\d+)?([dufxX])")
+
+
+def load_formats(header):
+    with open(header) as f:
+        text = f.read()
+    block = text[text.index("#define JIG_LOG_FORMATS(X)"):]
+    block = block[:block.index("\n\n")]
+    formats = []
+    for m in re.finditer(r"X\((\w+),((?:\s*\"(?:[^\"\\]|\\.)*\"\s*\\?)+)\)", block):
+        parts = re.findall(r"\"((?:[^\"\\]|\\.)*)\"", m.group(2))
+        fmt = codecs.decode("".join(parts), "unicode_escape")
+        formats.append((m.group(1), fmt))
+    return formats
+
+
+def render(fmt, words):
+    args = iter(words)
+
+    def conv(m):
+        if m.group(0) == "%%":
+            return "%"
+        w = next(args, 0)
+        kind = m.group(1)
+        if kind == "f":
+            value = struct.unpack("<f", struct.pack("<I", w))[0]
+        elif kind == "d":
+            value = struct.unpack("<i", struct.pack("<I", w))[0]
+        else:
+            value = w
+        return (m.group(0)[:-1] + kind.replace("u", "d")) % value
+
+    return SPEC.sub(conv, fmt)
+
+
+def decode(read, formats, out, timestamps):
+    buf = b""
+    while True:
+        chunk = read()
+        if not chunk:
+            break
+        buf += chunk
+        while True:
+            pos = buf.find(SYNC)
+            if pos < 0:
+                # keep a trailing 0xA5, it may start the next frame
+                keep = 1 if buf.endswith(SYNC[:1]) else 0
+                out.write(buf[:len(buf) - keep].decode("latin-1"))
+                buf = buf[len(buf) - keep:]
+                break
+            out.write(buf[:pos].decode("latin-1"))
+            buf = buf[pos:]
+            if len(buf) < HEADER_LEN:
+                break
+            fid, argc, ms = struct.unpack_from("<HBI", buf, 2)
+            if fid >= len(formats) or argc > MAX_ARGS:
+                out.write(buf[:1].decode("latin-1"))
+                buf = buf[1:]
+                continue
+            end = HEADER_LEN + 4 * argc
+            if len(buf) < end:
+                break
+            words = struct.unpack_from("<%dI" % argc, buf, HEADER_LEN)
+            text = render(formats[fid][1], words)
+            if timestamps:
+                text = "\n".join("[%10.3f] %s" % (ms / 1000.0, line) for line in text.split("\n"))
+            out.write(text + "\n")
+            buf = buf[end:]
+        out.flush()
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("capture", nargs="?", help="raw capture file, stdin if omitted")
+    parser.add_argument("--port", help="read from a serial port instead")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--header", default=os.path.join(here, "..", "src", "jigLog.h"))
+    parser.add_argument("-t", "--timestamps", action="store_true", help="prefix lines with the board millis()")
+    args = parser.parse_args()
+
+    formats = load_formats(args.header)
+    if args.port:
+        import serial
+        port = serial.Serial(args.port, args.baud, timeout=None)
+        read = lambda: port.read(max(1, port.in_waiting))
+    else:
+        stream = open(args.capture, "rb") if args.capture else sys.stdin.buffer
+        read = lambda: stream.read(256)
+    try:
+        decode(read, formats, sys.stdout, args.timestamps)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()